@@ -0,0 +1,356 @@
+/*************************************
+ * MPI-Bash persistent channels      *
+ *                                   *
+ * By Scott Pakin <pakin@lanl.gov>   *
+ *************************************/
+
+#include "mpibash.h"
+#include <stdint.h>
+#include <limits.h>
+
+/* Describe one end of a channel to a peer.  Each direction uses a
+ * persistent request on a preallocated buffer of the form [uint32_t
+ * length][data].  Messages too large for the buffer send only the
+ * length in the buffer; the data follow in an ordinary message. */
+typedef struct {
+  int in_use;                   /* 1=entry is allocated; 0=entry is free */
+  int peer;                     /* Rank at the other end of the channel */
+  int tag;                      /* Tag used in both directions */
+  int capacity;                 /* Maximum data bytes per buffer */
+  char *send_buffer;            /* Buffer for outgoing messages */
+  char *recv_buffer;            /* Buffer for incoming messages */
+  MPI_Request send_request;     /* Persistent send of send_buffer */
+  MPI_Request recv_request;     /* Persistent receive into recv_buffer, always started */
+} channel_t;
+
+static channel_t *channel_table = NULL;   /* All channels, indexed by handle */
+static int channel_table_size = 0;        /* Number of entries allocated in the above */
+
+/* Parse a channel handle.  Return 1 on success, 0 on failure. */
+static int
+parse_channel (char *word, int *handle)
+{
+  intmax_t n;
+
+  if (!legal_number(word, &n) || n < 0 || n >= channel_table_size
+      || !channel_table[n].in_use) {
+    builtin_error(_("%s: invalid channel handle"), word);
+    return 0;
+  }
+  *handle = (int) n;
+  return 1;
+}
+
+/* Open a persistent channel to another rank. */
+static int
+mpi_channel_open_builtin (WORD_LIST *list)
+{
+  intmax_t peer;                /* Rank at the other end of the channel */
+  intmax_t tag;                 /* Tag to use in both directions */
+  intmax_t capacity = 1024;     /* Maximum data bytes per preallocated buffer */
+  char *varname;                /* Name of the variable to bind the handle to */
+  channel_t *chan;              /* New channel */
+  int handle;                   /* Channel handle */
+  int opt;                      /* Parsed option */
+  int mpierr;
+
+  /* Parse any options provided. */
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "s:")) != -1) {
+    switch (opt) {
+      case 's':
+        if (!legal_number(list_optarg, &capacity) || capacity < 0
+            || capacity > INT_MAX - (intmax_t)sizeof(uint32_t)) {
+          builtin_error(_("-s: invalid buffer size"));
+          return (EX_USAGE);
+        }
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+
+  /* Parse the peer rank, tag, and target variable. */
+  YES_ARGS(list);
+  if (!legal_number(list->word->word, &peer) || peer < 0
+      || peer >= mpibash_num_ranks) {
+    builtin_error(_("mpi_channel_open: invalid rank %s"), list->word->word);
+    return (EX_USAGE);
+  }
+  list = list->next;
+  YES_ARGS(list);
+  if (!legal_number(list->word->word, &tag) || tag < 0) {
+    builtin_error(_("mpi_channel_open: invalid tag %s"), list->word->word);
+    return (EX_USAGE);
+  }
+  list = list->next;
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  no_args(list);
+
+  /* Messages on two channels with the same peer and tag would be
+   * indistinguishable. */
+  for (handle = 0; handle < channel_table_size; handle++)
+    if (channel_table[handle].in_use && channel_table[handle].peer == peer
+        && channel_table[handle].tag == tag) {
+      builtin_error(_("a channel to rank %d with tag %d is already open"),
+                    (int) peer, (int) tag);
+      return EXECUTION_FAILURE;
+    }
+
+  /* Allocate a table entry, reusing a free one if possible. */
+  for (handle = 0; handle < channel_table_size; handle++)
+    if (!channel_table[handle].in_use)
+      break;
+  if (handle == channel_table_size) {
+    int newsize = channel_table_size == 0 ? 8 : channel_table_size*2;
+
+    channel_table = realloc(channel_table, newsize*sizeof(channel_t));
+    memset(&channel_table[channel_table_size], 0,
+           (newsize - channel_table_size)*sizeof(channel_t));
+    channel_table_size = newsize;
+  }
+
+  /* Create the persistent requests and pre-post the first receive. */
+  chan = &channel_table[handle];
+  chan->peer = (int) peer;
+  chan->tag = (int) tag;
+  chan->capacity = (int) capacity;
+  chan->send_buffer = malloc(sizeof(uint32_t) + capacity);
+  chan->recv_buffer = malloc(sizeof(uint32_t) + capacity);
+  chan->send_request = MPI_REQUEST_NULL;
+  chan->recv_request = MPI_REQUEST_NULL;
+  MPI_TIMED(mpierr, MPI_Send_init(chan->send_buffer,
+                                  sizeof(uint32_t) + chan->capacity, MPI_BYTE,
+                                  chan->peer, chan->tag, mpibash_channel_comm,
+                                  &chan->send_request));
+  if (mpierr == MPI_SUCCESS)
+    MPI_TIMED(mpierr, MPI_Recv_init(chan->recv_buffer,
+                                    sizeof(uint32_t) + chan->capacity, MPI_BYTE,
+                                    chan->peer, chan->tag, mpibash_channel_comm,
+                                    &chan->recv_request));
+  if (mpierr == MPI_SUCCESS)
+    MPI_TIMED(mpierr, MPI_Start(&chan->recv_request));
+  if (mpierr != MPI_SUCCESS) {
+    if (chan->recv_request != MPI_REQUEST_NULL)
+      MPI_Request_free(&chan->recv_request);
+    if (chan->send_request != MPI_REQUEST_NULL)
+      MPI_Request_free(&chan->send_request);
+    free(chan->send_buffer);
+    free(chan->recv_buffer);
+    return mpibash_report_mpi_error(mpierr);
+  }
+  chan->in_use = 1;
+  mpibash_bind_variable_number(varname, handle, 0);
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_channel_open builtin. */
+static char *mpi_channel_open_doc[] = {
+  "Open a persistent communication channel to another process.",
+  "",
+  "Options:",
+  "  -s BYTES      Preallocate buffers for messages of up to BYTES bytes",
+  "                (default: 1024).  Longer messages are still delivered",
+  "                but require an additional MPI message.",
+  "",
+  "Arguments:",
+  "  RANK          Rank at the other end of the channel.",
+  "",
+  "  TAG           Nonnegative integer distinguishing this channel from",
+  "                others to the same rank.",
+  "",
+  "  NAME          Scalar variable in which to receive a channel handle.",
+  "",
+  "Both ends of a channel must open it with the same TAG and BYTES.",
+  "mpi_channel_send and mpi_channel_recv then merely start and complete",
+  "MPI persistent requests, which makes channels the fastest way to",
+  "exchange messages in a tight loop.  Channel messages are independent",
+  "of those sent with mpi_send.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_channel_open builtin. */
+DEFINE_BUILTIN(mpi_channel_open, "mpi_channel_open [-s bytes] rank tag name");
+
+/* Send a message on a channel. */
+static int
+mpi_channel_send_builtin (WORD_LIST *list)
+{
+  channel_t *chan;              /* Channel to send on */
+  char *message;                /* Message to send */
+  size_t len;                   /* Number of bytes in the above */
+  uint32_t len32;               /* Length header */
+  int handle;                   /* Channel handle */
+
+  /* Parse the channel and message. */
+  YES_ARGS(list);
+  if (!parse_channel(list->word->word, &handle))
+    return (EX_USAGE);
+  list = list->next;
+  YES_ARGS(list);
+  message = list->word->word;
+  list = list->next;
+  no_args(list);
+  chan = &channel_table[handle];
+
+  /* Fill in and send the preallocated buffer.  Send long messages'
+   * contents separately. */
+  len = strlen(message);
+  if (len > UINT32_MAX || len > INT_MAX) {
+    builtin_error(_("message too long for a channel"));
+    return EXECUTION_FAILURE;
+  }
+  len32 = (uint32_t) len;
+  memcpy(chan->send_buffer, &len32, sizeof(uint32_t));
+  if (len <= (size_t)chan->capacity)
+    memcpy(chan->send_buffer + sizeof(uint32_t), message, len);
+  MPI_TRY(MPI_Start(&chan->send_request));
+  MPI_TRY(MPI_Wait(&chan->send_request, MPI_STATUS_IGNORE));
+  if (len > (size_t)chan->capacity)
+    MPI_TRY(MPI_Send(message, (int) len, MPI_BYTE, chan->peer, chan->tag,
+                     mpibash_channel_comm));
+  mpibash_stats_bytes(mpibash_channel_comm, chan->peer, (long) len);
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_channel_send builtin. */
+static char *mpi_channel_send_doc[] = {
+  "Send a message on a persistent channel.",
+  "",
+  "Arguments:",
+  "  CHANNEL       Channel handle returned by mpi_channel_open.",
+  "",
+  "  MESSAGE       String to send to the rank at the other end of CHANNEL.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_channel_send builtin. */
+DEFINE_BUILTIN(mpi_channel_send, "mpi_channel_send channel message");
+
+/* Receive a message from a channel. */
+static int
+mpi_channel_recv_builtin (WORD_LIST *list)
+{
+  channel_t *chan;              /* Channel to receive from */
+  char *varname;                /* Name of the variable to bind the message to */
+  char *message;                /* Message received */
+  uint32_t len;                 /* Number of bytes in the above */
+  int handle;                   /* Channel handle */
+  int mpierr;
+
+  /* Parse the channel and target variable. */
+  YES_ARGS(list);
+  if (!parse_channel(list->word->word, &handle))
+    return (EX_USAGE);
+  list = list->next;
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  no_args(list);
+  chan = &channel_table[handle];
+
+  /* Complete the pre-posted receive.  Receive a long message's
+   * contents before reposting so the reposted receive can't match
+   * them. */
+  MPI_TRY(MPI_Wait(&chan->recv_request, MPI_STATUS_IGNORE));
+  memcpy(&len, chan->recv_buffer, sizeof(uint32_t));
+  message = malloc(len + 1);
+  if (len <= (uint32_t)chan->capacity)
+    memcpy(message, chan->recv_buffer + sizeof(uint32_t), len);
+  else {
+    MPI_TIMED(mpierr, MPI_Recv(message, (int) len, MPI_BYTE, chan->peer, chan->tag,
+                               mpibash_channel_comm, MPI_STATUS_IGNORE));
+    if (mpierr != MPI_SUCCESS) {
+      free(message);
+      return mpibash_report_mpi_error(mpierr);
+    }
+  }
+  message[len] = '\0';
+  mpibash_stats_bytes(mpibash_channel_comm, chan->peer, (long) len);
+  mpierr = MPI_Start(&chan->recv_request);
+  bind_variable(varname, message, 0);
+  free(message);
+  if (mpierr != MPI_SUCCESS)
+    return mpibash_report_mpi_error(mpierr);
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_channel_recv builtin. */
+static char *mpi_channel_recv_doc[] = {
+  "Receive a message from a persistent channel.",
+  "",
+  "Arguments:",
+  "  CHANNEL       Channel handle returned by mpi_channel_open.",
+  "",
+  "  NAME          Scalar variable in which to receive the message.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_channel_recv builtin. */
+DEFINE_BUILTIN(mpi_channel_recv, "mpi_channel_recv channel name");
+
+/* Close a channel and free its resources. */
+static int
+mpi_channel_close_builtin (WORD_LIST *list)
+{
+  channel_t *chan;              /* Channel to close */
+  MPI_Status status;            /* Status of the canceled receive */
+  int cancelled;                /* 1=receive was canceled; 0=it had completed */
+  int handle;                   /* Channel handle */
+
+  /* Parse the channel. */
+  YES_ARGS(list);
+  if (!parse_channel(list->word->word, &handle))
+    return (EX_USAGE);
+  list = list->next;
+  no_args(list);
+  chan = &channel_table[handle];
+
+  /* Cancel the pre-posted receive and free everything.  The channel
+   * remains open if the receive can't be canceled. */
+  MPI_TRY(MPI_Cancel(&chan->recv_request));
+  MPI_TRY(MPI_Wait(&chan->recv_request, &status));
+  MPI_TRY(MPI_Test_cancelled(&status, &cancelled));
+  chan->in_use = 0;
+  MPI_TRY(MPI_Request_free(&chan->recv_request));
+  MPI_TRY(MPI_Request_free(&chan->send_request));
+  free(chan->send_buffer);
+  free(chan->recv_buffer);
+  if (!cancelled) {
+    builtin_error(_("discarded a message that arrived on the channel before it was closed"));
+    return EXECUTION_FAILURE;
+  }
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_channel_close builtin. */
+static char *mpi_channel_close_doc[] = {
+  "Close a persistent channel.",
+  "",
+  "Arguments:",
+  "  CHANNEL       Channel handle returned by mpi_channel_open.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given, an error occurs, or a",
+  "message arrived on CHANNEL that was never received.",
+  NULL
+};
+
+/* Describe the mpi_channel_close builtin. */
+DEFINE_BUILTIN(mpi_channel_close, "mpi_channel_close channel");
@@ -36,17 +36,30 @@ static char *all_circle_builtins[] = {  /* All builtins that Circle-Bash defines
   NULL
 };
 
+static char *all_circle_callbacks[] = {  /* Names under which mpi_stats reports each callback */
+  "cb_create",
+  "cb_process",
+  "cb_reduce_init",
+  "cb_reduce_op",
+  "cb_reduce_fini",
+  NULL
+};
+
 /* Invoke the user-defined creation-callback function (circlebash_create_func). */
 static void
 internal_create_func (CIRCLE_handle * handle)
 {
+  static mpibash_stats_t *stats = NULL;      /* Statistics of this callback */
+  mpibash_stats_frame_t frame;  /* Builtin the callback interrupted */
   WORD_LIST *funcargs;
 
   if (circlebash_create_func == NULL)
     return;
   circlebash_current_handle = handle;
   funcargs = make_word_list(make_word("cb_create"), NULL);
+  mpibash_stats_enter(&stats, "cb_create", &frame);
   execute_shell_function(circlebash_create_func, funcargs);
+  mpibash_stats_leave(&frame);
   dispose_words(funcargs);
   circlebash_current_handle = NULL;
 }
@@ -55,13 +68,17 @@ internal_create_func (CIRCLE_handle * handle)
 static void
 internal_process_func (CIRCLE_handle * handle)
 {
+  static mpibash_stats_t *stats = NULL;      /* Statistics of this callback */
+  mpibash_stats_frame_t frame;  /* Builtin the callback interrupted */
   WORD_LIST *funcargs;
 
   if (circlebash_process_func == NULL)
     return;
   circlebash_current_handle = handle;
   funcargs = make_word_list(make_word("cb_process"), NULL);
+  mpibash_stats_enter(&stats, "cb_process", &frame);
   execute_shell_function(circlebash_process_func, funcargs);
+  mpibash_stats_leave(&frame);
   dispose_words(funcargs);
   circlebash_current_handle = NULL;
 }
@@ -71,13 +88,17 @@ internal_process_func (CIRCLE_handle * handle)
 static void
 internal_reduce_init_func (void)
 {
+  static mpibash_stats_t *stats = NULL;      /* Statistics of this callback */
+  mpibash_stats_frame_t frame;  /* Builtin the callback interrupted */
   WORD_LIST *funcargs;
 
   if (circlebash_reduce_init_func == NULL)
     return;
   circlebash_within_reduction = 1;
   funcargs = make_word_list(make_word("cb_reduce_init"), NULL);
+  mpibash_stats_enter(&stats, "cb_reduce_init", &frame);
   execute_shell_function(circlebash_reduce_init_func, funcargs);
+  mpibash_stats_leave(&frame);
   dispose_words(funcargs);
   circlebash_within_reduction = 0;
 }
@@ -87,6 +108,8 @@ internal_reduce_init_func (void)
 static void
 internal_reduce_op_func (const void *buf1, size_t size1, const void *buf2, size_t size2)
 {
+  static mpibash_stats_t *stats = NULL;      /* Statistics of this callback */
+  mpibash_stats_frame_t frame;  /* Builtin the callback interrupted */
   WORD_LIST *funcargs;
 
   if (circlebash_reduce_op_func == NULL)
@@ -95,7 +118,9 @@ internal_reduce_op_func (const void *buf1, size_t size1, const void *buf2, size_
   funcargs = make_word_list(make_word(buf2), NULL);
   funcargs = make_word_list(make_word(buf1), funcargs);
   funcargs = make_word_list(make_word("cb_reduce_op"), funcargs);
+  mpibash_stats_enter(&stats, "cb_reduce_op", &frame);
   execute_shell_function(circlebash_reduce_op_func, funcargs);
+  mpibash_stats_leave(&frame);
   dispose_words(funcargs);
   circlebash_within_reduction = 0;
 }
@@ -105,38 +130,20 @@ internal_reduce_op_func (const void *buf1, size_t size1, const void *buf2, size_
 static void
 internal_reduce_fini_func (const void *buf, size_t size)
 {
+  static mpibash_stats_t *stats = NULL;      /* Statistics of this callback */
+  mpibash_stats_frame_t frame;  /* Builtin the callback interrupted */
   WORD_LIST *funcargs;
 
   if (circlebash_reduce_fini_func == NULL)
     return;
   funcargs = make_word_list(make_word(buf), NULL);
   funcargs = make_word_list(make_word("cb_reduce_fini"), funcargs);
+  mpibash_stats_enter(&stats, "cb_reduce_fini", &frame);
   execute_shell_function(circlebash_reduce_fini_func, funcargs);
+  mpibash_stats_leave(&frame);
   dispose_words(funcargs);
 }
 
-/* Load another builtin from our plugin by invoking "enable -f
- * circlebash.so <name>". */
-static int
-load_circle_builtin (char *name)
-{
-  static char *circlebash_so = NULL;   /* Path to circlebash.so */
-
-  /* Find our .so file name. */
-  if (circlebash_so == NULL) {
-    Dl_info self_info;
-
-    if (dladdr(load_circle_builtin, &self_info) == 0 || self_info.dli_fname == NULL) {
-      fprintf(stderr, _("circle_init: failed to find the Circle-Bash .so file\n"));
-      return EXECUTION_FAILURE;
-    }
-    circlebash_so = strdup(self_info.dli_fname);
-  }
-
-  /* Enable the given Circle-Bash function. */
-  return mpibash_invoke_bash_command("enable", "-f", circlebash_so, name, NULL);
-}
-
 /* Initialize Circle-Bash. */
 static int
 circle_init_builtin (WORD_LIST *list)
@@ -147,8 +154,15 @@ circle_init_builtin (WORD_LIST *list)
   int circle_rank;              /* Rank in the Libcircle job */
   char **func;
 
-  /* Initialize Libcircle. */
+  /* Exclude MPI-Bash's progress thread, if any, while our builtins
+   * run, as Libcircle calls MPI. */
   no_args(list);
+  if (!mpibash_share_builtin_lock()) {
+    builtin_error(_("failed to find MPI-Bash's builtin lock"));
+    return EXECUTION_FAILURE;
+  }
+
+  /* Initialize Libcircle. */
   circle_rank = CIRCLE_init(margc, margv, CIRCLE_DEFAULT_FLAGS);
   mpibash_bind_variable_number("circle_rank", circle_rank, 0);
   CIRCLE_enable_logging(CIRCLE_LOG_WARN);
@@ -161,10 +175,15 @@ circle_init_builtin (WORD_LIST *list)
   CIRCLE_cb_reduce_op(internal_reduce_op_func);
   CIRCLE_cb_reduce_fini(internal_reduce_fini_func);
 
-  /* As a convenience for the user, load all of the other MPI-Bash builtins. */
-  for (func = all_circle_builtins; *func; func++)
-    if (load_circle_builtin(*func) != EXECUTION_SUCCESS)
-      return EXECUTION_FAILURE;
+  /* As a convenience for the user, load all of the other Circle-Bash
+   * builtins in a single pass. */
+  if (mpibash_register_builtins(circle_init_builtin, all_circle_builtins) != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+
+  /* Account for the callbacks (see mpi_stats) in the same order on
+   * every rank, even those that never invoke some of them. */
+  for (func = all_circle_callbacks; *func; func++)
+    mpibash_stats_lookup(*func);
 
   return EXECUTION_SUCCESS;
 }
@@ -174,6 +193,8 @@ static char *circle_init_doc[] = {
   "Initialize Circle-Bash.",
   "",
   "Invoke CIRCLE_init() then load all of the other Circle-Bash builtins.",
+  "When using mpi_init -t, invoke circle_init after mpi_init so that",
+  "Circle-Bash's builtins exclude the progress thread as well.",
   "",
   "Exit Status:",
   "Returns success if Libcircle successfully initialized and all Libcircle",
@@ -5,13 +5,25 @@
  ***********************************/
 
 #include "mpibash.h"
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/stat.h>
 
 /* Synchronize all of the MPI ranks. */
 static int
 mpi_barrier_builtin (WORD_LIST * list)
 {
+  mpibash_comm_t comm;          /* Communicator to synchronize */
+
+  if (mpibash_parse_comm_option(&list, &comm) != EXECUTION_SUCCESS)
+    return (EX_USAGE);
   no_args(list);
-  MPI_TRY(MPI_Barrier(MPI_COMM_WORLD));
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  MPI_TRY(MPI_Barrier(comm.comm));
   return EXECUTION_SUCCESS;
 }
 
@@ -19,6 +31,9 @@ mpi_barrier_builtin (WORD_LIST * list)
 static char *mpi_barrier_doc[] = {
   "Synchronizes all of the processes in the MPI job.",
   "",
+  "Options:",
+  "  -c COMM       Synchronize only the processes in communicator COMM.",
+  "",
   "No process will return from mpi_barrier until all processes have",
   "called mpi_barrier.",
   "",
@@ -28,25 +43,186 @@ static char *mpi_barrier_doc[] = {
 };
 
 /* Describe the mpi_barrier builtin. */
-DEFINE_BUILTIN(mpi_barrier, "mpi_barrier");
+DEFINE_BUILTIN(mpi_barrier, "mpi_barrier [-c comm]");
+
+/* Broadcast the contents of a file or file descriptor from ROOT in
+ * chunks across communicator COMM.  Each chunk's length is broadcast
+ * first; a length of 0 ends the stream, and a length of -1 ends it
+ * because the root failed to read its source.  On the root, SRC provides the
+ * chunks, and reading the next chunk overlaps with broadcasting the
+ * current one.  Everywhere, the chunks are written to FD unless it is
+ * -1.  Elsewhere than the root, if FD is -1, the chunks are instead
+ * accumulated into a newly allocated, NUL-terminated *BUFFER or, if
+ * BUFFER is NULL, discarded.  Consuming a chunk overlaps with
+ * broadcasting the next one.  Store the total number of bytes
+ * broadcast in *TOTAL. */
+static int
+bcast_stream (int root, MPI_Comm comm, mpibash_source_t *src, int fd,
+              char **buffer, size_t *total)
+{
+  static char *chunks[2] = {NULL, NULL};        /* Double-buffered chunk data */
+  MPI_Request request = MPI_REQUEST_NULL;       /* Broadcast of the current chunk */
+  char *chunk = NULL;           /* Current chunk */
+  long len = 0;                 /* Number of bytes in the above */
+  char *prev = NULL;            /* Previous chunk, awaiting consumption */
+  long prev_len = 0;            /* Number of bytes in the above */
+  int cur = 0;                  /* Index into chunks of the current chunk */
+  int rank;                     /* Our rank in comm */
+  int result = EXECUTION_SUCCESS;
+
+  *total = 0;
+  MPI_TRY(MPI_Comm_rank(comm, &rank));
+  if (rank == root) {
+    /* Root: read and broadcast each chunk in turn. */
+    len = mpibash_read_chunk(src, &chunk);
+    while (1) {
+      char *next;               /* Next chunk */
+      long next_len;            /* Number of bytes in the above */
+
+      if (len == -1)
+        result = EXECUTION_FAILURE;
+      MPI_TRY(MPI_Bcast(&len, 1, MPI_LONG, root, comm));
+      if (len <= 0)
+        break;
+      MPI_TRY(MPI_Ibcast(chunk, (int) len, MPI_BYTE, root, comm, &request));
+      if (fd != -1 && result == EXECUTION_SUCCESS)
+        result = mpibash_write_all(fd, chunk, len);
+      next_len = mpibash_read_chunk(src, &next);
+      MPI_TRY(MPI_Wait(&request, MPI_STATUS_IGNORE));
+      *total += len;
+      chunk = next;
+      len = next_len;
+    }
+    return result;
+  }
+
+  /* Non-root: receive each chunk while consuming the previous one. */
+  if (chunks[0] == NULL) {
+    chunks[0] = malloc(MPIBASH_CHUNK_SIZE);
+    chunks[1] = malloc(MPIBASH_CHUNK_SIZE);
+  }
+  if (fd == -1 && buffer != NULL)
+    *buffer = NULL;
+  while (1) {
+    MPI_TRY(MPI_Bcast(&len, 1, MPI_LONG, root, comm));
+    if (len > 0)
+      MPI_TRY(MPI_Ibcast(chunks[cur], (int) len, MPI_BYTE, root, comm,
+                         &request));
+    if (prev != NULL) {
+      if (fd != -1) {
+        if (result == EXECUTION_SUCCESS)
+          result = mpibash_write_all(fd, prev, prev_len);
+      }
+      else if (buffer != NULL) {
+        *buffer = realloc(*buffer, *total + prev_len + 1);
+        memcpy(*buffer + *total, prev, prev_len);
+        (*buffer)[*total + prev_len] = '\0';
+      }
+      *total += prev_len;
+    }
+    if (len == -1) {
+      builtin_error(_("rank %d failed to read the data it was broadcasting"), root);
+      result = EXECUTION_FAILURE;
+    }
+    if (len <= 0)
+      break;
+    MPI_TRY(MPI_Wait(&request, MPI_STATUS_IGNORE));
+    prev = chunks[cur];
+    prev_len = len;
+    cur = 1 - cur;
+  }
+  if (fd == -1 && buffer != NULL && *buffer == NULL)
+    *buffer = strdup("");
+  return result;
+}
+
+/* Define the size of the header that mpi_bcast -r broadcasts ahead of
+ * a message.  The header holds the message length and, if the message
+ * fits, the message itself. */
+#define BCAST_HEADER_SIZE 1024
 
 /* Broadcast a message from one rank to all the others. */
 static int
 mpi_bcast_builtin (WORD_LIST *list)
 {
   int root;                     /* MPI root rank */
+  intmax_t given_root = -1;     /* Root specified with -r or -1 if none */
+  static char *header = NULL;   /* Length and possibly contents of the message */
+  int64_t hdrlen;               /* Message length in the above (-1=stream) */
+  int inline_msg;               /* 1=message was contained in the header */
   char *root_message;           /* Message to broadcast */
   int msglen;                   /* Length in bytes of the above (including the NULL byte) */
   char *varname;                /* Name of the variable to bind the results to */
-  static int *all_lengths = NULL;       /* List of every rank's msglen */
+  static int *all_lengths = NULL;       /* List of every rank's msglen (sized for all processes) */
   static char *message = NULL;  /* Message received from the root */
   static int alloced = 0;       /* Bytes allocated for the above */
+  char *infile = NULL;          /* File whose contents should be broadcast */
+  int infd = -1;                /* File descriptor whose contents should be broadcast */
+  char *outfile = NULL;         /* File to which to write the broadcast data */
+  int outfd = -1;               /* File descriptor corresponding to the above */
+  mpibash_source_t src;         /* Source of streamed contents */
+  char *contents = NULL;        /* Streamed contents */
+  size_t total;                 /* Number of bytes in the above */
+  mpibash_comm_t comm;          /* Communicator to broadcast across */
+  int sink_failed = 0;          /* 1=outfile could not be opened */
+  int result;
+  int opt;                      /* Parsed option */
   int i;
 
+  /* Parse any options provided. */
+  mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "c:f:F:o:r:")) != -1) {
+    switch (opt) {
+      case 'c':
+        if (!mpibash_parse_comm(list_optarg, &comm))
+          return (EX_USAGE);
+        break;
+
+      case 'f':
+        infile = list_optarg;
+        break;
+
+      case 'F':
+        if (!mpibash_parse_fd(list_optarg, &infd))
+          return (EX_USAGE);
+        break;
+
+      case 'o':
+        outfile = list_optarg;
+        break;
+
+      case 'r':
+        if (!legal_number(list_optarg, &given_root) || given_root < 0) {
+          builtin_error(_("-r: nonnegative rank required"));
+          return (EX_USAGE);
+        }
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+  if (given_root >= comm.size) {
+    builtin_error(_("-r: rank in the range [0, %d] required"), comm.size - 1);
+    return (EX_USAGE);
+  }
+  if (infile != NULL && infd != -1) {
+    builtin_error(_("-f and -F are mutually exclusive"));
+    return (EX_USAGE);
+  }
+
   /* Parse the optional message and target variable, which must not be
-   * read-only. */
+   * read-only.  A message length of 0 indicates a stream. */
   YES_ARGS(list);
-  if (list->next == NULL) {
+  if (infile != NULL || infd != -1) {
+    /* Root, streaming */
+    root_message = NULL;
+    msglen = 0;
+  }
+  else if (list->next == NULL) {
     /* Non-root */
     root_message = NULL;
     msglen = -1;
@@ -62,30 +238,96 @@ mpi_bcast_builtin (WORD_LIST *list)
   list = list->next;
   no_args(list);
 
-  /* Acquire global agreement on the root and the message size. */
-  if (all_lengths == NULL)
-    all_lengths = malloc(mpibash_num_ranks * sizeof(int));
-  MPI_TRY(MPI_Allgather(&msglen, 1, MPI_INT, all_lengths, 1, MPI_INT, MPI_COMM_WORLD));
-  root = -1;
-  for (i = 0; i < mpibash_num_ranks; i++) {
-    if (all_lengths[i] == -1)
-      continue;
-    if (root != -1) {
-      builtin_error(_
-                    ("mpi_bcast: more than one process specified a message"));
+  if (given_root != -1 && (comm.rank == given_root) != (msglen != -1)) {
+    if (comm.rank == given_root)
+      builtin_error(_("mpi_bcast: the root must specify a message"));
+    else
+      builtin_error(_("mpi_bcast: only the root may specify a message"));
+    return (EX_USAGE);
+  }
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+
+  if (given_root != -1) {
+    /* The root is known, so broadcast a fixed-size header with the
+     * message size and, if it fits, the message. */
+    root = (int) given_root;
+    if (header == NULL)
+      header = malloc(BCAST_HEADER_SIZE);
+    if (comm.rank == root) {
+      hdrlen = msglen == 0 ? -1 : msglen;
+      memcpy(header, &hdrlen, sizeof(int64_t));
+      if (msglen > 0 && msglen <= BCAST_HEADER_SIZE - (int)sizeof(int64_t))
+        memcpy(header + sizeof(int64_t), root_message, msglen);
+    }
+    MPI_TRY(MPI_Bcast(header, BCAST_HEADER_SIZE, MPI_BYTE, root, comm.comm));
+    memcpy(&hdrlen, header, sizeof(int64_t));
+    msglen = hdrlen == -1 ? 0 : (int) hdrlen;
+  }
+  else {
+    /* Acquire global agreement on the root and the message size. */
+    if (all_lengths == NULL)
+      all_lengths = malloc(mpibash_num_ranks * sizeof(int));
+    MPI_TRY(MPI_Allgather(&msglen, 1, MPI_INT, all_lengths, 1, MPI_INT, comm.comm));
+    root = -1;
+    for (i = 0; i < comm.size; i++) {
+      if (all_lengths[i] == -1)
+        continue;
+      if (root != -1) {
+        builtin_error(_
+                      ("mpi_bcast: more than one process specified a message"));
+        return (EXECUTION_FAILURE);
+      }
+      root = i;
+      msglen = all_lengths[i];
+    }
+    if (root == -1) {
+      builtin_error(_("mpi_bcast: no process specified a message"));
       return (EXECUTION_FAILURE);
     }
-    root = i;
-    msglen = all_lengths[i];
   }
-  if (root == -1) {
-    builtin_error(_("mpi_bcast: no process specified a message"));
-    return (EXECUTION_FAILURE);
+  /* A rank that can't open its output file still takes part in the
+   * broadcast so the others don't hang, but it discards the data. */
+  if (outfile != NULL && comm.rank != root) {
+    outfd = mpibash_open_sink(outfile);
+    sink_failed = outfd == -1;
   }
 
-  /* Broadcast the message. */
-  if (mpibash_rank == root) {
-    MPI_TRY(MPI_Bcast(root_message, msglen, MPI_BYTE, root, MPI_COMM_WORLD));
+  /* Stream the contents of a file. */
+  if (msglen == 0) {
+    if (comm.rank == root
+        && mpibash_open_source(&src, infile, infd) != EXECUTION_SUCCESS) {
+      /* Send a failed stream so the other ranks don't hang. */
+      long len = -1;
+
+      MPI_TRY(MPI_Bcast(&len, 1, MPI_LONG, root, comm.comm));
+      return EXECUTION_FAILURE;
+    }
+    result = bcast_stream(root, comm.comm, &src, outfd,
+                          sink_failed ? NULL : &contents, &total);
+    mpibash_stats_bytes(comm.comm, MPI_PROC_NULL, (long) total);
+    if (comm.rank == root)
+      mpibash_close_source(&src);
+    if (sink_failed)
+      return EXECUTION_FAILURE;
+    if (comm.rank == root || outfd != -1)
+      mpibash_bind_variable_number(varname, (long) total, 0);
+    else {
+      bind_variable(varname, contents, 0);
+      free(contents);
+    }
+    if (outfd != -1)
+      close(outfd);
+    return result;
+  }
+
+  /* Broadcast the message unless it already arrived in the header. */
+  inline_msg = given_root != -1
+    && msglen <= BCAST_HEADER_SIZE - (int)sizeof(int64_t);
+  mpibash_stats_bytes(comm.comm, MPI_PROC_NULL, msglen);
+  if (comm.rank == root) {
+    if (!inline_msg)
+      MPI_TRY(MPI_Bcast(root_message, msglen, MPI_BYTE, root, comm.comm));
     bind_variable(varname, root_message, 0);
   }
   else {
@@ -93,8 +335,20 @@ mpi_bcast_builtin (WORD_LIST *list)
       message = realloc(message, msglen);
       alloced = msglen;
     }
-    MPI_TRY(MPI_Bcast(message, msglen, MPI_BYTE, root, MPI_COMM_WORLD));
-    bind_variable(varname, message, 0);
+    if (inline_msg)
+      memcpy(message, header + sizeof(int64_t), msglen);
+    else
+      MPI_TRY(MPI_Bcast(message, msglen, MPI_BYTE, root, comm.comm));
+    if (sink_failed)
+      return EXECUTION_FAILURE;
+    if (outfd == -1)
+      bind_variable(varname, message, 0);
+    else {
+      result = mpibash_write_all(outfd, message, msglen - 1);
+      close(outfd);
+      mpibash_bind_variable_number(varname, msglen - 1, 0);
+      return result;
+    }
   }
   return EXECUTION_SUCCESS;
 }
@@ -103,14 +357,33 @@ mpi_bcast_builtin (WORD_LIST *list)
 static char *mpi_bcast_doc[] = {
   "Broadcast a message to all processes in the same MPI job.",
   "",
+  "Options:",
+  "  -f FILE       Broadcast the contents of FILE instead of MESSAGE.",
+  "",
+  "  -F FD         Broadcast everything that can be read from file",
+  "                descriptor FD instead of MESSAGE.",
+  "",
+  "  -o FILE       On receiving processes, write the broadcast data to",
+  "                FILE and bind NAME to the number of bytes written.",
+  "",
+  "  -r ROOT       Broadcast from rank ROOT.  When every process names the",
+  "                root, mpi_bcast avoids an all-to-all exchange needed to",
+  "                discover it, and short messages take a single",
+  "                broadcast.",
+  "",
+  "  -c COMM       Broadcast only among the processes in communicator COMM.",
+  "                ROOT is then a rank within COMM.",
+  "",
   "Arguments:",
   "  MESSAGE       String to broadcast from one process to all the others.",
   "",
   "  NAME          Scalar variable in which to receive the broadcast message.",
   "",
-  "Exactly one process in the MPI job must specify a message to",
-  "broadcast.  No process will return from mpi_bcast until all processes",
-  "have called mpi_bcast.",
+  "Exactly one process in the MPI job must specify a message (or -f or",
+  "-F) to broadcast.  No process will return from mpi_bcast until all",
+  "processes have called mpi_bcast.  File contents are broadcast in",
+  "pipelined chunks; on the broadcasting process, NAME receives the",
+  "number of bytes broadcast.",
   "",
   "Exit Status:",
   "Returns 0 unless an invalid option is given or an error occurs.",
@@ -118,9 +391,186 @@ static char *mpi_bcast_doc[] = {
 };
 
 /* Describe the mpi_bcast builtin. */
-DEFINE_BUILTIN(mpi_bcast, "mpi_bcast [message] name");
+DEFINE_BUILTIN(mpi_bcast, "mpi_bcast [-c comm] [-r root] [-f file | -F fd] [-o file] [message] name");
+
+/* Keep track of the communicators mpi_bcast_file uses: one containing
+ * all ranks on this node and one containing a single leader per node.
+ * Both are built for a particular root, which is made rank 0 of each,
+ * and are rebuilt only when the root changes. */
+static struct {
+  int root;                     /* World rank the communicators were built for (-1=none) */
+  MPI_Comm node_comm;           /* All ranks on this node */
+  MPI_Comm leader_comm;         /* One rank per node (MPI_COMM_NULL on non-leaders) */
+} staging = {-1, MPI_COMM_NULL, MPI_COMM_NULL};
+
+/* Build the staging communicators for a given root. */
+static int
+build_staging_comms (int root)
+{
+  int key;                      /* Sort key that puts the root first */
+  int node_rank;                /* Our rank within node_comm */
+
+  if (staging.root == root)
+    return EXECUTION_SUCCESS;
+  if (staging.root != -1) {
+    MPI_TRY(MPI_Comm_free(&staging.node_comm));
+    if (staging.leader_comm != MPI_COMM_NULL)
+      MPI_TRY(MPI_Comm_free(&staging.leader_comm));
+    staging.root = -1;
+  }
+  key = (mpibash_rank - root + mpibash_num_ranks) % mpibash_num_ranks;
+  MPI_TRY(MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, key,
+                              MPI_INFO_NULL, &staging.node_comm));
+  MPI_TRY(MPI_Comm_rank(staging.node_comm, &node_rank));
+  MPI_TRY(MPI_Comm_split(MPI_COMM_WORLD, node_rank == 0 ? 0 : MPI_UNDEFINED,
+                         key, &staging.leader_comm));
+  staging.root = root;
+  return EXECUTION_SUCCESS;
+}
+
+/* Return 1 if two paths name the same existing file, 0 otherwise. */
+static int
+same_file (const char *path1, const char *path2)
+{
+  struct stat st1, st2;
+
+  return stat(path1, &st1) == 0 && stat(path2, &st2) == 0
+    && st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino;
+}
+
+/* Copy a file from one rank to every node, writing it once per node. */
+static int
+mpi_bcast_file_builtin (WORD_LIST *list)
+{
+  int root = 0;                 /* Rank that reads the file */
+  intmax_t n;                   /* Parsed root */
+  char *srcname;                /* File to read on the root */
+  char *dstname;                /* File to write on each node */
+  mpibash_source_t src;         /* Source of streamed contents */
+  int fd = -1;                  /* File descriptor for dstname */
+  size_t total;                 /* Number of bytes broadcast */
+  int result = EXECUTION_SUCCESS;
+  int global_result;            /* Worst result on any rank */
+  int opt;                      /* Parsed option */
+
+  /* Parse any options provided. */
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "r:")) != -1) {
+    switch (opt) {
+      case 'r':
+        if (!legal_number(list_optarg, &n) || n < 0 || n >= mpibash_num_ranks) {
+          builtin_error(_("-r: rank in the range [0, %d] required"),
+                        mpibash_num_ranks - 1);
+          return (EX_USAGE);
+        }
+        root = (int) n;
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+
+  /* Parse the source and destination file names. */
+  YES_ARGS(list);
+  srcname = list->word->word;
+  list = list->next;
+  YES_ARGS(list);
+  dstname = list->word->word;
+  list = list->next;
+  no_args(list);
+
+  /* Stream the file from the root to one leader per node.  Leaders
+   * that already see the source file under the destination name (for
+   * example, because both are on a shared filesystem) don't write
+   * it. */
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  if (build_staging_comms(root) != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  if (staging.leader_comm != MPI_COMM_NULL) {
+    if (!same_file(srcname, dstname)) {
+      fd = mpibash_open_sink(dstname);
+      if (fd == -1)
+        result = EXECUTION_FAILURE;
+    }
+    if (mpibash_rank == root
+        && mpibash_open_source(&src, srcname, -1) != EXECUTION_SUCCESS) {
+      /* Send a failed stream so the other leaders don't hang. */
+      long len = -1;
+
+      MPI_TRY(MPI_Bcast(&len, 1, MPI_LONG, 0, staging.leader_comm));
+      result = EXECUTION_FAILURE;
+    }
+    else {
+      if (bcast_stream(0, staging.leader_comm, &src, fd, NULL, &total) != EXECUTION_SUCCESS)
+        result = EXECUTION_FAILURE;
+      if (mpibash_rank == root)
+        mpibash_close_source(&src);
+    }
+    if (fd != -1 && close(fd) == -1) {
+      builtin_error("%s: %s", dstname, strerror(errno));
+      result = EXECUTION_FAILURE;
+    }
+  }
+
+  /* Agree on success so that every rank returns only once every node
+   * has its copy, and discard partial copies on failure. */
+  MPI_TRY(MPI_Allreduce(&result, &global_result, 1, MPI_INT, MPI_MAX,
+                        MPI_COMM_WORLD));
+  if (global_result != EXECUTION_SUCCESS && fd != -1)
+    unlink(dstname);
+  return global_result;
+}
+
+/* Define the documentation for the mpi_bcast_file builtin. */
+static char *mpi_bcast_file_doc[] = {
+  "Copy a file from one process to every node in the MPI job.",
+  "",
+  "Options:",
+  "  -r ROOT       Read the file on rank ROOT (default: 0).",
+  "",
+  "Arguments:",
+  "  SOURCE        File to read on the root.",
+  "",
+  "  DEST          File to write on each node, typically in node-local",
+  "                storage such as /dev/shm.",
+  "",
+  "The root reads SOURCE once and streams it in pipelined chunks to one",
+  "process per node, which writes DEST.  This avoids having every",
+  "process read the same file from a parallel filesystem.  All processes",
+  "in the MPI job must call mpi_bcast_file together, and none returns",
+  "until every node has its copy.  DEST is not written where it already",
+  "names the same file as SOURCE.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs on",
+  "any process.",
+  NULL
+};
+
+/* Describe the mpi_bcast_file builtin. */
+DEFINE_BUILTIN(mpi_bcast_file, "mpi_bcast_file [-r root] source dest");
+
+/* Parse "-r ROOT", a rank in a communicator of NRANKS ranks, into
+ * *ROOT.  Return 1 on success, 0 on failure. */
+static int
+parse_root (char *word, int nranks, int *root)
+{
+  intmax_t n;
+
+  if (!legal_number(word, &n) || n < 0 || n >= nranks) {
+    builtin_error(_("-r: rank in the range [0, %d] required"), nranks - 1);
+    return 0;
+  }
+  *root = (int) n;
+  return 1;
+}
 
-/* Define a reduction-type function (allreduce, scan, exscan, etc.). */
+/* Define a reduction-type function (allreduce, scan, exscan, etc.).
+ * A NULL function denotes a reduction to a single root (MPI_Reduce). */
 typedef int (*reduction_func_t)(const void *, void *, int, MPI_Datatype, MPI_Op, MPI_Comm);
 
 /* Parse an operation name into an MPI_Op.  Return 1 on success, 0 on
@@ -166,160 +616,859 @@ parse_operation (char *name, MPI_Op *op)
   return 0;
 }
 
-/* Perform any reduction-type operation (allreduce, scan, exscan, etc.). */
+/* Define the types of values a reduction can operate on. */
+typedef enum {
+  REDUCE_LONG,                  /* Signed integers (the default) */
+  REDUCE_DOUBLE,                /* Floating-point numbers (-d) */
+  REDUCE_UINT64                 /* Unsigned 64-bit integers (-u) */
+} reduce_type_t;
+
+/* Describe a single value to reduce, possibly paired with a rank for
+ * maxloc and minloc.  Every member begins with the value itself. */
+typedef union {
+  struct {
+    long value;
+    int rank;
+  } l;                          /* REDUCE_LONG (MPI_LONG_INT) */
+  struct {
+    double value;
+    int rank;
+  } d;                          /* REDUCE_DOUBLE (MPI_DOUBLE_INT) */
+  uint64_t u;                   /* REDUCE_UINT64 */
+} reduce_value_t;
+
+/* Parse a string into a value of the given type, stored at VALUE.
+ * Return 1 on success, 0 on failure. */
 static int
-reduction_like (WORD_LIST *list, char *funcname, reduction_func_t func)
+parse_value (reduce_type_t type, const char *word, void *value)
 {
-  char *word;                   /* One argument */
-  struct {
-    long int value;             /* Reduced value */
-    int rank;                   /* Rank associated with the above */
-  } number, result;
-  MPI_Op operation = MPI_SUM;   /* Operation to perform */
-  char *varname;                /* Name of the variable to bind the results to */
-  intmax_t n;
+  intmax_t n;                   /* Parsed integer */
+  char *end;                    /* First unparsed character */
 
-  /* Parse "-O OPERATION" (optional), where OPERATION is a reduction
-   * operation. */
-  YES_ARGS(list);
-  word = list->word->word;
-  if (ISOPTION(word, 'O')) {
-    list = list->next;
-    if (list == 0) {
-      sh_needarg(funcname);
-      return EX_USAGE;
-    }
-    word = list->word->word;
-    if (!parse_operation(word, &operation)) {
-      sh_invalidopt("-O");
-      return EX_USAGE;
-    }
-    list = list->next;
+  switch (type) {
+    case REDUCE_LONG:
+      if (!legal_number(word, &n))
+        return 0;
+      *(long *)value = (long) n;
+      return 1;
+
+    case REDUCE_DOUBLE:
+      errno = 0;
+      *(double *)value = strtod(word, &end);
+      return end != word && *end == '\0' && errno != ERANGE;
+
+    case REDUCE_UINT64:
+      while (*word == ' ' || *word == '\t')
+        word++;
+      if (*word == '-')
+        return 0;
+      errno = 0;
+      *(uint64_t *)value = (uint64_t) strtoumax(word, &end, 10);
+      return end != word && *end == '\0' && errno != ERANGE;
   }
+  return 0;
+}
 
-  /* Parse the argument, which must be a number. */
-  YES_ARGS(list);
-  word = list->word->word;
-  if (!legal_number(word, &n)) {
-    sh_neednumarg(funcname);
-    return EX_USAGE;
+/* Format a value of the given type as a string in BUFFER, which must
+ * be at least 32 bytes long.  Doubles are formatted so that they read
+ * back exactly. */
+static void
+format_value (reduce_type_t type, const void *value, char *buffer)
+{
+  switch (type) {
+    case REDUCE_LONG:
+      sprintf(buffer, "%ld", *(const long *)value);
+      break;
+
+    case REDUCE_DOUBLE:
+      sprintf(buffer, "%.17g", *(const double *)value);
+      break;
+
+    case REDUCE_UINT64:
+      sprintf(buffer, "%" PRIu64, *(const uint64_t *)value);
+      break;
   }
-  number.value = (long int) n;
-  number.rank = mpibash_rank;
-  list = list->next;
+}
 
-  /* Parse the target variable, which must not be read-only. */
-  YES_ARGS(list);
-  varname = list->word->word;
-  if (mpibash_rank != 0 || (void *)func != (void *)MPI_Exscan)
-    REQUIRE_WRITABLE(varname);
-  list = list->next;
-  no_args(list);
+/* Store at VALUE the identity element of an operation on the given
+ * type.  Missing elements of a vector reduction are treated as this
+ * value. */
+static void
+identity_value (reduce_type_t type, MPI_Op operation, void *value)
+{
+  switch (type) {
+    case REDUCE_LONG:
+      if (operation == MPI_MAX)
+        *(long *)value = LONG_MIN;
+      else if (operation == MPI_MIN)
+        *(long *)value = LONG_MAX;
+      else if (operation == MPI_PROD || operation == MPI_LAND)
+        *(long *)value = 1;
+      else if (operation == MPI_BAND)
+        *(long *)value = ~0L;
+      else
+        *(long *)value = 0;
+      break;
 
-  /* Perform the reduction operation.  Bind the given array variable
-   * to the result and, for minloc/maxloc, the associated rank. */
-  if (mpibash_rank != 0 || (void *)func != (void *)MPI_Exscan) {
-    bind_array_variable(varname, 0, "", 0);
-    bind_array_variable(varname, 1, "", 0);
+    case REDUCE_DOUBLE:
+      if (operation == MPI_MAX)
+        *(double *)value = -HUGE_VAL;
+      else if (operation == MPI_MIN)
+        *(double *)value = HUGE_VAL;
+      else if (operation == MPI_PROD)
+        *(double *)value = 1.0;
+      else
+        *(double *)value = 0.0;
+      break;
+
+    case REDUCE_UINT64:
+      if (operation == MPI_MIN || operation == MPI_BAND)
+        *(uint64_t *)value = UINT64_MAX;
+      else if (operation == MPI_PROD || operation == MPI_LAND)
+        *(uint64_t *)value = 1;
+      else
+        *(uint64_t *)value = 0;
+      break;
+  }
+}
+
+/* Return the MPI datatype and size in bytes of one value of the given
+ * type. */
+static MPI_Datatype
+reduce_datatype (reduce_type_t type, size_t *size)
+{
+  switch (type) {
+    case REDUCE_DOUBLE:
+      *size = sizeof(double);
+      return MPI_DOUBLE;
+
+    case REDUCE_UINT64:
+      *size = sizeof(uint64_t);
+      return MPI_UINT64_T;
+
+    default:
+      *size = sizeof(long);
+      return MPI_LONG;
   }
+}
+
+/* Perform a reduction-type operation element-wise across COMM on the
+ * indexed array INNAME, binding the results to indexed array OUTNAME.
+ * If FUNC is NULL, reduce to rank ROOT only.  Arrays shorter
+ * than the longest array presented by any process are padded with the
+ * operation's identity element. */
+static int
+reduce_vector (char *inname, char *outname, reduce_type_t type,
+               MPI_Op operation, reduction_func_t func, int root,
+               mpibash_comm_t *comm)
+{
+  SHELL_VAR *var;               /* Input variable */
+  ARRAY *array;                 /* Input array */
+  ARRAY_ELEMENT *ae;            /* One element of the above */
+  MPI_Datatype datatype;        /* MPI datatype of one value */
+  size_t size;                  /* Number of bytes in the above */
+  char *values;                 /* Values to reduce */
+  char *results;                /* Reduced values */
+  long nelts = 0;               /* Number of values this process presents */
+  long maxelts;                 /* Number of values any process presents */
+  char numstr[32];              /* One reduced value as a string */
+  SHELL_VAR *outvar;            /* Output variable */
+  long i;
+  int mpierr;
+
+  /* Convert the array to a vector of numbers in a single pass. */
   if (operation == MPI_MINLOC || operation == MPI_MAXLOC) {
-    MPI_TRY(func(&number, &result, 1, MPI_LONG_INT, operation, MPI_COMM_WORLD));
-    if (mpibash_rank != 0 || (void *)func != (void *)MPI_Exscan)
-      mpibash_bind_array_variable_number(varname, 1, result.rank, 0);
+    builtin_error(_("-a cannot be used with maxloc or minloc"));
+    return EX_USAGE;
   }
+  var = find_variable(inname);
+  if (var == NULL || invisible_p(var) || !array_p(var)) {
+    builtin_error(_("%s: not an indexed array"), inname);
+    return EXECUTION_FAILURE;
+  }
+  datatype = reduce_datatype(type, &size);
+  array = array_cell(var);
+  if (array->num_elements > 0)
+    nelts = (long) array->max_index + 1;
+  values = malloc((nelts + 1)*size);
+  for (i = 0; i < nelts; i++)
+    identity_value(type, operation, values + i*size);
+  for (ae = element_forw(array_head(array)); ae != array_head(array); ae = element_forw(ae))
+    if (!parse_value(type, element_value(ae), values + element_index(ae)*size)) {
+      builtin_error(_("%s[%ld]: %s: number expected"), inname,
+                    (long) element_index(ae), element_value(ae));
+      free(values);
+      return EXECUTION_FAILURE;
+    }
+
+  /* Pad the vector to the longest length presented by any process. */
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS) {
+    free(values);
+    return EXECUTION_FAILURE;
+  }
+  MPI_TIMED(mpierr, MPI_Allreduce(&nelts, &maxelts, 1, MPI_LONG, MPI_MAX, comm->comm));
+  if (mpierr != MPI_SUCCESS) {
+    free(values);
+    return mpibash_report_mpi_error(mpierr);
+  }
+  values = realloc(values, (maxelts + 1)*size);
+  for (i = nelts; i < maxelts; i++)
+    identity_value(type, operation, values + i*size);
+
+  /* Reduce all elements at once and bind them in a single pass. */
+  results = malloc((maxelts + 1)*size);
+  if (func == NULL)
+    MPI_TIMED(mpierr, MPI_Reduce(values, results, (int) maxelts, datatype, operation,
+                                 root, comm->comm));
   else
-    MPI_TRY(func(&number.value, &result.value, 1, MPI_LONG, operation, MPI_COMM_WORLD));
-  if (mpibash_rank != 0 || (void *)func != (void *)MPI_Exscan)
-    mpibash_bind_array_variable_number(varname, 0, result.value, 0);
+    MPI_TIMED(mpierr, func(values, results, (int) maxelts, datatype, operation, comm->comm));
+  free(values);
+  if (mpierr != MPI_SUCCESS) {
+    free(results);
+    return mpibash_report_mpi_error(mpierr);
+  }
+  if (func == NULL ? comm->rank == root
+      : comm->rank != 0 || (void *)func != (void *)MPI_Exscan) {
+    outvar = find_shell_variable(outname);
+    if (outvar != NULL && readonly_p(outvar)) {
+      err_readonly(outname);
+      free(results);
+      return EXECUTION_FAILURE;
+    }
+    if (outvar != NULL)
+      unbind_variable(outname);
+    outvar = make_new_array_variable(outname);
+    for (i = 0; i < maxelts; i++) {
+      format_value(type, results + i*size, numstr);
+      array_insert(array_cell(outvar), (arrayind_t) i, numstr);
+    }
+  }
+  free(results);
   return EXECUTION_SUCCESS;
 }
 
-/* Perform an inclusive-scan operation. */
+/* Define the tag that associative-array merges use on a communicator's
+ * private collective duplicate. */
+#define ASSOC_REDUCE_TAG 0
+
+/* Combine numeric value B into A using OPERATION (sum, min, or max). */
+static void
+combine_values (reduce_type_t type, MPI_Op operation, reduce_value_t *a,
+                const reduce_value_t *b)
+{
+  switch (type) {
+    case REDUCE_DOUBLE:
+      if (operation == MPI_SUM)
+        a->d.value += b->d.value;
+      else if (operation == MPI_MIN ? b->d.value < a->d.value : b->d.value > a->d.value)
+        a->d.value = b->d.value;
+      break;
+
+    case REDUCE_UINT64:
+      if (operation == MPI_SUM)
+        a->u += b->u;
+      else if (operation == MPI_MIN ? b->u < a->u : b->u > a->u)
+        a->u = b->u;
+      break;
+
+    default:
+      if (operation == MPI_SUM)
+        a->l.value += b->l.value;
+      else if (operation == MPI_MIN ? b->l.value < a->l.value : b->l.value > a->l.value)
+        a->l.value = b->l.value;
+      break;
+  }
+}
+
+/* Merge KEY=VALUE into hash table TABLE, combining VALUE with any
+ * existing value for KEY using OPERATION (MPI_OP_NULL=concatenate with
+ * a space in between).  Copy KEY and VALUE as needed.  Return 1 on
+ * success or 0 if a value is not a number of the given type. */
 static int
-mpi_scan_builtin (WORD_LIST *list)
+merge_element (HASH_TABLE *table, const char *key, const char *value,
+               reduce_type_t type, MPI_Op operation)
 {
-  return reduction_like(list, "mpi_scan", MPI_Scan);
+  BUCKET_CONTENTS *b;           /* Existing element with the same key */
+  reduce_value_t old, new;      /* Numeric forms of the two values */
+  char numstr[32];              /* Combined value as a string */
+  char *data;                   /* Existing value */
+  size_t oldlen;                /* Length of the above */
+
+  b = hash_search((char *) key, table, 0);
+  if (b == NULL) {
+    if (operation != MPI_OP_NULL && !parse_value(type, value, &new))
+      return 0;
+    b = hash_insert(strdup(key), table, HASH_NOSRCH);
+    b->data = strdup(value);
+    return 1;
+  }
+  data = (char *) b->data;
+  if (operation == MPI_OP_NULL) {
+    oldlen = strlen(data);
+    data = realloc(data, oldlen + strlen(value) + 2);
+    data[oldlen] = ' ';
+    strcpy(data + oldlen + 1, value);
+    b->data = data;
+    return 1;
+  }
+  if (!parse_value(type, data, &old) || !parse_value(type, value, &new))
+    return 0;
+  combine_values(type, operation, &old, &new);
+  format_value(type, &old, numstr);
+  free(data);
+  b->data = strdup(numstr);
+  return 1;
 }
 
-/* Define the documentation for the mpi_scan builtin. */
-static char *mpi_scan_doc[] = {
-  "Perform an inclusive scan across all processes in the same MPI job.",
-  "",
-  "  -O OPERATION  Operation to perform.  Must be one of \"max\", \"min\",",
-  "                \"sum\", \"prod\", \"land\", \"band\", \"lor\", \"bor\", \"lxor\",",
-  "                \"bxor\", \"maxloc\", or \"minloc\" (default: \"sum\").",
-  "",
-  "Arguments:",
-  "  NUMBER        Integer to use in the scan operation.",
-  "",
-  "  NAME          Array variable in which to receive the result and, in",
-  "                the case of maxloc and minloc, the associated rank.",
-  "",
-  "In an inclusive-scan operation, each process i presents a number,",
-  "a[i].  Once all processes in the MPI job have presented their number,",
-  "the command returns a[0] to rank 0, a[0]+a[1] to rank 1,",
-  "a[0]+a[1]+a[2] to rank 2, and so forth.  The -O option enables \"+\" to",
-  "be replaced with other operations.",
-  "",
-  "Inclusive scans can be useful for assigning a unique index to each",
-  "process in the MPI job.",
-  "",
-  "Exit Status:",
-  "Returns 0 unless an invalid option is given or an error occurs.",
-  NULL
-};
+/* Pack every element of hash table TABLE into a newly allocated
+ * buffer, which the caller must free: an element count followed by
+ * each key and value, each length-prefixed.  Return the number of
+ * bytes or -1 if that exceeds an int. */
+static long
+pack_assoc (HASH_TABLE *table, char **buffer)
+{
+  BUCKET_CONTENTS *b;           /* One element */
+  uint64_t nelts = 0;           /* Number of elements */
+  uint64_t len;                 /* Length of a key or value */
+  size_t total = sizeof(uint64_t);      /* Number of bytes to pack */
+  char *p;                      /* Next byte to fill in */
+  int i;
 
-/* Describe the mpi_scan builtin. */
-DEFINE_BUILTIN(mpi_scan, "mpi_scan [-O operation] number name");
+  for (i = 0; i < table->nbuckets; i++)
+    for (b = hash_items(i, table); b != NULL; b = b->next) {
+      total += 2*sizeof(uint64_t) + strlen(b->key) + strlen((char *)b->data);
+      nelts++;
+    }
+  if (total > INT_MAX) {
+    builtin_error(_("too much data for a single collective"));
+    return -1;
+  }
+  *buffer = p = malloc(total);
+  memcpy(p, &nelts, sizeof(uint64_t));
+  p += sizeof(uint64_t);
+  for (i = 0; i < table->nbuckets; i++)
+    for (b = hash_items(i, table); b != NULL; b = b->next) {
+      len = strlen(b->key);
+      memcpy(p, &len, sizeof(uint64_t));
+      memcpy(p + sizeof(uint64_t), b->key, len);
+      p += sizeof(uint64_t) + len;
+      len = strlen((char *)b->data);
+      memcpy(p, &len, sizeof(uint64_t));
+      memcpy(p + sizeof(uint64_t), b->data, len);
+      p += sizeof(uint64_t) + len;
+    }
+  return (long) total;
+}
 
-/* Perform an exclusive-scan operation. */
+/* Invoke a function on each key and value in a buffer produced by
+ * pack_assoc.  Stop and return 0 if the function returns 0. */
 static int
-mpi_exscan_builtin (WORD_LIST *list)
+foreach_packed (char *buffer, int (*func)(void *, const char *, const char *),
+                void *arg)
 {
-  return reduction_like(list, "mpi_exscan", MPI_Exscan);
-}
+  uint64_t nelts;               /* Number of elements */
+  uint64_t len;                 /* Length of a key or value */
+  char *key;                    /* One key */
+  char *value;                  /* Value associated with the above */
+  char *p = buffer + sizeof(uint64_t);  /* Next byte to unpack */
+  int ok = 1;                   /* 0=func failed */
 
-/* Define the documentation for the mpi_exscan builtin. */
-static char *mpi_exscan_doc[] = {
-  "Perform an exclusive scan across all processes in the same MPI job.",
-  "",
-  "  -O OPERATION  Operation to perform.  Must be one of \"max\", \"min\",",
-  "                \"sum\", \"prod\", \"land\", \"band\", \"lor\", \"bor\", \"lxor\",",
-  "                \"bxor\", \"maxloc\", or \"minloc\" (default: \"sum\").",
-  "",
-  "Arguments:",
-  "  NUMBER        Integer to use in the scan operation.",
-  "",
-  "  NAME          Array variable in which to receive the result and, in",
-  "                the case of maxloc and minloc, the associated rank.",
-  "",
-  "In a exclusive-scan operation, each process i presents a number, a[i].",
-  "Once all processes in the MPI job have presented their number, the",
-  "command assigns a[0] to NAME on rank 1, a[0]+a[1] to NAME on rank 2,",
-  "a[0]+a[1]+a[2] to NAME on rank 3, and so forth.  No assignment is",
-  "performed on rank 0.  The -O option enables \"+\" to be replaced with",
-  "other operations.",
-  "",
-  "Exclusive scans can be useful for assigning a unique index to each",
-  "process in the MPI job.",
-  "",
-  "Exit Status:",
-  "Returns 0 unless an invalid option is given or an error occurs.",
-  NULL
-};
+  memcpy(&nelts, buffer, sizeof(uint64_t));
+  for (; nelts > 0 && ok; nelts--) {
+    memcpy(&len, p, sizeof(uint64_t));
+    key = strndup(p + sizeof(uint64_t), len);
+    p += sizeof(uint64_t) + len;
+    memcpy(&len, p, sizeof(uint64_t));
+    value = strndup(p + sizeof(uint64_t), len);
+    p += sizeof(uint64_t) + len;
+    ok = func(arg, key, value);
+    free(key);
+    free(value);
+  }
+  return ok;
+}
 
-/* Describe the mpi_exscan builtin. */
-DEFINE_BUILTIN(mpi_exscan, "mpi_exscan [-O operation] number name");
+/* Describe how to merge unpacked elements into a hash table. */
+typedef struct {
+  HASH_TABLE *table;            /* Table to merge into */
+  reduce_type_t type;           /* Type of numeric values */
+  MPI_Op operation;             /* Operation to merge with */
+} assoc_merge_t;
 
-/* Perform an all-reduce operation. */
+/* Merge one unpacked element into a hash table (foreach_packed
+ * callback). */
 static int
-mpi_allreduce_builtin (WORD_LIST *list)
+merge_packed_element (void *arg, const char *key, const char *value)
 {
-  return reduction_like(list, "mpi_allreduce", MPI_Allreduce);
+  assoc_merge_t *merge = (assoc_merge_t *) arg;
+
+  return merge_element(merge->table, key, value, merge->type, merge->operation);
 }
 
-/* Define the documentation for the mpi_allreduce builtin. */
-static char *mpi_allreduce_doc[] = {
+/* Insert one unpacked element into an associative array (foreach_packed
+ * callback). */
+static int
+bind_packed_element (void *arg, const char *key, const char *value)
+{
+  SHELL_VAR *var = (SHELL_VAR *) arg;
+
+  assoc_insert(assoc_cell(var), strdup(key), (char *) value);   /* Takes ownership of key */
+  return 1;
+}
+
+/* Merge associative array INNAME across COMM by key, combining the
+ * values of duplicate keys with OPERATION (sum, min, max, or, as
+ * MPI_OP_NULL, concatenation in rank order).  Partial results flow up
+ * a binomial tree to ROOT or, if ROOT is -1, to rank 0, from which
+ * they are broadcast to all ranks.  Bind the result to associative
+ * array OUTNAME on every process that receives it.  A process that
+ * fails still takes part in the tree, sending an empty message in
+ * place of its partial result so the failure reaches the root. */
+static int
+reduce_assoc (char *inname, char *outname, reduce_type_t type,
+              MPI_Op operation, int root, mpibash_comm_t *comm)
+{
+  MPI_Comm tree_comm = comm->coll_comm;     /* Communicator for the tree */
+  SHELL_VAR *var;               /* Input or output variable */
+  HASH_TABLE *hash;             /* Contents of the input variable */
+  BUCKET_CONTENTS *b;           /* One element of the above */
+  assoc_merge_t merge;          /* Merged elements */
+  char *buffer = NULL;          /* Packed elements */
+  long count;                   /* Number of bytes in the above */
+  int64_t total;                /* Broadcast form of the above */
+  int top = root == -1 ? 0 : root;      /* Root of the tree */
+  int relrank;                  /* Our rank relative to top */
+  int mask;                     /* Current tree level */
+  int peer;                     /* Child or parent in the tree */
+  MPI_Message mpimsg;           /* Matched message from a child */
+  MPI_Status status;            /* Status of the above */
+  int msglen;                   /* Number of bytes in the above */
+  char *received;               /* Contents of the above */
+  int ok = 1;                   /* 0=we or a descendant failed */
+  int mpierr = MPI_SUCCESS;
+  int i;
+
+  /* Copy our own elements into a hash table, checking that every
+   * value is a number (unless concatenating). */
+  var = find_variable(inname);
+  hash = NULL;
+  if (var == NULL || invisible_p(var) || !assoc_p(var)) {
+    builtin_error(_("%s: not an associative array"), inname);
+    ok = 0;
+  }
+  else
+    hash = assoc_cell(var);
+  merge.table = hash_create(hash == NULL ? 0 : hash->nbuckets);
+  merge.type = type;
+  merge.operation = operation;
+  for (i = 0; hash != NULL && i < hash->nbuckets && ok; i++)
+    for (b = hash_items(i, hash); b != NULL && ok; b = b->next)
+      if (!merge_element(merge.table, b->key,
+                         b->data == NULL ? "" : (char *)b->data, type, operation)) {
+        builtin_error(_("%s[%s]: %s: number expected"), inname, b->key,
+                      b->data == NULL ? "" : (char *)b->data);
+        ok = 0;
+      }
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    ok = 0;
+
+  /* Merge our children's elements into ours, lowest relative rank
+   * first, then send the result to our parent. */
+  relrank = (comm->rank - top + comm->size) % comm->size;
+  for (mask = 1; mask < comm->size && mpierr == MPI_SUCCESS; mask <<= 1) {
+    if (relrank & mask) {
+      peer = (relrank - mask + top) % comm->size;
+      count = ok ? pack_assoc(merge.table, &buffer) : -1;
+      if (count == -1) {
+        ok = 0;
+        count = 0;
+      }
+      MPI_TIMED(mpierr, MPI_Send(buffer, (int) count, MPI_BYTE, peer,
+                                 ASSOC_REDUCE_TAG, tree_comm));
+      free(buffer);
+      buffer = NULL;
+      break;
+    }
+    if (relrank + mask >= comm->size)
+      continue;
+    peer = (relrank + mask + top) % comm->size;
+    MPI_TIMED(mpierr, MPI_Mprobe(peer, ASSOC_REDUCE_TAG, tree_comm, &mpimsg, &status));
+    if (mpierr == MPI_SUCCESS)
+      mpierr = MPI_Get_count(&status, MPI_BYTE, &msglen);
+    if (mpierr != MPI_SUCCESS)
+      break;
+    received = malloc(msglen);
+    MPI_TIMED(mpierr, MPI_Mrecv(received, msglen, MPI_BYTE, &mpimsg, MPI_STATUS_IGNORE));
+    if (msglen == 0)
+      ok = 0;
+    if (mpierr == MPI_SUCCESS && ok)
+      foreach_packed(received, merge_packed_element, &merge);
+    free(received);
+  }
+
+  /* Pack the result on the root and, for an all-reduce, broadcast
+   * it.  A length of -1 tells the other ranks that something failed. */
+  if (mpierr == MPI_SUCCESS && relrank == 0 && ok) {
+    count = pack_assoc(merge.table, &buffer);
+    if (count == -1)
+      ok = 0;
+  }
+  hash_flush(merge.table, NULL);
+  hash_dispose(merge.table);
+  if (root == -1) {
+    total = relrank == 0 && mpierr == MPI_SUCCESS && ok ? (int64_t) count : -1;
+    if (mpierr == MPI_SUCCESS || relrank == 0)
+      MPI_TIMED(mpierr, MPI_Bcast(&total, 1, MPI_INT64_T, top, comm->comm));
+    if (mpierr == MPI_SUCCESS && total == -1)
+      ok = 0;
+    if (mpierr == MPI_SUCCESS && ok) {
+      if (relrank != 0)
+        buffer = malloc(total);
+      MPI_TIMED(mpierr, MPI_Bcast(buffer, (int) total, MPI_BYTE, top, comm->comm));
+    }
+  }
+  if (mpierr != MPI_SUCCESS || !ok) {
+    free(buffer);
+    return mpierr != MPI_SUCCESS ? mpibash_report_mpi_error(mpierr) : EXECUTION_FAILURE;
+  }
+
+  /* Bind the result. */
+  if (buffer != NULL) {
+    var = find_shell_variable(outname);
+    if (var != NULL && readonly_p(var)) {
+      err_readonly(outname);
+      free(buffer);
+      return EXECUTION_FAILURE;
+    }
+    if (var != NULL)
+      unbind_variable(outname);
+    var = make_new_assoc_variable(outname);
+    foreach_packed(buffer, bind_packed_element, var);
+    free(buffer);
+  }
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the shapes of data a reduction can operate on. */
+typedef enum {
+  REDUCE_SCALAR,                /* A single number */
+  REDUCE_ARRAY,                 /* Indexed arrays, element-wise (-a) */
+  REDUCE_ASSOC                  /* Associative arrays, merged by key (-A) */
+} reduce_shape_t;
+
+/* Parse the options common to the reduction-type builtins: "-O
+ * OPERATION" and "-c COMM" (optional), where OPERATION is a reduction
+ * operation or, with -A, "concat", and "-a", "-A", "-d", and "-u"
+ * (optional).  If SHAPE is NULL, -a and -A are not accepted.  If ROOT
+ * is non-NULL, "-r ROOT" (default: 0) is also accepted.  Because
+ * NUMBER may be negative, we don't use internal_getopt.  Advance *LIST
+ * past the options.  "concat" is represented as MPI_OP_NULL. */
+static int
+parse_reduction_options (WORD_LIST **list, char *funcname, reduce_type_t *type,
+                         MPI_Op *operation, reduce_shape_t *shape, int *root,
+                         mpibash_comm_t *comm)
+{
+  WORD_LIST *args = *list;      /* Remaining arguments */
+  char *word;                   /* One argument */
+  char *rootword = NULL;        /* Argument to -r */
+  int is_loc;                   /* 1=operation is maxloc or minloc */
+  int is_assoc;                 /* 1=merging associative arrays */
+
+  *type = REDUCE_LONG;
+  *operation = MPI_SUM;
+  if (shape != NULL)
+    *shape = REDUCE_SCALAR;
+  if (root != NULL)
+    *root = 0;
+  mpibash_get_comm(MPIBASH_COMM_WORLD, comm);
+  YES_ARGS(args);
+  for (word = args->word->word;
+       ISOPTION(word, 'O') || ISOPTION(word, 'c')
+         || (shape != NULL && (ISOPTION(word, 'a') || ISOPTION(word, 'A')))
+         || (root != NULL && ISOPTION(word, 'r'))
+         || ISOPTION(word, 'd') || ISOPTION(word, 'u');
+       word = args->word->word) {
+    if (ISOPTION(word, 'a'))
+      *shape = REDUCE_ARRAY;
+    else if (ISOPTION(word, 'A'))
+      *shape = REDUCE_ASSOC;
+    else if (ISOPTION(word, 'd'))
+      *type = REDUCE_DOUBLE;
+    else if (ISOPTION(word, 'u'))
+      *type = REDUCE_UINT64;
+    else if (ISOPTION(word, 'c')) {
+      args = args->next;
+      if (args == 0) {
+        sh_needarg(funcname);
+        return EX_USAGE;
+      }
+      if (!mpibash_parse_comm(args->word->word, comm))
+        return EX_USAGE;
+    }
+    else if (ISOPTION(word, 'r')) {
+      args = args->next;
+      if (args == 0) {
+        sh_needarg(funcname);
+        return EX_USAGE;
+      }
+      rootword = args->word->word;
+    }
+    else {
+      args = args->next;
+      if (args == 0) {
+        sh_needarg(funcname);
+        return EX_USAGE;
+      }
+      word = args->word->word;
+      if (!strcmp(word, "concat"))
+        *operation = MPI_OP_NULL;
+      else if (!parse_operation(word, operation)) {
+        sh_invalidopt("-O");
+        return EX_USAGE;
+      }
+    }
+    args = args->next;
+    YES_ARGS(args);
+  }
+  if (rootword != NULL && !parse_root(rootword, comm->size, root))
+    return EX_USAGE;
+  is_loc = *operation == MPI_MINLOC || *operation == MPI_MAXLOC;
+  is_assoc = shape != NULL && *shape == REDUCE_ASSOC;
+  if (*operation == MPI_OP_NULL && !is_assoc) {
+    builtin_error(_("concat requires -A"));
+    return EX_USAGE;
+  }
+  if (is_assoc && *operation != MPI_OP_NULL && *operation != MPI_SUM
+      && *operation != MPI_MIN && *operation != MPI_MAX) {
+    builtin_error(_("-A supports only sum, min, max, and concat"));
+    return EX_USAGE;
+  }
+  if (*type == REDUCE_DOUBLE
+      && (*operation == MPI_LAND || *operation == MPI_BAND || *operation == MPI_LOR
+          || *operation == MPI_BOR || *operation == MPI_LXOR || *operation == MPI_BXOR)) {
+    builtin_error(_("-d supports only max, min, sum, prod, maxloc, and minloc"));
+    return EX_USAGE;
+  }
+  if (*type == REDUCE_UINT64 && is_loc) {
+    builtin_error(_("-u cannot be used with maxloc or minloc"));
+    return EX_USAGE;
+  }
+  *list = args;
+  return EXECUTION_SUCCESS;
+}
+
+/* Perform any reduction-type operation (allreduce, scan, exscan, etc.).
+ * If FUNC is NULL, reduce to the rank given by -r. */
+static int
+reduction_like (WORD_LIST *list, char *funcname, reduction_func_t func)
+{
+  char *word;                   /* One argument */
+  reduce_value_t number, result;        /* Value to reduce and reduced value */
+  reduce_type_t type;           /* Type of the above */
+  MPI_Datatype datatype;        /* MPI datatype corresponding to the above */
+  size_t size;                  /* Bytes per value */
+  MPI_Op operation;             /* Operation to perform */
+  char *varname;                /* Name of the variable to bind the results to */
+  char *inname;                 /* Name of the input array with -a or -A */
+  char numstr[32];              /* Reduced value as a string */
+  reduce_shape_t shape;         /* Scalars, indexed arrays, or associative arrays */
+  int is_loc;                   /* 1=operation is maxloc or minloc */
+  int bind;                     /* 1=this process receives a result */
+  int root = -1;                /* Rank that receives the result or -1 for all */
+  mpibash_comm_t comm;          /* Communicator to reduce across */
+
+  if (parse_reduction_options(&list, funcname, &type, &operation, &shape,
+                              func == NULL ? &root : NULL,
+                              &comm) != EXECUTION_SUCCESS)
+    return EX_USAGE;
+  is_loc = operation == MPI_MINLOC || operation == MPI_MAXLOC;
+
+  /* Reduce entire arrays. */
+  if (shape != REDUCE_SCALAR) {
+    inname = list->word->word;
+    list = list->next;
+    YES_ARGS(list);
+    varname = list->word->word;
+    list = list->next;
+    no_args(list);
+    if (shape == REDUCE_ARRAY)
+      return reduce_vector(inname, varname, type, operation, func, root, &comm);
+    if (func != NULL && (void *)func != (void *)MPI_Allreduce) {
+      builtin_error(_("-A is supported only by mpi_allreduce and mpi_reduce"));
+      return EX_USAGE;
+    }
+    return reduce_assoc(inname, varname, type, operation, root, &comm);
+  }
+
+  /* Parse the argument, which must be a number of the given type. */
+  YES_ARGS(list);
+  word = list->word->word;
+  if (!parse_value(type, word, &number)) {
+    sh_neednumarg(funcname);
+    return EX_USAGE;
+  }
+  if (type == REDUCE_DOUBLE)
+    number.d.rank = comm.rank;
+  else
+    number.l.rank = comm.rank;
+  list = list->next;
+
+  /* Parse the target variable, which must not be read-only. */
+  YES_ARGS(list);
+  varname = list->word->word;
+  if (func == NULL)
+    bind = comm.rank == root;
+  else
+    bind = comm.rank != 0 || (void *)func != (void *)MPI_Exscan;
+  if (bind)
+    REQUIRE_WRITABLE(varname);
+  list = list->next;
+  no_args(list);
+
+  /* Perform the reduction operation.  Bind the given array variable
+   * to the result and, for minloc/maxloc, the associated rank. */
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  if (bind) {
+    bind_array_variable(varname, 0, "", 0);
+    bind_array_variable(varname, 1, "", 0);
+  }
+  if (is_loc)
+    datatype = type == REDUCE_DOUBLE ? MPI_DOUBLE_INT : MPI_LONG_INT;
+  else
+    datatype = reduce_datatype(type, &size);
+  if (func == NULL)
+    MPI_TRY(MPI_Reduce(&number, &result, 1, datatype, operation, root, comm.comm));
+  else
+    MPI_TRY(func(&number, &result, 1, datatype, operation, comm.comm));
+  if (!bind)
+    return EXECUTION_SUCCESS;
+  format_value(type, &result, numstr);
+  bind_array_variable(varname, 0, numstr, 0);
+  if (is_loc)
+    mpibash_bind_array_variable_number(varname, 1,
+                                       type == REDUCE_DOUBLE ? result.d.rank : result.l.rank, 0);
+  return EXECUTION_SUCCESS;
+}
+
+/* Perform an inclusive-scan operation. */
+static int
+mpi_scan_builtin (WORD_LIST *list)
+{
+  return reduction_like(list, "mpi_scan", MPI_Scan);
+}
+
+/* Define the documentation for the mpi_scan builtin. */
+static char *mpi_scan_doc[] = {
+  "Perform an inclusive scan across all processes in the same MPI job.",
+  "",
+  "  -O OPERATION  Operation to perform.  Must be one of \"max\", \"min\",",
+  "                \"sum\", \"prod\", \"land\", \"band\", \"lor\", \"bor\", \"lxor\",",
+  "                \"bxor\", \"maxloc\", or \"minloc\" (default: \"sum\").",
+  "",
+  "  -d            Operate on floating-point numbers instead of integers.",
+  "                Only max, min, sum, prod, maxloc, and minloc apply.",
+  "",
+  "  -u            Operate on unsigned 64-bit integers, for example, byte",
+  "                counts too large for signed arithmetic.  maxloc and",
+  "                minloc do not apply.",
+  "",
+  "  -a            Operate element-wise on indexed arrays.  NUMBER names an",
+  "                array of numbers, and NAME receives an array of",
+  "                results.  Shorter arrays are padded with the",
+  "                operation's identity element.  Cannot be combined with",
+  "                maxloc or minloc.",
+  "",
+  "  -c COMM       Operate only across the processes in communicator COMM,",
+  "                whose ranks are then the ones reported.",
+  "",
+  "Arguments:",
+  "  NUMBER        Number to use in the scan operation.",
+  "",
+  "  NAME          Array variable in which to receive the result and, in",
+  "                the case of maxloc and minloc, the associated rank.",
+  "",
+  "In an inclusive-scan operation, each process i presents a number,",
+  "a[i].  Once all processes in the MPI job have presented their number,",
+  "the command returns a[0] to rank 0, a[0]+a[1] to rank 1,",
+  "a[0]+a[1]+a[2] to rank 2, and so forth.  The -O option enables \"+\" to",
+  "be replaced with other operations.",
+  "",
+  "Inclusive scans can be useful for assigning a unique index to each",
+  "process in the MPI job.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_scan builtin. */
+DEFINE_BUILTIN(mpi_scan, "mpi_scan [-c comm] [-O operation] [-d | -u] [-a] number name");
+
+/* Perform an exclusive-scan operation. */
+static int
+mpi_exscan_builtin (WORD_LIST *list)
+{
+  return reduction_like(list, "mpi_exscan", MPI_Exscan);
+}
+
+/* Define the documentation for the mpi_exscan builtin. */
+static char *mpi_exscan_doc[] = {
+  "Perform an exclusive scan across all processes in the same MPI job.",
+  "",
+  "  -O OPERATION  Operation to perform.  Must be one of \"max\", \"min\",",
+  "                \"sum\", \"prod\", \"land\", \"band\", \"lor\", \"bor\", \"lxor\",",
+  "                \"bxor\", \"maxloc\", or \"minloc\" (default: \"sum\").",
+  "",
+  "  -d            Operate on floating-point numbers instead of integers.",
+  "                Only max, min, sum, prod, maxloc, and minloc apply.",
+  "",
+  "  -u            Operate on unsigned 64-bit integers, for example, byte",
+  "                counts too large for signed arithmetic.  maxloc and",
+  "                minloc do not apply.",
+  "",
+  "  -a            Operate element-wise on indexed arrays.  NUMBER names an",
+  "                array of numbers, and NAME receives an array of",
+  "                results.  Shorter arrays are padded with the",
+  "                operation's identity element.  Cannot be combined with",
+  "                maxloc or minloc.",
+  "",
+  "  -c COMM       Operate only across the processes in communicator COMM,",
+  "                whose ranks are then the ones reported.",
+  "",
+  "Arguments:",
+  "  NUMBER        Number to use in the scan operation.",
+  "",
+  "  NAME          Array variable in which to receive the result and, in",
+  "                the case of maxloc and minloc, the associated rank.",
+  "",
+  "In a exclusive-scan operation, each process i presents a number, a[i].",
+  "Once all processes in the MPI job have presented their number, the",
+  "command assigns a[0] to NAME on rank 1, a[0]+a[1] to NAME on rank 2,",
+  "a[0]+a[1]+a[2] to NAME on rank 3, and so forth.  No assignment is",
+  "performed on rank 0.  The -O option enables \"+\" to be replaced with",
+  "other operations.",
+  "",
+  "Exclusive scans can be useful for assigning a unique index to each",
+  "process in the MPI job.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_exscan builtin. */
+DEFINE_BUILTIN(mpi_exscan, "mpi_exscan [-c comm] [-O operation] [-d | -u] [-a] number name");
+
+/* Perform an all-reduce operation. */
+static int
+mpi_allreduce_builtin (WORD_LIST *list)
+{
+  return reduction_like(list, "mpi_allreduce", MPI_Allreduce);
+}
+
+/* Define the documentation for the mpi_allreduce builtin. */
+static char *mpi_allreduce_doc[] = {
   "Reduce numbers from all processes in an MPI job to a single number.",
   "",
   "Options:",
@@ -328,8 +1477,31 @@ static char *mpi_allreduce_doc[] = {
   "                \"sum\", \"prod\", \"land\", \"band\", \"lor\", \"bor\", \"lxor\",",
   "                \"bxor\", \"maxloc\", or \"minloc\" (default: \"sum\").",
   "",
+  "  -d            Operate on floating-point numbers instead of integers.",
+  "                Only max, min, sum, prod, maxloc, and minloc apply.",
+  "",
+  "  -u            Operate on unsigned 64-bit integers, for example, byte",
+  "                counts too large for signed arithmetic.  maxloc and",
+  "                minloc do not apply.",
+  "",
+  "  -a            Operate element-wise on indexed arrays.  NUMBER names an",
+  "                array of numbers, and NAME receives an array of",
+  "                results.  Shorter arrays are padded with the",
+  "                operation's identity element.  Cannot be combined with",
+  "                maxloc or minloc.",
+  "",
+  "  -A            Merge associative arrays by key.  NUMBER names an",
+  "                associative array, and NAME receives the union of all",
+  "                processes' keys.  Values of keys present on more than",
+  "                one process are combined with sum, min, max, or",
+  "                \"concat\", which joins them with spaces in rank order.",
+  "                No other operations apply.",
+  "",
+  "  -c COMM       Operate only across the processes in communicator COMM,",
+  "                whose ranks are then the ones reported.",
+  "",
   "Arguments:",
-  "  NUMBER        Integer to use in the allreduce operation.",
+  "  NUMBER        Number to use in the allreduce operation.",
   "",
   "  NAME          Array variable in which to receive the result and, in",
   "                the case of maxloc and minloc, the associated rank.",
@@ -348,4 +1520,1184 @@ static char *mpi_allreduce_doc[] = {
 };
 
 /* Describe the mpi_allreduce builtin. */
-DEFINE_BUILTIN(mpi_allreduce, "mpi_allreduce [-O operation] number name");
+DEFINE_BUILTIN(mpi_allreduce, "mpi_allreduce [-c comm] [-O operation] [-d | -u] [-a | -A] number name");
+
+/* Perform a reduction to a single root. */
+static int
+mpi_reduce_builtin (WORD_LIST *list)
+{
+  return reduction_like(list, "mpi_reduce", NULL);
+}
+
+/* Define the documentation for the mpi_reduce builtin. */
+static char *mpi_reduce_doc[] = {
+  "Reduce numbers from all processes in an MPI job to a number on one process.",
+  "",
+  "Options:",
+  "",
+  "  -r ROOT       Deliver the result to rank ROOT (default: 0).",
+  "",
+  "  -O OPERATION  Operation to perform.  Must be one of \"max\", \"min\",",
+  "                \"sum\", \"prod\", \"land\", \"band\", \"lor\", \"bor\", \"lxor\",",
+  "                \"bxor\", \"maxloc\", or \"minloc\" (default: \"sum\").",
+  "",
+  "  -d            Operate on floating-point numbers instead of integers.",
+  "                Only max, min, sum, prod, maxloc, and minloc apply.",
+  "",
+  "  -u            Operate on unsigned 64-bit integers, for example, byte",
+  "                counts too large for signed arithmetic.  maxloc and",
+  "                minloc do not apply.",
+  "",
+  "  -a            Operate element-wise on indexed arrays.  NUMBER names an",
+  "                array of numbers, and NAME receives an array of",
+  "                results.  Shorter arrays are padded with the",
+  "                operation's identity element.  Cannot be combined with",
+  "                maxloc or minloc.",
+  "",
+  "  -A            Merge associative arrays by key.  NUMBER names an",
+  "                associative array, and NAME receives the union of all",
+  "                processes' keys.  Values of keys present on more than",
+  "                one process are combined with sum, min, max, or",
+  "                \"concat\", which joins them with spaces in rank order.",
+  "                No other operations apply.",
+  "",
+  "  -c COMM       Operate only across the processes in communicator COMM.",
+  "                ROOT and the ranks reported are then ranks within COMM.",
+  "",
+  "Arguments:",
+  "  NUMBER        Number to use in the reduce operation.",
+  "",
+  "  NAME          Array variable in which the root receives the result",
+  "                and, in the case of maxloc and minloc, the associated",
+  "                rank.  NAME is not modified on any other process.",
+  "",
+  "mpi_reduce computes the same result as mpi_allreduce but delivers it",
+  "only to ROOT, which is cheaper when only one process needs it (e.g.,",
+  "to print a summary).",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_reduce builtin. */
+DEFINE_BUILTIN(mpi_reduce, "mpi_reduce [-c comm] [-r root] [-O operation] [-d | -u] [-a | -A] number name");
+
+/* Return 1 if the variable NAME may be (re)bound or issue an error
+ * message and return 0 if it is read-only.  Unlike REQUIRE_WRITABLE,
+ * this does not unbind NAME, which may also name an input array. */
+static int
+check_writable (char *name)
+{
+  SHELL_VAR *var = find_shell_variable(name);
+
+  if (var != NULL && readonly_p(var)) {
+    err_readonly(name);
+    return 0;
+  }
+  return 1;
+}
+
+/* Concatenate elements 0 through NELTS-1 of indexed array NAME, each
+ * with its NUL terminator, into a newly allocated buffer, which the
+ * caller must free.  Missing elements are treated as empty strings.
+ * Store each element's length (including the NUL) in COUNTS. */
+static int
+pack_elements (char *name, int nelts, char **buffer, int *counts)
+{
+  SHELL_VAR *var;               /* Variable to pack */
+  ARRAY *array;                 /* Contents of the above */
+  ARRAY_ELEMENT *ae;            /* One element of the above */
+  char **strs;                  /* Value of each element, in index order */
+  size_t total = 0;             /* Number of bytes to pack */
+  char *p;                      /* Next byte to fill in */
+  int i;
+
+  var = find_variable(name);
+  if (var == NULL || invisible_p(var) || !array_p(var)) {
+    builtin_error(_("%s: not an indexed array"), name);
+    return EXECUTION_FAILURE;
+  }
+  array = array_cell(var);
+  if (array->num_elements > 0 && array->max_index >= nelts) {
+    builtin_error(_("%s: more than %d elements"), name, nelts);
+    return EXECUTION_FAILURE;
+  }
+  strs = calloc(nelts, sizeof(char *));
+  for (ae = element_forw(array_head(array)); ae != array_head(array); ae = element_forw(ae))
+    strs[element_index(ae)] = element_value(ae);
+  for (i = 0; i < nelts; i++) {
+    counts[i] = (strs[i] == NULL ? 0 : (int) strlen(strs[i])) + 1;
+    total += counts[i];
+  }
+  if (total > INT_MAX) {
+    builtin_error(_("%s: array too large to send"), name);
+    free(strs);
+    return EXECUTION_FAILURE;
+  }
+  *buffer = p = malloc(total);
+  for (i = 0; i < nelts; i++) {
+    if (strs[i] != NULL)
+      memcpy(p, strs[i], counts[i]);
+    else
+      *p = '\0';
+    p += counts[i];
+  }
+  free(strs);
+  return EXECUTION_SUCCESS;
+}
+
+/* Compute the displacement of each of NELTS blocks from their COUNTS.
+ * Return the total number of bytes or, with an error message, -1 if
+ * that exceeds an int. */
+static long
+compute_displs (int *counts, int *displs, int nelts)
+{
+  long total = 0;               /* Running sum of counts */
+  int i;
+
+  for (i = 0; i < nelts; i++) {
+    displs[i] = (int) total;
+    total += counts[i];
+    if (total > INT_MAX) {
+      builtin_error(_("too much data for a single collective"));
+      return -1;
+    }
+  }
+  return total;
+}
+
+/* Bind NELTS NUL-terminated strings, stored consecutively in BUFFER,
+ * to elements 0 through NELTS-1 of a new indexed array VARNAME. */
+static void
+bind_elements (char *varname, char *buffer, int *counts, int nelts)
+{
+  SHELL_VAR *var;               /* Array to bind */
+  int i;
+
+  if (find_shell_variable(varname) != NULL)
+    unbind_variable(varname);
+  var = make_new_array_variable(varname);
+  for (i = 0; i < nelts; i++) {
+    array_insert(array_cell(var), (arrayind_t) i, buffer);
+    buffer += counts[i];
+  }
+}
+
+/* Gather one string from every rank of COMM, either to a single root
+ * or, if ROOT is -1, to all ranks, and bind the strings to indexed
+ * array VARNAME on every rank that receives them.  If a receiver can't
+ * accept the strings, every rank fails. */
+static int
+gather_like (char *value, int root, char *varname, mpibash_comm_t *comm)
+{
+  int msglen = (int) strlen(value) + 1;   /* Length of our string including the NUL */
+  int *counts = NULL;           /* Length of each rank's string */
+  int *displs = NULL;           /* Offset of each rank's string */
+  char *buffer = NULL;          /* All ranks' strings */
+  int receives = root == -1 || root == comm->rank;    /* 1=we receive the strings */
+  long total;                   /* Number of bytes in buffer */
+  int ok = 1;                   /* 1=the receivers can accept the strings */
+  int mpierr;
+
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  mpibash_stats_bytes(comm->comm, MPI_PROC_NULL, msglen);
+  if (receives) {
+    counts = malloc(comm->size*sizeof(int));
+    displs = malloc(comm->size*sizeof(int));
+  }
+
+  /* Exchange the string lengths then the strings themselves. */
+  if (root == -1)
+    MPI_TIMED(mpierr, MPI_Allgather(&msglen, 1, MPI_INT, counts, 1, MPI_INT, comm->comm));
+  else
+    MPI_TIMED(mpierr, MPI_Gather(&msglen, 1, MPI_INT, counts, 1, MPI_INT, root, comm->comm));
+  if (mpierr == MPI_SUCCESS && receives) {
+    total = compute_displs(counts, displs, comm->size);
+    if (total == -1)
+      ok = 0;
+    else if (!check_writable(varname))
+      ok = 0;
+    else
+      buffer = malloc(total);
+  }
+
+  /* With a single root, only the root knows whether it can accept the
+   * strings, so it tells the other ranks.  With all ranks receiving,
+   * every rank saw the same lengths and so reached the same
+   * conclusion. */
+  if (mpierr == MPI_SUCCESS && root != -1)
+    MPI_TIMED(mpierr, MPI_Bcast(&ok, 1, MPI_INT, root, comm->comm));
+  if (mpierr == MPI_SUCCESS && ok) {
+    if (root == -1)
+      MPI_TIMED(mpierr, MPI_Allgatherv(value, msglen, MPI_BYTE, buffer, counts, displs,
+                                       MPI_BYTE, comm->comm));
+    else
+      MPI_TIMED(mpierr, MPI_Gatherv(value, msglen, MPI_BYTE, buffer, counts, displs,
+                                    MPI_BYTE, root, comm->comm));
+  }
+  if (mpierr == MPI_SUCCESS && ok && receives)
+    bind_elements(varname, buffer, counts, comm->size);
+  free(buffer);
+  free(counts);
+  free(displs);
+  if (mpierr != MPI_SUCCESS)
+    return mpibash_report_mpi_error(mpierr);
+  return ok ? EXECUTION_SUCCESS : EXECUTION_FAILURE;
+}
+
+/* Gather a string from every rank into an array on one rank. */
+static int
+mpi_gather_builtin (WORD_LIST *list)
+{
+  int root = 0;                 /* Rank that receives the strings */
+  char *value;                  /* String to contribute */
+  char *varname;                /* Name of the variable to bind the results to */
+  char *rootword = NULL;        /* Argument to -r */
+  mpibash_comm_t comm;          /* Communicator to gather across */
+  int opt;                      /* Parsed option */
+
+  /* Parse any options provided. */
+  mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "c:r:")) != -1) {
+    switch (opt) {
+      case 'c':
+        if (!mpibash_parse_comm(list_optarg, &comm))
+          return (EX_USAGE);
+        break;
+
+      case 'r':
+        rootword = list_optarg;
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+  if (rootword != NULL && !parse_root(rootword, comm.size, &root))
+    return (EX_USAGE);
+
+  /* Parse the string to contribute and the target variable. */
+  YES_ARGS(list);
+  value = list->word->word;
+  list = list->next;
+  YES_ARGS(list);
+  varname = list->word->word;
+  list = list->next;
+  no_args(list);
+  return gather_like(value, root, varname, &comm);
+}
+
+/* Define the documentation for the mpi_gather builtin. */
+static char *mpi_gather_doc[] = {
+  "Gather a string from every process into an array on one process.",
+  "",
+  "Options:",
+  "  -r ROOT       Gather the strings on rank ROOT (default: 0).",
+  "",
+  "  -c COMM       Gather only from the processes in communicator COMM.",
+  "                ROOT is then a rank within COMM.",
+  "",
+  "Arguments:",
+  "  VALUE         String to contribute.",
+  "",
+  "  NAME          Indexed array variable in which the root receives each",
+  "                process's VALUE, in rank order.  NAME is not modified",
+  "                on any other process.",
+  "",
+  "All processes in the MPI job must call mpi_gather together.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_gather builtin. */
+DEFINE_BUILTIN(mpi_gather, "mpi_gather [-c comm] [-r root] value name");
+
+/* Gather a string from every rank into an array on every rank. */
+static int
+mpi_allgather_builtin (WORD_LIST *list)
+{
+  char *value;                  /* String to contribute */
+  char *varname;                /* Name of the variable to bind the results to */
+  mpibash_comm_t comm;          /* Communicator to gather across */
+
+  if (mpibash_parse_comm_option(&list, &comm) != EXECUTION_SUCCESS)
+    return (EX_USAGE);
+  YES_ARGS(list);
+  value = list->word->word;
+  list = list->next;
+  YES_ARGS(list);
+  varname = list->word->word;
+  if (!check_writable(varname))
+    return EXECUTION_FAILURE;
+  list = list->next;
+  no_args(list);
+  return gather_like(value, -1, varname, &comm);
+}
+
+/* Define the documentation for the mpi_allgather builtin. */
+static char *mpi_allgather_doc[] = {
+  "Gather a string from every process into an array on every process.",
+  "",
+  "Options:",
+  "  -c COMM       Gather only from the processes in communicator COMM.",
+  "",
+  "Arguments:",
+  "  VALUE         String to contribute.",
+  "",
+  "  NAME          Indexed array variable in which to receive each",
+  "                process's VALUE, in rank order.",
+  "",
+  "All processes in the MPI job must call mpi_allgather together.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_allgather builtin. */
+DEFINE_BUILTIN(mpi_allgather, "mpi_allgather [-c comm] value name");
+
+/* Distribute the elements of an array on one rank, one per rank. */
+static int
+mpi_scatter_builtin (WORD_LIST *list)
+{
+  int root = 0;                 /* Rank that provides the strings */
+  char *inname = NULL;          /* Name of the array to scatter */
+  char *varname;                /* Name of the variable to bind the result to */
+  int *counts = NULL;           /* Length of each rank's string */
+  int *displs = NULL;           /* Offset of each rank's string */
+  char *buffer = NULL;          /* All ranks' strings */
+  int msglen;                   /* Length of our string including the NUL */
+  char *message;                /* Our string */
+  char *rootword = NULL;        /* Argument to -r */
+  mpibash_comm_t comm;          /* Communicator to scatter across */
+  int opt;                      /* Parsed option */
+  int mpierr;
+  int i;
+
+  /* Parse any options provided. */
+  mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "c:r:")) != -1) {
+    switch (opt) {
+      case 'c':
+        if (!mpibash_parse_comm(list_optarg, &comm))
+          return (EX_USAGE);
+        break;
+
+      case 'r':
+        rootword = list_optarg;
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+  if (rootword != NULL && !parse_root(rootword, comm.size, &root))
+    return (EX_USAGE);
+
+  /* Parse the array to scatter (root only) and the target variable. */
+  YES_ARGS(list);
+  if (comm.rank == root) {
+    inname = list->word->word;
+    list = list->next;
+    YES_ARGS(list);
+  }
+  varname = list->word->word;
+  if (!check_writable(varname))
+    return EXECUTION_FAILURE;
+  list = list->next;
+  no_args(list);
+
+  /* On the root, pack the array.  If that fails, scatter a length of
+   * -1 so every rank gives up together. */
+  if (comm.rank == root) {
+    counts = malloc(comm.size*sizeof(int));
+    displs = malloc(comm.size*sizeof(int));
+    if (pack_elements(inname, comm.size, &buffer, counts) == EXECUTION_SUCCESS)
+      compute_displs(counts, displs, comm.size);
+    else
+      for (i = 0; i < comm.size; i++)
+        counts[i] = -1;
+  }
+
+  /* Scatter the string lengths then the strings themselves. */
+  mpierr = mpibash_flush_batches() == EXECUTION_SUCCESS ? MPI_SUCCESS : MPI_ERR_OTHER;
+  if (mpierr == MPI_SUCCESS)
+    MPI_TIMED(mpierr, MPI_Scatter(counts, 1, MPI_INT, &msglen, 1, MPI_INT, root, comm.comm));
+  if (mpierr == MPI_SUCCESS && msglen == -1) {
+    free(buffer);
+    free(counts);
+    free(displs);
+    return EXECUTION_FAILURE;
+  }
+  if (mpierr == MPI_SUCCESS) {
+    message = malloc(msglen);
+    MPI_TIMED(mpierr, MPI_Scatterv(buffer, counts, displs, MPI_BYTE, message, msglen,
+                                   MPI_BYTE, root, comm.comm));
+    mpibash_stats_bytes(comm.comm, MPI_PROC_NULL, msglen);
+    if (mpierr == MPI_SUCCESS) {
+      if (find_shell_variable(varname) != NULL)
+        unbind_variable(varname);
+      bind_variable(varname, message, 0);
+    }
+    free(message);
+  }
+  free(buffer);
+  free(counts);
+  free(displs);
+  if (mpierr != MPI_SUCCESS)
+    return mpibash_report_mpi_error(mpierr);
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_scatter builtin. */
+static char *mpi_scatter_doc[] = {
+  "Distribute the elements of an array on one process, one per process.",
+  "",
+  "Options:",
+  "  -r ROOT       Scatter from rank ROOT (default: 0).",
+  "",
+  "  -c COMM       Scatter only to the processes in communicator COMM.",
+  "                ROOT is then a rank within COMM.",
+  "",
+  "Arguments:",
+  "  ARRAY         On the root only, indexed array whose element i is sent",
+  "                to rank i.  Missing elements are sent as empty",
+  "                strings.",
+  "",
+  "  NAME          Scalar variable in which to receive this process's",
+  "                element.",
+  "",
+  "All processes in the MPI job must call mpi_scatter together.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_scatter builtin. */
+DEFINE_BUILTIN(mpi_scatter, "mpi_scatter [-c comm] [-r root] [array] name");
+
+/* Send element i of an array on every rank to rank i. */
+static int
+mpi_alltoall_builtin (WORD_LIST *list)
+{
+  char *inname;                 /* Name of the array to send */
+  char *varname;                /* Name of the variable to bind the results to */
+  int *sendcounts;              /* Length of the string to send to each rank */
+  int *senddispls;              /* Offset of the string to send to each rank */
+  int *recvcounts;              /* Length of the string from each rank */
+  int *recvdispls;              /* Offset of the string from each rank */
+  char *sendbuf;                /* Strings to send */
+  char *recvbuf = NULL;         /* Strings received */
+  long total;                   /* Number of bytes in the above */
+  mpibash_comm_t comm;          /* Communicator to exchange across */
+  int ok;                       /* 1=all processes can exchange strings */
+  int mpierr;
+
+  /* Parse the input and output arrays. */
+  if (mpibash_parse_comm_option(&list, &comm) != EXECUTION_SUCCESS)
+    return (EX_USAGE);
+  YES_ARGS(list);
+  inname = list->word->word;
+  list = list->next;
+  YES_ARGS(list);
+  varname = list->word->word;
+  if (!check_writable(varname))
+    return EXECUTION_FAILURE;
+  list = list->next;
+  no_args(list);
+
+  /* Pack our array and exchange string lengths. */
+  sendcounts = malloc(comm.size*sizeof(int));
+  senddispls = malloc(comm.size*sizeof(int));
+  recvcounts = malloc(comm.size*sizeof(int));
+  recvdispls = malloc(comm.size*sizeof(int));
+  sendbuf = NULL;
+  ok = pack_elements(inname, comm.size, &sendbuf, sendcounts) == EXECUTION_SUCCESS;
+  if (ok)
+    compute_displs(sendcounts, senddispls, comm.size);
+  else
+    memset(sendcounts, 0, comm.size*sizeof(int));
+  mpierr = mpibash_flush_batches() == EXECUTION_SUCCESS ? MPI_SUCCESS : MPI_ERR_OTHER;
+  if (mpierr == MPI_SUCCESS)
+    MPI_TIMED(mpierr, MPI_Alltoall(sendcounts, 1, MPI_INT, recvcounts, 1, MPI_INT, comm.comm));
+
+  /* Exchange the strings themselves, but only if every rank packed its
+   * array and can hold what it will receive.  Otherwise, every rank
+   * gives up together. */
+  if (mpierr == MPI_SUCCESS) {
+    total = ok ? compute_displs(recvcounts, recvdispls, comm.size) : -1;
+    ok = total != -1;
+    MPI_TIMED(mpierr, MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, comm.comm));
+  }
+  if (mpierr == MPI_SUCCESS && ok) {
+    recvbuf = malloc(total);
+    MPI_TIMED(mpierr, MPI_Alltoallv(sendbuf, sendcounts, senddispls, MPI_BYTE,
+                                    recvbuf, recvcounts, recvdispls, MPI_BYTE,
+                                    comm.comm));
+    mpibash_stats_bytes(comm.comm, MPI_PROC_NULL, total);
+  }
+  if (mpierr == MPI_SUCCESS && ok)
+    bind_elements(varname, recvbuf, recvcounts, comm.size);
+  free(sendbuf);
+  free(recvbuf);
+  free(sendcounts);
+  free(senddispls);
+  free(recvcounts);
+  free(recvdispls);
+  if (mpierr != MPI_SUCCESS)
+    return mpibash_report_mpi_error(mpierr);
+  return ok ? EXECUTION_SUCCESS : EXECUTION_FAILURE;
+}
+
+/* Define the documentation for the mpi_alltoall builtin. */
+static char *mpi_alltoall_doc[] = {
+  "Exchange a distinct string between every pair of processes.",
+  "",
+  "Options:",
+  "  -c COMM       Exchange only among the processes in communicator COMM.",
+  "",
+  "Arguments:",
+  "  ARRAY         Indexed array whose element i is sent to rank i.",
+  "                Missing elements are sent as empty strings.",
+  "",
+  "  NAME          Indexed array variable whose element i receives the",
+  "                string sent to this process by rank i.",
+  "",
+  "All processes in the MPI job must call mpi_alltoall together.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_alltoall builtin. */
+DEFINE_BUILTIN(mpi_alltoall, "mpi_alltoall [-c comm] array name");
+
+/* Initiate a barrier. */
+static int
+mpi_ibarrier_builtin (WORD_LIST *list)
+{
+  mpibash_comm_t comm;          /* Communicator to synchronize */
+  char *reqname;                /* Name of the variable to bind the handle to */
+  mpibash_request_t *req;       /* Nonblocking request */
+  int handle;                   /* Handle corresponding to the above */
+  int mpierr;
+
+  /* Parse the arguments. */
+  if (mpibash_parse_comm_option(&list, &comm) != EXECUTION_SUCCESS)
+    return (EX_USAGE);
+  YES_ARGS(list);
+  reqname = list->word->word;
+  REQUIRE_WRITABLE(reqname);
+  list = list->next;
+  no_args(list);
+
+  /* Initiate the barrier.  Batched messages are sent first in case
+   * another process must receive them before it can reach the
+   * barrier. */
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  handle = mpibash_alloc_request();
+  req = mpibash_get_request(handle);
+  req->comm = comm.comm;
+  mpierr = MPI_Ibarrier(comm.comm, &req->request);
+  if (mpierr != MPI_SUCCESS) {
+    mpibash_release_request(handle);
+    return mpibash_report_mpi_error(mpierr);
+  }
+  mpibash_bind_variable_number(reqname, handle, 0);
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_ibarrier builtin. */
+static char *mpi_ibarrier_doc[] = {
+  "Initiate a barrier across all processes in the MPI job.",
+  "",
+  "Options:",
+  "  -c COMM       Synchronize only the processes in communicator COMM.",
+  "",
+  "Arguments:",
+  "  REQUEST       Scalar variable in which to receive a request handle.",
+  "",
+  "mpi_ibarrier returns immediately.  The barrier completes, as reported",
+  "by mpi_wait, mpi_test, mpi_waitany, or mpi_waitall, once every process",
+  "has called mpi_ibarrier.  This lets a process keep working while it",
+  "waits for the others to catch up.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_ibarrier builtin. */
+DEFINE_BUILTIN(mpi_ibarrier, "mpi_ibarrier [-c comm] request");
+
+/* Bind the result of a completed nonblocking all-reduce. */
+static int
+complete_iallreduce (mpibash_request_t *req)
+{
+  reduce_value_t result;        /* Reduced value */
+  reduce_type_t type = (reduce_type_t) req->kind;       /* Type of the above */
+  char numstr[32];              /* Reduced value as a string */
+
+  memcpy(&result, req->buffer + sizeof(reduce_value_t), sizeof(reduce_value_t));
+  bind_array_variable(req->varname, 0, "", 0);
+  bind_array_variable(req->varname, 1, "", 0);
+  format_value(type, &result, numstr);
+  bind_array_variable(req->varname, 0, numstr, 0);
+  if (req->op == MPI_MINLOC || req->op == MPI_MAXLOC)
+    mpibash_bind_array_variable_number(req->varname, 1,
+                                       type == REDUCE_DOUBLE ? result.d.rank : result.l.rank, 0);
+  return EXECUTION_SUCCESS;
+}
+
+/* Initiate an all-reduce. */
+static int
+mpi_iallreduce_builtin (WORD_LIST *list)
+{
+  char *word;                   /* One argument */
+  reduce_value_t number;        /* Value to reduce */
+  reduce_type_t type;           /* Type of the above */
+  MPI_Datatype datatype;        /* MPI datatype corresponding to the above */
+  size_t size;                  /* Bytes per value */
+  MPI_Op operation;             /* Operation to perform */
+  mpibash_comm_t comm;          /* Communicator to reduce across */
+  char *varname;                /* Name of the variable to bind the result to */
+  char *reqname;                /* Name of the variable to bind the handle to */
+  mpibash_request_t *req;       /* Nonblocking request */
+  int handle;                   /* Handle corresponding to the above */
+  int mpierr;
+
+  /* Parse the options and the number, which must be of the given
+   * type. */
+  if (parse_reduction_options(&list, "mpi_iallreduce", &type, &operation,
+                              NULL, NULL, &comm) != EXECUTION_SUCCESS)
+    return EX_USAGE;
+  word = list->word->word;
+  if (!parse_value(type, word, &number)) {
+    sh_neednumarg("mpi_iallreduce");
+    return EX_USAGE;
+  }
+  if (type == REDUCE_DOUBLE)
+    number.d.rank = comm.rank;
+  else
+    number.l.rank = comm.rank;
+  list = list->next;
+
+  /* Parse the result and request-handle variables, neither of which
+   * may be read-only. */
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  YES_ARGS(list);
+  reqname = list->word->word;
+  REQUIRE_WRITABLE(reqname);
+  list = list->next;
+  no_args(list);
+
+  /* Initiate the reduction.  The request's buffer holds our value
+   * followed by the reduced value. */
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  if (operation == MPI_MINLOC || operation == MPI_MAXLOC)
+    datatype = type == REDUCE_DOUBLE ? MPI_DOUBLE_INT : MPI_LONG_INT;
+  else
+    datatype = reduce_datatype(type, &size);
+  handle = mpibash_alloc_request();
+  req = mpibash_get_request(handle);
+  req->buffer = malloc(2*sizeof(reduce_value_t));
+  memcpy(req->buffer, &number, sizeof(reduce_value_t));
+  req->comm = comm.comm;
+  req->kind = (int) type;
+  req->op = operation;
+  req->varname = strdup(varname);
+  req->complete = complete_iallreduce;
+  mpierr = MPI_Iallreduce(req->buffer, req->buffer + sizeof(reduce_value_t),
+                          1, datatype, operation, comm.comm, &req->request);
+  if (mpierr != MPI_SUCCESS) {
+    mpibash_release_request(handle);
+    return mpibash_report_mpi_error(mpierr);
+  }
+  mpibash_bind_variable_number(reqname, handle, 0);
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_iallreduce builtin. */
+static char *mpi_iallreduce_doc[] = {
+  "Initiate an all-reduce across all processes in the MPI job.",
+  "",
+  "Options:",
+  "  -O OPERATION  Operation to perform.  Must be one of \"max\", \"min\",",
+  "                \"sum\", \"prod\", \"land\", \"band\", \"lor\", \"bor\", \"lxor\",",
+  "                \"bxor\", \"maxloc\", or \"minloc\" (default: \"sum\").",
+  "",
+  "  -d            Operate on floating-point numbers instead of integers.",
+  "                Only max, min, sum, prod, maxloc, and minloc apply.",
+  "",
+  "  -u            Operate on unsigned 64-bit integers.  maxloc and minloc",
+  "                do not apply.",
+  "",
+  "  -c COMM       Operate only across the processes in communicator COMM,",
+  "                whose ranks are then the ones reported.",
+  "",
+  "Arguments:",
+  "  NUMBER        Number to contribute to the reduction.",
+  "",
+  "  NAME          Array variable in which to receive the result and, in",
+  "                the case of maxloc and minloc, the associated rank once",
+  "                the reduction completes.",
+  "",
+  "  REQUEST       Scalar variable in which to receive a request handle.",
+  "",
+  "mpi_iallreduce returns immediately.  Pass the request handle to",
+  "mpi_wait, mpi_test, mpi_waitany, or mpi_waitall to complete the",
+  "reduction, after which NAME holds the same result mpi_allreduce would",
+  "have produced.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_iallreduce builtin. */
+DEFINE_BUILTIN(mpi_iallreduce, "mpi_iallreduce [-c comm] [-O operation] [-d | -u] number name request");
+
+/* Keep track, in posting order, of the mpi_ibcast requests whose
+ * headers may not yet have arrived.  Bodies too long for the header
+ * are broadcast in this order so that every process posts them in the
+ * same order. */
+static int *ibcast_queue = NULL;
+static int ibcast_queue_len = 0;        /* Number of handles in the above */
+static int ibcast_queue_alloced = 0;    /* Number of handles allocated for the above */
+
+/* Once the header of an mpi_ibcast request has arrived, either move
+ * the inline message into place or start broadcasting the body on the
+ * communicator's stream duplicate.  The message follows the header in
+ * the request's buffer. */
+static int
+start_ibcast_body (mpibash_request_t *req)
+{
+  int64_t hdrlen;               /* Message length from the header */
+
+  memcpy(&hdrlen, req->buffer, sizeof(int64_t));
+  req->count = (int) hdrlen;
+  req->buffer = realloc(req->buffer, BCAST_HEADER_SIZE + req->count);
+  if (req->count <= BCAST_HEADER_SIZE - (int)sizeof(int64_t)) {
+    memmove(req->buffer + BCAST_HEADER_SIZE, req->buffer + sizeof(int64_t),
+            req->count);
+    req->state = MPIBASH_REQ_DONE;
+    return MPI_SUCCESS;
+  }
+  req->state = MPIBASH_REQ_ACTIVE;
+  return MPI_Ibcast(req->buffer + BCAST_HEADER_SIZE, req->count, MPI_BYTE,
+                    req->peer, mpibash_stream_comm_of(req->comm), &req->request);
+}
+
+/* Advance a deferred mpi_ibcast request by processing, in order, the
+ * headers of it and of all earlier requests. */
+static int
+post_ibcast (mpibash_request_t *req, int block)
+{
+  mpibash_request_t *first;     /* Oldest request awaiting its header */
+  int flag = 1;                 /* 1=the header arrived */
+  int mpierr;
+
+  while (req->state == MPIBASH_REQ_DEFERRED) {
+    first = mpibash_get_request(ibcast_queue[0]);
+    if (block)
+      MPI_TIMED(mpierr, MPI_Wait(&first->request, MPI_STATUS_IGNORE));
+    else
+      mpierr = MPI_Test(&first->request, &flag, MPI_STATUS_IGNORE);
+    if (mpierr != MPI_SUCCESS || !flag)
+      return mpierr;
+    ibcast_queue_len--;
+    memmove(ibcast_queue, ibcast_queue + 1, ibcast_queue_len*sizeof(int));
+    mpierr = start_ibcast_body(first);
+    if (mpierr != MPI_SUCCESS)
+      return mpierr;
+  }
+  return MPI_SUCCESS;
+}
+
+/* Bind the message of a completed nonblocking broadcast. */
+static int
+complete_ibcast (mpibash_request_t *req)
+{
+  bind_variable(req->varname, req->buffer + BCAST_HEADER_SIZE, 0);
+  return EXECUTION_SUCCESS;
+}
+
+/* Initiate a broadcast from a known root. */
+static int
+mpi_ibcast_builtin (WORD_LIST *list)
+{
+  char *rootword = NULL;        /* Argument to -r */
+  int root;                     /* Rank that provides the message */
+  mpibash_comm_t comm;          /* Communicator to broadcast across */
+  char *message = NULL;         /* Message to broadcast (root only) */
+  int msglen = 0;               /* Length in bytes of the above (including the NUL byte) */
+  int64_t hdrlen;               /* Message length as stored in the header */
+  char *varname;                /* Name of the variable to bind the message to */
+  char *reqname;                /* Name of the variable to bind the handle to */
+  mpibash_request_t *req;       /* Nonblocking request */
+  int handle;                   /* Handle corresponding to the above */
+  int opt;                      /* Parsed option */
+  int mpierr;
+
+  /* Parse any options provided.  Unlike mpi_bcast, the root must be
+   * given, as discovering it would require blocking. */
+  mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "c:r:")) != -1) {
+    switch (opt) {
+      case 'c':
+        if (!mpibash_parse_comm(list_optarg, &comm))
+          return (EX_USAGE);
+        break;
+
+      case 'r':
+        rootword = list_optarg;
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+  if (rootword == NULL) {
+    builtin_error(_("-r is required"));
+    return (EX_USAGE);
+  }
+  if (!parse_root(rootword, comm.size, &root))
+    return (EX_USAGE);
+
+  /* Parse the message (root only), the message variable, and the
+   * request-handle variable. */
+  YES_ARGS(list);
+  if (comm.rank == root) {
+    message = list->word->word;
+    msglen = (int) strlen(message) + 1;
+    list = list->next;
+    YES_ARGS(list);
+  }
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  YES_ARGS(list);
+  reqname = list->word->word;
+  REQUIRE_WRITABLE(reqname);
+  list = list->next;
+  no_args(list);
+
+  /* Initiate broadcasting a fixed-size header holding the message
+   * length and, if it fits, the message itself.  The root also keeps
+   * the message after the header for broadcasting the body. */
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  handle = mpibash_alloc_request();
+  req = mpibash_get_request(handle);
+  req->state = MPIBASH_REQ_DEFERRED;
+  req->comm = comm.comm;
+  req->peer = root;
+  req->varname = strdup(varname);
+  req->post = post_ibcast;
+  req->complete = complete_ibcast;
+  req->buffer = malloc(BCAST_HEADER_SIZE + msglen);
+  if (message != NULL) {
+    hdrlen = msglen;
+    memcpy(req->buffer, &hdrlen, sizeof(int64_t));
+    if (msglen <= BCAST_HEADER_SIZE - (int)sizeof(int64_t))
+      memcpy(req->buffer + sizeof(int64_t), message, msglen);
+    memcpy(req->buffer + BCAST_HEADER_SIZE, message, msglen);
+  }
+  mpierr = MPI_Ibcast(req->buffer, BCAST_HEADER_SIZE, MPI_BYTE, root,
+                      comm.comm, &req->request);
+  if (mpierr != MPI_SUCCESS) {
+    mpibash_release_request(handle);
+    return mpibash_report_mpi_error(mpierr);
+  }
+  if (ibcast_queue_len == ibcast_queue_alloced) {
+    ibcast_queue_alloced = ibcast_queue_alloced == 0 ? 16 : ibcast_queue_alloced*2;
+    ibcast_queue = realloc(ibcast_queue, ibcast_queue_alloced*sizeof(int));
+  }
+  ibcast_queue[ibcast_queue_len++] = handle;
+  mpibash_bind_variable_number(reqname, handle, 0);
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_ibcast builtin. */
+static char *mpi_ibcast_doc[] = {
+  "Initiate broadcasting a message to all processes in the MPI job.",
+  "",
+  "Options:",
+  "  -r ROOT       Broadcast from rank ROOT.  This option is required.",
+  "",
+  "  -c COMM       Broadcast only among the processes in communicator COMM.",
+  "                ROOT is then a rank within COMM.",
+  "",
+  "Arguments:",
+  "  MESSAGE       On the root only, string to broadcast.",
+  "",
+  "  NAME          Scalar variable in which to receive the message once",
+  "                the broadcast completes.",
+  "",
+  "  REQUEST       Scalar variable in which to receive a request handle.",
+  "",
+  "mpi_ibcast returns immediately.  Pass the request handle to mpi_wait,",
+  "mpi_test, mpi_waitany, or mpi_waitall to complete the broadcast.",
+  "Short messages travel in a single broadcast; longer ones take a second",
+  "broadcast that starts once the first completes.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_ibcast builtin. */
+DEFINE_BUILTIN(mpi_ibcast, "mpi_ibcast [-c comm] -r root [message] name request");
+
+/* Locate field FIELD (numbered from 1) of RECORD, where fields are
+ * separated by character DELIM or, if DELIM is '\0', by runs of
+ * blanks.  A FIELD of 0 selects the entire record.  A missing field is
+ * empty.  Store the field's start in *KEY and its length in *LEN. */
+static void
+find_key (const char *record, int field, int delim, const char **key,
+          size_t *len)
+{
+  const char *p = record;       /* Start of the current field */
+  const char *end;              /* End of the above */
+  int i;
+
+  if (field == 0) {
+    *key = record;
+    *len = strlen(record);
+    return;
+  }
+  for (i = 1; ; i++) {
+    if (delim == '\0')
+      while (*p == ' ' || *p == '\t' || *p == '\n')
+        p++;
+    if (delim == '\0')
+      end = p + strcspn(p, " \t\n");
+    else {
+      end = strchr(p, delim);
+      if (end == NULL)
+        end = p + strlen(p);
+    }
+    if (i == field || *end == '\0')
+      break;
+    p = end + 1;
+  }
+  if (i == field) {
+    *key = p;
+    *len = end - p;
+  }
+  else {
+    *key = "";
+    *len = 0;
+  }
+}
+
+/* Route each element of an array to the rank that owns its key. */
+static int
+mpi_shuffle_builtin (WORD_LIST *list)
+{
+  mpibash_comm_t comm;          /* Communicator to shuffle across */
+  intmax_t field = 1;           /* Key field number (0=entire record) */
+  int delim = '\0';             /* Field delimiter ('\0'=blanks) */
+  char *inname;                 /* Name of the array to shuffle */
+  char *varname;                /* Name of the variable to bind the results to */
+  SHELL_VAR *var;               /* Array to shuffle */
+  ARRAY *array;                 /* Contents of the above */
+  ARRAY_ELEMENT *ae;            /* One element of the above */
+  const char *key;              /* Key of one record */
+  size_t keylen;                /* Number of bytes in the above */
+  int *dests;                   /* Destination rank of each element */
+  int *sendcounts;              /* Bytes to send to each rank */
+  int *senddispls;              /* Offset of the bytes to send to each rank */
+  int *recvcounts;              /* Bytes to receive from each rank */
+  int *recvdispls;              /* Offset of the bytes from each rank */
+  int *offsets;                 /* Next byte to fill in for each rank */
+  char *sendbuf = NULL;         /* Records to send */
+  char *recvbuf = NULL;         /* Records received */
+  long total;                   /* Number of bytes in either of the above */
+  char *p;                      /* One received record */
+  long nelts;                   /* Number of records received */
+  long i;
+  int opt;                      /* Parsed option */
+  int ok;                       /* 1=all processes can exchange records */
+  int mpierr;
+
+  /* Parse any options provided. */
+  mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "c:k:t:")) != -1) {
+    switch (opt) {
+      case 'c':
+        if (!mpibash_parse_comm(list_optarg, &comm))
+          return (EX_USAGE);
+        break;
+
+      case 'k':
+        if (!legal_number(list_optarg, &field) || field < 0 || field > INT_MAX) {
+          builtin_error(_("-k: nonnegative field number required"));
+          return (EX_USAGE);
+        }
+        break;
+
+      case 't':
+        if (strlen(list_optarg) != 1) {
+          builtin_error(_("-t: single character required"));
+          return (EX_USAGE);
+        }
+        delim = list_optarg[0];
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+
+  /* Parse the input and output arrays. */
+  YES_ARGS(list);
+  inname = list->word->word;
+  list = list->next;
+  YES_ARGS(list);
+  varname = list->word->word;
+  if (!check_writable(varname))
+    return EXECUTION_FAILURE;
+  list = list->next;
+  no_args(list);
+
+  /* Hash each record's key to a destination and tally the bytes bound
+   * for each rank.  A process that can't send its records still takes
+   * part in the exchange, sending nothing, so every rank gives up
+   * together. */
+  var = find_variable(inname);
+  ok = var != NULL && !invisible_p(var) && array_p(var);
+  if (!ok)
+    builtin_error(_("%s: not an indexed array"), inname);
+  array = ok ? array_cell(var) : NULL;
+  dests = malloc(((ok ? array->num_elements : 0) + 1)*sizeof(int));
+  sendcounts = calloc(comm.size, sizeof(int));
+  senddispls = malloc(comm.size*sizeof(int));
+  recvcounts = malloc(comm.size*sizeof(int));
+  recvdispls = malloc(comm.size*sizeof(int));
+  offsets = malloc(comm.size*sizeof(int));
+  if (ok)
+    for (i = 0, ae = element_forw(array_head(array)); ok && ae != array_head(array); i++, ae = element_forw(ae)) {
+      size_t len = strlen(element_value(ae)) + 1;     /* Bytes in this record */
+
+      find_key(element_value(ae), (int) field, delim, &key, &keylen);
+      dests[i] = (int) (mpibash_hash_key(key, keylen) % (uint64_t) comm.size);
+      if (len > (size_t) (INT_MAX - sendcounts[dests[i]])) {
+        builtin_error(_("%s: array too large to send"), inname);
+        ok = 0;
+      }
+      else
+        sendcounts[dests[i]] += (int) len;
+    }
+  total = ok ? compute_displs(sendcounts, senddispls, comm.size) : -1;
+  ok = total != -1;
+
+  /* Pack the records in destination order. */
+  if (ok) {
+    memcpy(offsets, senddispls, comm.size*sizeof(int));
+    sendbuf = malloc(total + 1);
+    for (i = 0, ae = element_forw(array_head(array)); ae != array_head(array); i++, ae = element_forw(ae)) {
+      size_t len = strlen(element_value(ae)) + 1;     /* Bytes in this record */
+
+      memcpy(sendbuf + offsets[dests[i]], element_value(ae), len);
+      offsets[dests[i]] += (int) len;
+    }
+  }
+  else
+    memset(sendcounts, 0, comm.size*sizeof(int));
+
+  /* Exchange byte counts.  Exchange the records themselves only if
+   * every rank packed its records and can hold what it will receive. */
+  mpierr = mpibash_flush_batches() == EXECUTION_SUCCESS ? MPI_SUCCESS : MPI_ERR_OTHER;
+  if (mpierr == MPI_SUCCESS)
+    MPI_TIMED(mpierr, MPI_Alltoall(sendcounts, 1, MPI_INT, recvcounts, 1, MPI_INT, comm.comm));
+  if (mpierr == MPI_SUCCESS) {
+    total = ok ? compute_displs(recvcounts, recvdispls, comm.size) : -1;
+    ok = total != -1;
+    MPI_TIMED(mpierr, MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, comm.comm));
+  }
+  if (mpierr == MPI_SUCCESS && ok) {
+    recvbuf = malloc(total + 1);
+    MPI_TIMED(mpierr, MPI_Alltoallv(sendbuf, sendcounts, senddispls, MPI_BYTE,
+                                    recvbuf, recvcounts, recvdispls, MPI_BYTE,
+                                    comm.comm));
+    mpibash_stats_bytes(comm.comm, MPI_PROC_NULL, total);
+  }
+
+  /* Bind the received records, in order of source rank, to a new
+   * indexed array. */
+  if (mpierr == MPI_SUCCESS && ok) {
+    if (find_shell_variable(varname) != NULL)
+      unbind_variable(varname);
+    var = make_new_array_variable(varname);
+    for (nelts = 0, p = recvbuf; p < recvbuf + total; nelts++, p += strlen(p) + 1)
+      array_insert(array_cell(var), (arrayind_t) nelts, p);
+  }
+  free(sendbuf);
+  free(recvbuf);
+  free(dests);
+  free(sendcounts);
+  free(senddispls);
+  free(recvcounts);
+  free(recvdispls);
+  free(offsets);
+  if (mpierr != MPI_SUCCESS)
+    return mpibash_report_mpi_error(mpierr);
+  return ok ? EXECUTION_SUCCESS : EXECUTION_FAILURE;
+}
+
+/* Define the documentation for the mpi_shuffle builtin. */
+static char *mpi_shuffle_doc[] = {
+  "Route each record to the process that owns its key.",
+  "",
+  "Options:",
+  "  -k FIELD      Use field FIELD (numbered from 1) of each record as its",
+  "                key (default: 1).  0 uses the entire record.",
+  "",
+  "  -t CHAR       Separate fields with CHAR instead of runs of blanks.",
+  "",
+  "  -c COMM       Shuffle only among the processes in communicator COMM.",
+  "",
+  "Arguments:",
+  "  ARRAY         Indexed array of records to shuffle.",
+  "",
+  "  NAME          Indexed array variable in which to receive the records",
+  "                whose keys this process owns.",
+  "",
+  "Each key is hashed to a rank, so all records with the same key, from",
+  "every process, end up on the same process.  Records arrive in order",
+  "of the sending rank and, within a rank, in ARRAY's order.  All",
+  "processes in the MPI job must call mpi_shuffle together.  This is the",
+  "shuffle step of a MapReduce-style group-by.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_shuffle builtin. */
+DEFINE_BUILTIN(mpi_shuffle, "mpi_shuffle [-c comm] [-k field] [-t char] array name");
@@ -0,0 +1,373 @@
+/*************************************
+ * MPI-Bash communicator management  *
+ *                                   *
+ * By Scott Pakin <pakin@lanl.gov>   *
+ *************************************/
+
+#include "mpibash.h"
+
+static mpibash_comm_t *comm_table = NULL;   /* All communicators, indexed by handle */
+static int comm_table_size = 0;             /* Number of entries allocated in the above */
+
+/* Enter MPI_COMM_WORLD into the communicator table as handle
+ * MPIBASH_COMM_WORLD.  This is called once by mpi_init. */
+void
+mpibash_init_comms (void)
+{
+  comm_table_size = 8;
+  comm_table = calloc(comm_table_size, sizeof(mpibash_comm_t));
+  comm_table[MPIBASH_COMM_WORLD].in_use = 1;
+  comm_table[MPIBASH_COMM_WORLD].comm = MPI_COMM_WORLD;
+  comm_table[MPIBASH_COMM_WORLD].stream_comm = mpibash_stream_comm;
+  comm_table[MPIBASH_COMM_WORLD].coll_comm = mpibash_coll_comm;
+  comm_table[MPIBASH_COMM_WORLD].rank = mpibash_rank;
+  comm_table[MPIBASH_COMM_WORLD].size = mpibash_num_ranks;
+}
+
+/* Copy the communicator with a given handle into *COMM. */
+void
+mpibash_get_comm (int handle, mpibash_comm_t *comm)
+{
+  *comm = comm_table[handle];
+}
+
+/* Parse a communicator handle and copy the communicator into *COMM.
+ * Return 1 on success, 0 on failure. */
+int
+mpibash_parse_comm (char *word, mpibash_comm_t *comm)
+{
+  intmax_t n;
+
+  if (!legal_number(word, &n) || n < 0 || n >= comm_table_size
+      || !comm_table[n].in_use) {
+    builtin_error(_("%s: invalid communicator handle"), word);
+    return 0;
+  }
+  *comm = comm_table[n];
+  return 1;
+}
+
+/* Return the private duplicate of COMM that carries streamed file
+ * contents. */
+MPI_Comm
+mpibash_stream_comm_of (MPI_Comm comm)
+{
+  int handle;
+
+  for (handle = 0; handle < comm_table_size; handle++)
+    if (comm_table[handle].in_use && comm_table[handle].comm == comm)
+      return comm_table[handle].stream_comm;
+  return mpibash_stream_comm;
+}
+
+/* Enter a newly created communicator into the table and bind its
+ * handle to VARNAME.  If NEWCOMM is MPI_COMM_NULL, leave VARNAME
+ * unset. */
+static int
+register_comm (MPI_Comm newcomm, char *varname)
+{
+  mpibash_comm_t *entry;        /* New table entry */
+  int handle;                   /* Handle corresponding to the above */
+
+  if (newcomm == MPI_COMM_NULL)
+    return EXECUTION_SUCCESS;
+
+  /* Reuse a free entry if possible.  Otherwise, grow the table. */
+  for (handle = 0; handle < comm_table_size; handle++)
+    if (!comm_table[handle].in_use)
+      break;
+  if (handle == comm_table_size) {
+    int newsize = comm_table_size*2;
+
+    comm_table = realloc(comm_table, newsize*sizeof(mpibash_comm_t));
+    memset(&comm_table[comm_table_size], 0,
+           (newsize - comm_table_size)*sizeof(mpibash_comm_t));
+    comm_table_size = newsize;
+  }
+
+  /* Initialize the entry. */
+  entry = &comm_table[handle];
+  MPI_TRY(MPI_Comm_set_errhandler(newcomm, MPI_ERRORS_RETURN));
+  MPI_TRY(MPI_Comm_dup(newcomm, &entry->stream_comm));
+  MPI_TRY(MPI_Comm_dup(newcomm, &entry->coll_comm));
+  MPI_TRY(MPI_Comm_rank(newcomm, &entry->rank));
+  MPI_TRY(MPI_Comm_size(newcomm, &entry->size));
+  entry->comm = newcomm;
+  entry->in_use = 1;
+  mpibash_bind_variable_number(varname, handle, 0);
+  return EXECUTION_SUCCESS;
+}
+
+/* Parse "-c COMM" (optional), the only option a builtin accepts, into
+ * *COMM, which defaults to MPI_COMM_WORLD.  Advance *LIST past the
+ * option. */
+int
+mpibash_parse_comm_option (WORD_LIST **list, mpibash_comm_t *comm)
+{
+  int opt;                      /* Parsed option */
+
+  mpibash_get_comm(MPIBASH_COMM_WORLD, comm);
+  reset_internal_getopt();
+  while ((opt = internal_getopt(*list, "c:")) != -1) {
+    switch (opt) {
+      case 'c':
+        if (!mpibash_parse_comm(list_optarg, comm))
+          return (EX_USAGE);
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  *list = loptend;
+  return EXECUTION_SUCCESS;
+}
+
+/* Split a communicator into disjoint subcommunicators by color. */
+static int
+mpi_comm_split_builtin (WORD_LIST *list)
+{
+  mpibash_comm_t comm;          /* Communicator to split */
+  char *word;                   /* One argument */
+  intmax_t color;               /* Subcommunicator to join */
+  intmax_t key;                 /* Sort key within the subcommunicator */
+  char *varname;                /* Name of the variable to bind the handle to */
+  MPI_Comm newcomm;             /* New subcommunicator */
+
+  /* Parse the arguments. */
+  if (mpibash_parse_comm_option(&list, &comm) != EXECUTION_SUCCESS)
+    return (EX_USAGE);
+  YES_ARGS(list);
+  word = list->word->word;
+  if (!strcmp(word, "none"))
+    color = MPI_UNDEFINED;
+  else if (!legal_number(word, &color) || color < 0) {
+    builtin_error(_("mpi_comm_split: nonnegative color or \"none\" required"));
+    return (EX_USAGE);
+  }
+  list = list->next;
+  YES_ARGS(list);
+  if (!legal_number(list->word->word, &key)) {
+    builtin_error(_("mpi_comm_split: numeric key required"));
+    return (EX_USAGE);
+  }
+  list = list->next;
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  no_args(list);
+
+  /* Split the communicator. */
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  MPI_TRY(MPI_Comm_split(comm.comm, (int) color, (int) key, &newcomm));
+  return register_comm(newcomm, varname);
+}
+
+/* Define the documentation for the mpi_comm_split builtin. */
+static char *mpi_comm_split_doc[] = {
+  "Split a communicator into subcommunicators.",
+  "",
+  "Options:",
+  "  -c COMM       Split communicator COMM (default: all processes).",
+  "",
+  "Arguments:",
+  "  COLOR         Nonnegative integer naming the subcommunicator to join",
+  "                or \"none\" to join none.",
+  "",
+  "  KEY           Integer that orders ranks within the subcommunicator.",
+  "",
+  "  NAME          Scalar variable in which to receive a handle to the new",
+  "                communicator.  NAME is left unset if COLOR is \"none\".",
+  "",
+  "All processes in COMM must call mpi_comm_split together.  Pass the",
+  "handle to the -c option of other MPI-Bash builtins to confine them to",
+  "the subcommunicator.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_comm_split builtin. */
+DEFINE_BUILTIN(mpi_comm_split, "mpi_comm_split [-c comm] color key name");
+
+/* Split a communicator into subcommunicators of processes that share
+ * memory. */
+static int
+mpi_comm_split_type_builtin (WORD_LIST *list)
+{
+  mpibash_comm_t comm;          /* Communicator to split */
+  char *word;                   /* One argument */
+  char *varname;                /* Name of the variable to bind the handle to */
+  MPI_Comm newcomm;             /* New subcommunicator */
+
+  /* Parse the arguments. */
+  if (mpibash_parse_comm_option(&list, &comm) != EXECUTION_SUCCESS)
+    return (EX_USAGE);
+  YES_ARGS(list);
+  word = list->word->word;
+  if (strcmp(word, "shared")) {
+    builtin_error(_("%s: \"shared\" required"), word);
+    return (EX_USAGE);
+  }
+  list = list->next;
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  no_args(list);
+
+  /* Split the communicator, preserving rank order. */
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  MPI_TRY(MPI_Comm_split_type(comm.comm, MPI_COMM_TYPE_SHARED, comm.rank,
+                              MPI_INFO_NULL, &newcomm));
+  return register_comm(newcomm, varname);
+}
+
+/* Define the documentation for the mpi_comm_split_type builtin. */
+static char *mpi_comm_split_type_doc[] = {
+  "Split a communicator into one subcommunicator per node.",
+  "",
+  "Options:",
+  "  -c COMM       Split communicator COMM (default: all processes).",
+  "",
+  "Arguments:",
+  "  shared        Group processes that can share memory.  This is the",
+  "                only type currently supported.",
+  "",
+  "  NAME          Scalar variable in which to receive a handle to the new",
+  "                communicator.",
+  "",
+  "All processes in COMM must call mpi_comm_split_type together.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_comm_split_type builtin. */
+DEFINE_BUILTIN(mpi_comm_split_type, "mpi_comm_split_type [-c comm] shared name");
+
+/* Duplicate a communicator. */
+static int
+mpi_comm_dup_builtin (WORD_LIST *list)
+{
+  mpibash_comm_t comm;          /* Communicator to duplicate */
+  char *varname;                /* Name of the variable to bind the handle to */
+  MPI_Comm newcomm;             /* New communicator */
+
+  if (mpibash_parse_comm_option(&list, &comm) != EXECUTION_SUCCESS)
+    return (EX_USAGE);
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  no_args(list);
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  MPI_TRY(MPI_Comm_dup(comm.comm, &newcomm));
+  return register_comm(newcomm, varname);
+}
+
+/* Define the documentation for the mpi_comm_dup builtin. */
+static char *mpi_comm_dup_doc[] = {
+  "Duplicate a communicator.",
+  "",
+  "Options:",
+  "  -c COMM       Duplicate communicator COMM (default: all processes).",
+  "",
+  "Arguments:",
+  "  NAME          Scalar variable in which to receive a handle to the new",
+  "                communicator.",
+  "",
+  "Messages on the new communicator never match messages on the old",
+  "one.  All processes in COMM must call mpi_comm_dup together.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_comm_dup builtin. */
+DEFINE_BUILTIN(mpi_comm_dup, "mpi_comm_dup [-c comm] name");
+
+/* Free a communicator. */
+static int
+mpi_comm_free_builtin (WORD_LIST *list)
+{
+  mpibash_comm_t comm;          /* Communicator to free */
+  int handle;                   /* Handle corresponding to the above */
+  int nreqs;                    /* Number of requests still using comm */
+  int ok;                       /* 1=no process has such requests */
+  int ndiscarded;               /* Number of messages never received */
+
+  YES_ARGS(list);
+  if (!mpibash_parse_comm(list->word->word, &comm))
+    return (EX_USAGE);
+  handle = atoi(list->word->word);
+  list = list->next;
+  no_args(list);
+  if (handle == MPIBASH_COMM_WORLD) {
+    builtin_error(_("the communicator of all processes cannot be freed"));
+    return EXECUTION_FAILURE;
+  }
+
+  /* Send any batched messages, as other processes may need them
+   * before they reach mpi_comm_free. */
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+
+  /* Requests would outlive the communicator they refer to.  Because
+   * freeing is collective, either every process frees the communicator
+   * or none does. */
+  nreqs = mpibash_count_requests(comm.comm);
+  if (nreqs > 0)
+    builtin_error(_("%d outstanding request(s) still use the communicator"),
+                  nreqs);
+  ok = nreqs == 0;
+  MPI_TRY(MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, comm.comm));
+  if (!ok)
+    return EXECUTION_FAILURE;
+
+  /* Drop any received messages that were never asked for so a later
+   * communicator can't match them. */
+  ndiscarded = mpibash_discard_pending(comm.comm);
+  comm_table[handle].in_use = 0;
+  mpibash_tool_release_comm(comm_table[handle].comm);
+  MPI_TRY(MPI_Comm_free(&comm_table[handle].stream_comm));
+  MPI_TRY(MPI_Comm_free(&comm_table[handle].coll_comm));
+  MPI_TRY(MPI_Comm_free(&comm_table[handle].comm));
+  if (ndiscarded > 0) {
+    builtin_error(_("discarded %d message(s) that were never received"),
+                  ndiscarded);
+    return EXECUTION_FAILURE;
+  }
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_comm_free builtin. */
+static char *mpi_comm_free_doc[] = {
+  "Free a communicator.",
+  "",
+  "Arguments:",
+  "  COMM          Communicator handle returned by mpi_comm_split,",
+  "                mpi_comm_split_type, or mpi_comm_dup.",
+  "",
+  "All processes in COMM must call mpi_comm_free together.  Complete",
+  "all requests on COMM with mpi_wait or mpi_waitall and free all",
+  "key-value stores created on COMM with mpi_kv_free first.  Messages",
+  "sent on COMM but never received are discarded.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given, an error occurs,",
+  "any process still has requests on COMM outstanding, or messages were",
+  "discarded.",
+  NULL
+};
+
+/* Describe the mpi_comm_free builtin. */
+DEFINE_BUILTIN(mpi_comm_free, "mpi_comm_free comm");
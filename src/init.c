@@ -9,16 +9,55 @@
 static int we_called_init = 0;  /* 1=we called MPI_Init(); 0=it was called for us */
 static char *all_mpibash_builtins[] = {  /* All builtins MPI-Bash defines except mpi_init */
   "mpi_abort",
+  "mpi_allgather",
   "mpi_allreduce",
+  "mpi_alltoall",
   "mpi_barrier",
   "mpi_bcast",
+  "mpi_bcast_file",
+  "mpi_channel_close",
+  "mpi_channel_open",
+  "mpi_channel_recv",
+  "mpi_channel_send",
+  "mpi_comm_dup",
+  "mpi_comm_free",
   "mpi_comm_rank",
   "mpi_comm_size",
+  "mpi_comm_split",
+  "mpi_comm_split_type",
+  "mpi_eager",
   "mpi_exscan",
   "mpi_finalize",
+  "mpi_flush",
+  "mpi_gather",
+  "mpi_iallreduce",
+  "mpi_ibarrier",
+  "mpi_ibcast",
+  "mpi_irecv",
+  "mpi_isend",
+  "mpi_kv_cas",
+  "mpi_kv_create",
+  "mpi_kv_free",
+  "mpi_kv_get",
+  "mpi_kv_put",
   "mpi_recv",
+  "mpi_reduce",
   "mpi_scan",
+  "mpi_scatter",
   "mpi_send",
+  "mpi_sendrecv",
+  "mpi_shift",
+  "mpi_shuffle",
+  "mpi_sort",
+  "mpi_stats",
+  "mpi_t_cvar",
+  "mpi_t_pvar",
+  "mpi_test",
+  "mpi_timer",
+  "mpi_wait",
+  "mpi_waitall",
+  "mpi_waitany",
+  "mpi_wtime",
   NULL
 };
 
@@ -26,39 +65,47 @@ static char *all_mpibash_builtins[] = {  /* All builtins MPI-Bash defines except
 int mpibash_rank;
 int mpibash_num_ranks;
 
-/* Load another builtin from our plugin by invoking "enable -f
- * mpibash.so <name>". */
-static int
-load_mpi_builtin (char *name)
-{
-  static char *mpibash_so = NULL;   /* Path to mpibash.so */
+/* Carry streamed file contents on a private duplicate of
+ * MPI_COMM_WORLD so they can never match an ordinary receive. */
+MPI_Comm mpibash_stream_comm = MPI_COMM_NULL;
 
-  /* Find our .so file name. */
-  if (mpibash_so == NULL) {
-    Dl_info self_info;
+/* Likewise, carry persistent-channel messages on a private duplicate
+ * of MPI_COMM_WORLD. */
+MPI_Comm mpibash_channel_comm = MPI_COMM_NULL;
 
-    if (dladdr(load_mpi_builtin, &self_info) == 0 || self_info.dli_fname == NULL) {
-      fprintf(stderr, _("mpi_init: failed to find the MPI-Bash .so file\n"));
-      return EXECUTION_FAILURE;
-    }
-    mpibash_so = strdup(self_info.dli_fname);
-  }
-
-  /* Enable the given MPI-Bash function. */
-  return mpibash_invoke_bash_command("enable", "-f", mpibash_so, name, NULL);
-}
+/* Likewise, carry the point-to-point steps of collectives implemented
+ * by hand on a private duplicate of MPI_COMM_WORLD. */
+MPI_Comm mpibash_coll_comm = MPI_COMM_NULL;
 
-/* Initialize MPI with MPI_Init().  This has never worked for me with
- * Open MPI so we provide a hack in which the user can set
- * LD_PRELOAD=mpibash.so in advance of running bash. */
+/* Initialize MPI with MPI_Init() or, given -t, MPI_Init_thread().
+ * This has never worked for me with Open MPI so we provide a hack in
+ * which the user can set LD_PRELOAD=mpibash.so in advance of running
+ * bash. */
 static int
 mpi_init_builtin (WORD_LIST *list)
 {
   int inited;
-  char **func;
+  int threaded = 0;             /* 1=start a progress thread */
+  int provided;                 /* Thread level MPI provides */
+  int opt;                      /* Parsed option */
 
-  /* Initialize MPI. */
+  /* Parse the command line. */
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "t")) != -1) {
+    switch (opt) {
+      case 't':
+        threaded = 1;
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
   no_args(list);
+
+  /* Initialize MPI. */
   MPI_Initialized(&inited);
   if (!inited) {
     /* MPI_Init() has not yet been called.  For Open MPI, at least,
@@ -68,7 +115,10 @@ mpi_init_builtin (WORD_LIST *list)
     char **margv = &marg;
     int margc = 1;
 
-    MPI_Init(&margc, &margv);
+    if (threaded)
+      MPI_Init_thread(&margc, &margv, MPI_THREAD_SERIALIZED, &provided);
+    else
+      MPI_Init(&margc, &margv);
     we_called_init = 1;
   }
 
@@ -77,16 +127,34 @@ mpi_init_builtin (WORD_LIST *list)
   MPI_Comm_set_errhandler (MPI_COMM_WORLD, MPI_ERRORS_RETURN);
   MPI_Comm_rank (MPI_COMM_WORLD, &mpibash_rank);
   MPI_Comm_size (MPI_COMM_WORLD, &mpibash_num_ranks);
+  MPI_Comm_dup (MPI_COMM_WORLD, &mpibash_stream_comm);
+  MPI_Comm_dup (MPI_COMM_WORLD, &mpibash_channel_comm);
+  MPI_Comm_dup (MPI_COMM_WORLD, &mpibash_coll_comm);
+  mpibash_init_comms();
+  mpibash_init_tool();
 
-  /* As a convenience for the user, load all of the other MPI-Bash builtins. */
-  for (func = all_mpibash_builtins; *func; func++)
-    if (load_mpi_builtin(*func) != EXECUTION_SUCCESS)
-      return EXECUTION_FAILURE;
+  /* As a convenience for the user, load all of the other MPI-Bash
+   * builtins in a single pass. */
+  if (mpibash_register_builtins(mpi_init_builtin, all_mpibash_builtins) != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
 
   /* The LD_PRELOAD of mpibash.so seems to mess up ordinary commands we try to
    * run.  Remove that variable from the environment. */
   if (mpibash_invoke_bash_command("unset", "LD_PRELOAD", NULL) != EXECUTION_SUCCESS)
     return EXECUTION_FAILURE;
+
+  /* Start the progress thread last so it never races with the above.
+   * If MPI was initialized for us, it may not be thread-safe.  The
+   * thread and the builtins never call MPI concurrently, so
+   * MPI_THREAD_SERIALIZED suffices. */
+  if (threaded) {
+    MPI_Query_thread(&provided);
+    if (provided < MPI_THREAD_SERIALIZED) {
+      builtin_error(_("MPI does not support MPI_THREAD_SERIALIZED; no progress thread started"));
+      return EXECUTION_FAILURE;
+    }
+    return mpibash_start_progress();
+  }
   return EXECUTION_SUCCESS;
 }
 
@@ -94,23 +162,45 @@ mpi_init_builtin (WORD_LIST *list)
 static char *mpi_init_doc[] = {
   "Initialize MPI and MPI-Bash.",
   "",
-  "Invoke MPI_Init() then load all of the other MPI-Bash builtins.",
+  "Invoke MPI_Init() and initialize the MPI tool information interface",
+  "(see mpi_t_pvar and mpi_t_cvar), then load all of the other MPI-Bash",
+  "builtins.",
+  "",
+  "Options:",
+  "  -t            Initialize MPI with MPI_THREAD_SERIALIZED and start a",
+  "                background thread that advances nonblocking",
+  "                requests (e.g., from mpi_isend, mpi_irecv, and",
+  "                mpi_ibcast) while the script runs other commands.",
+  "",
+  "Without -t, nonblocking requests progress only while an MPI-Bash",
+  "builtin is running.",
   "",
   "Exit Status:",
   "Returns success if MPI successfully initialized and all MPI-Bash",
-  "builtins were loaded into the shell.",
+  "builtins were loaded into the shell.  With -t, returns failure if MPI",
+  "does not support threads, although all builtins remain usable.",
   NULL
 };
 
 /* Describe the mpi_init builtin. */
-DEFINE_BUILTIN(mpi_init, "mpi_init");
+DEFINE_BUILTIN(mpi_init, "mpi_init [-t]");
 
 /* Finalize MPI with MPI_Finalize(), but only if we previously invoked
  * MPI_Init() explicitly. */
 static int
 mpi_finalize_builtin (WORD_LIST *list)
 {
+  char *report = getenv("MPIBASH_STATS");   /* Non-empty=report statistics */
+
   no_args(list);
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS
+      || mpibash_retire_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  if (report != NULL && *report != '\0')
+    if (mpibash_stats_report() != EXECUTION_SUCCESS)
+      return EXECUTION_FAILURE;
+  mpibash_stop_progress();
+  mpibash_finalize_tool();
   if (we_called_init)
     if (MPI_Finalize() != MPI_SUCCESS)
       return EXECUTION_FAILURE;
@@ -121,7 +211,10 @@ mpi_finalize_builtin (WORD_LIST *list)
 static char *mpi_finalize_doc[] = {
   "Finalize MPI and MPI-Bash.",
   "",
-  "Invoke MPI_Finalize().",
+  "Stop the progress thread, if any, then invoke MPI_Finalize().  If",
+  "the environment variable MPIBASH_STATS is set to a non-empty value,",
+  "first write a cross-rank summary of mpi_stats to standard error on",
+  "rank 0.",
   "",
   "Exit Status:",
   "Always succeeds.  However, the MPI standard does not define what",
@@ -138,13 +231,16 @@ static int
 mpi_comm_rank_builtin (WORD_LIST *list)
 {
   char *varname;         /* Name of the variable to bind the results to */
+  mpibash_comm_t comm;   /* Communicator to query */
 
+  if (mpibash_parse_comm_option(&list, &comm) != EXECUTION_SUCCESS)
+    return (EX_USAGE);
   YES_ARGS(list);
   varname = list->word->word;
   REQUIRE_WRITABLE(varname);
   list = list->next;
   no_args(list);
-  mpibash_bind_variable_number(varname, mpibash_rank, 0);
+  mpibash_bind_variable_number(varname, comm.rank, 0);
   return EXECUTION_SUCCESS;
 }
 
@@ -152,6 +248,9 @@ mpi_comm_rank_builtin (WORD_LIST *list)
 static char *mpi_comm_rank_doc[] = {
   "Return the process's rank in the MPI job.",
   "",
+  "Options:",
+  "  -c COMM       Return the rank within communicator COMM instead.",
+  "",
   "Arguments:",
   "  NAME          Scalar variable in which to receive the rank",
   "",
@@ -161,20 +260,23 @@ static char *mpi_comm_rank_doc[] = {
 };
 
 /* Describe the mpi_comm_rank builtin. */
-DEFINE_BUILTIN(mpi_comm_rank, "mpi_comm_rank name");
+DEFINE_BUILTIN(mpi_comm_rank, "mpi_comm_rank [-c comm] name");
 
 /* Return the number of MPI ranks available. */
 int
 mpi_comm_size_builtin (WORD_LIST *list)
 {
   char *varname;         /* Name of the variable to bind the results to */
+  mpibash_comm_t comm;   /* Communicator to query */
 
+  if (mpibash_parse_comm_option(&list, &comm) != EXECUTION_SUCCESS)
+    return (EX_USAGE);
   YES_ARGS (list);
   varname = list->word->word;
   REQUIRE_WRITABLE(varname);
   list = list->next;
   no_args(list);
-  mpibash_bind_variable_number(varname, mpibash_num_ranks, 0);
+  mpibash_bind_variable_number(varname, comm.size, 0);
   return EXECUTION_SUCCESS;
 }
 
@@ -182,6 +284,9 @@ mpi_comm_size_builtin (WORD_LIST *list)
 static char *mpi_comm_size_doc[] = {
   "Return the total number of ranks in the MPI job.",
   "",
+  "Options:",
+  "  -c COMM       Return the number of ranks in communicator COMM instead.",
+  "",
   "Arguments:",
   "  NAME          Scalar variable in which to receive the number of ranks",
   "",
@@ -191,16 +296,27 @@ static char *mpi_comm_size_doc[] = {
 };
 
 /* Describe the mpi_comm_size builtin. */
-DEFINE_BUILTIN(mpi_comm_size, "mpi_comm_size name");
+DEFINE_BUILTIN(mpi_comm_size, "mpi_comm_size [-c comm] name");
 
 /* Abort the program, typically bringing down all ranks. */
 int
 mpi_abort_builtin (WORD_LIST *list)
 {
   int exit_value;
+  mpibash_comm_t comm;          /* Communicator whose processes to abort */
 
+  /* Parse "-c COMM" (optional) by hand, as get_exitstat must see the
+   * remaining arguments. */
+  mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
+  if (list != 0 && ISOPTION(list->word->word, 'c')) {
+    list = list->next;
+    YES_ARGS(list);
+    if (!mpibash_parse_comm(list->word->word, &comm))
+      return EX_USAGE;
+    list = list->next;
+  }
   exit_value = (running_trap == 1 && list == 0) ? trap_saved_exit_value : get_exitstat(list);  /* Copied from exit.def */
-  MPI_TRY(MPI_Abort(MPI_COMM_WORLD, exit_value));
+  MPI_TRY(MPI_Abort(comm.comm, exit_value));
   return EXECUTION_FAILURE;
 }
 
@@ -212,10 +328,13 @@ static char *mpi_abort_doc[] = {
   "remote shells that are part of the same MPI job.  If N is omitted, the",
   "exit status is that of the last command executed.",
   "",
+  "With -c COMM, abort only the processes in communicator COMM (although",
+  "MPI implementations may abort all of them anyway).",
+  "",
   "This command should be used only in extreme circumstances.  It is",
   "better for each process to exit normally on its own.",
   NULL
 };
 
 /* Describe the mpi_abort builtin. */
-DEFINE_BUILTIN(mpi_abort, "mpi_abort [n]");
+DEFINE_BUILTIN(mpi_abort, "mpi_abort [-c comm] [n]");
@@ -0,0 +1,553 @@
+/*************************************
+ * MPI-Bash distributed key-value    *
+ * store over one-sided windows      *
+ *                                   *
+ * By Scott Pakin <pakin@lanl.gov>   *
+ *************************************/
+
+#include "mpibash.h"
+#include <limits.h>
+
+/* Describe the fixed-size header at the start of every slot.  The key
+ * and then the value immediately follow it. */
+typedef struct {
+  uint64_t hash;                /* Hash of the key or 0 if the slot is empty */
+  uint32_t keylen;              /* Number of bytes in the key */
+  uint32_t vallen;              /* Number of bytes in the value */
+} slot_header_t;
+
+/* Describe one distributed key-value store.  Each rank hosts NSLOTS
+ * slots, and each key lives on the rank its hash selects. */
+typedef struct {
+  int in_use;                   /* 1=entry is allocated; 0=entry is free */
+  mpibash_comm_t comm;          /* Processes across which the store is spread */
+  MPI_Win win;                  /* Window over comm exposing every rank's slots */
+  int nslots;                   /* Slots per rank */
+  int keybytes;                 /* Maximum key length */
+  int valbytes;                 /* Maximum value length */
+  MPI_Aint slot_size;           /* Bytes per slot, including the header */
+} kv_t;
+
+static kv_t *kv_table = NULL;   /* All key-value stores, indexed by handle */
+static int kv_table_size = 0;   /* Number of entries allocated in the above */
+
+/* Parse a key-value-store handle.  Return a pointer to the store, or
+ * NULL on failure.  The pointer is valid only until the next
+ * mpi_kv_create. */
+static kv_t *
+parse_kv (char *word)
+{
+  intmax_t n;
+
+  if (!legal_number(word, &n) || n < 0 || n >= kv_table_size
+      || !kv_table[n].in_use) {
+    builtin_error(_("%s: invalid key-value store handle"), word);
+    return NULL;
+  }
+  return &kv_table[n];
+}
+
+/* Copy LEN bytes at offset DISP within RANK's slots, which the caller
+ * has locked, into BUFFER.  Every access, even to our own slots, is an
+ * RMA operation: an MPI_Win_lock may be acquired lazily, so only RMA
+ * operations are guaranteed to be excluded by another process's
+ * exclusive lock. */
+static int
+kv_read (kv_t *kv, int rank, MPI_Aint disp, void *buffer, int len)
+{
+  int mpierr;
+
+  mpierr = MPI_Get(buffer, len, MPI_BYTE, rank, disp, len, MPI_BYTE, kv->win);
+  if (mpierr == MPI_SUCCESS)
+    MPI_TIMED(mpierr, MPI_Win_flush(rank, kv->win));
+  if (mpierr == MPI_SUCCESS)
+    mpibash_stats_bytes(kv->comm.comm, rank, len);
+  return mpierr;
+}
+
+/* Copy LEN bytes from BUFFER to offset DISP within RANK's slots,
+ * which the caller has locked. */
+static int
+kv_write (kv_t *kv, int rank, MPI_Aint disp, void *buffer, int len)
+{
+  int mpierr;
+
+  mpierr = MPI_Put(buffer, len, MPI_BYTE, rank, disp, len, MPI_BYTE, kv->win);
+  if (mpierr == MPI_SUCCESS)
+    MPI_TIMED(mpierr, MPI_Win_flush(rank, kv->win));
+  if (mpierr == MPI_SUCCESS)
+    mpibash_stats_bytes(kv->comm.comm, rank, len);
+  return mpierr;
+}
+
+/* Search RANK's slots, which the caller has locked, for KEY, whose
+ * hash is HASH, by linear probing.  Set *SLOT to the slot holding the
+ * key or, if the key is absent, to the empty slot that ended the
+ * search (-1 if every slot is full).  Read the slot's header into
+ * *HEADER; its hash is 0 if the key is absent.  Return an MPI error
+ * code. */
+static int
+find_slot (kv_t *kv, int rank, const char *key, uint32_t keylen,
+           uint64_t hash, int *slot, slot_header_t *header)
+{
+  char *keybuf = malloc(keylen + 1);   /* Key stored in a slot */
+  int first;                    /* First slot to probe */
+  int i;
+  int mpierr = MPI_SUCCESS;
+
+  first = (int) ((hash/kv->comm.size) % kv->nslots);
+  *slot = -1;
+  for (i = 0; i < kv->nslots && mpierr == MPI_SUCCESS; i++) {
+    int s = (first + i) % kv->nslots;
+
+    mpierr = kv_read(kv, rank, s*kv->slot_size, header, sizeof(slot_header_t));
+    if (mpierr != MPI_SUCCESS)
+      break;
+    if (header->hash == 0) {
+      *slot = s;
+      break;
+    }
+    if (header->hash != hash || header->keylen != keylen)
+      continue;
+    mpierr = kv_read(kv, rank, s*kv->slot_size + sizeof(slot_header_t), keybuf, keylen);
+    if (mpierr == MPI_SUCCESS && !memcmp(keybuf, key, keylen)) {
+      *slot = s;
+      break;
+    }
+  }
+  if (*slot == -1)
+    header->hash = 0;
+  free(keybuf);
+  return mpierr;
+}
+
+/* Look up KEY in KV.  If NEWVALUE is non-NULL, store it as KEY's value
+ * unless EXPECTED is non-NULL and differs from the current value (the
+ * empty string if KEY is absent).  Return KEY's previous value, or NULL
+ * if it was absent, as a newly allocated string in *OLDVALUE and set
+ * *STORED to 1 if NEWVALUE was stored. */
+static int
+kv_access (kv_t *kv, char *key, char *newvalue, char *expected,
+           char **oldvalue, int *stored)
+{
+  size_t keylen = strlen(key);  /* Number of bytes in the key */
+  size_t vallen;                /* Number of bytes in the new value */
+  uint64_t hash;                /* Hash of the key */
+  int owner;                    /* Rank hosting the key */
+  slot_header_t header;         /* Header of the key's slot */
+  char *record;                 /* Header, key, and value to store */
+  int slot;                     /* Slot holding or to hold the key */
+  int full = 0;                 /* 1=no slot was available for a new key */
+  int mpierr, unlockerr;
+
+  /* Validate the key and value. */
+  *oldvalue = NULL;
+  *stored = 0;
+  if (keylen > (size_t) kv->keybytes) {
+    builtin_error(_("%s: key exceeds %d bytes"), key, kv->keybytes);
+    return EXECUTION_FAILURE;
+  }
+  vallen = newvalue == NULL ? 0 : strlen(newvalue);
+  if (vallen > (size_t) kv->valbytes) {
+    builtin_error(_("value for key %s exceeds %d bytes"), key, kv->valbytes);
+    return EXECUTION_FAILURE;
+  }
+
+  /* Find the key's slot on its owner and read its current value.  An
+   * update holds an exclusive lock on the owner from the first read
+   * through the write so that no other access can come in between. */
+  hash = mpibash_hash_key(key, keylen);
+  if (hash == 0)
+    hash = 1;                   /* 0 marks an empty slot. */
+  owner = (int) (hash % kv->comm.size);
+  MPI_TIMED(mpierr, MPI_Win_lock(newvalue == NULL ? MPI_LOCK_SHARED : MPI_LOCK_EXCLUSIVE,
+                                 owner, 0, kv->win));
+  if (mpierr != MPI_SUCCESS)
+    return mpibash_report_mpi_error(mpierr);
+  mpierr = find_slot(kv, owner, key, (uint32_t) keylen, hash, &slot, &header);
+  if (mpierr == MPI_SUCCESS && header.hash != 0) {
+    *oldvalue = malloc(header.vallen + 1);
+    (*oldvalue)[header.vallen] = '\0';
+    mpierr = kv_read(kv, owner,
+                     slot*kv->slot_size + sizeof(slot_header_t) + header.keylen,
+                     *oldvalue, header.vallen);
+  }
+
+  /* Store the new value if appropriate. */
+  if (mpierr == MPI_SUCCESS && newvalue != NULL
+      && (expected == NULL || !strcmp(*oldvalue == NULL ? "" : *oldvalue, expected))) {
+    if (slot == -1)
+      full = 1;
+    else {
+      record = malloc(sizeof(slot_header_t) + keylen + vallen);
+      header.hash = hash;
+      header.keylen = (uint32_t) keylen;
+      header.vallen = (uint32_t) vallen;
+      memcpy(record, &header, sizeof(slot_header_t));
+      memcpy(record + sizeof(slot_header_t), key, keylen);
+      memcpy(record + sizeof(slot_header_t) + keylen, newvalue, vallen);
+      mpierr = kv_write(kv, owner, slot*kv->slot_size, record,
+                        (int) (sizeof(slot_header_t) + keylen + vallen));
+      free(record);
+      *stored = mpierr == MPI_SUCCESS;
+    }
+  }
+
+  /* Release the owner and report any problems. */
+  MPI_TIMED(unlockerr, MPI_Win_unlock(owner, kv->win));
+  if (mpierr == MPI_SUCCESS)
+    mpierr = unlockerr;
+  if (mpierr != MPI_SUCCESS) {
+    free(*oldvalue);
+    *oldvalue = NULL;
+    return mpibash_report_mpi_error(mpierr);
+  }
+  if (full) {
+    builtin_error(_("%s: no free slot for the key on rank %d"), key, owner);
+    return EXECUTION_FAILURE;
+  }
+  return EXECUTION_SUCCESS;
+}
+
+/* Create a distributed key-value store. */
+static int
+mpi_kv_create_builtin (WORD_LIST *list)
+{
+  mpibash_comm_t comm;          /* Processes to spread the store across */
+  intmax_t nslots = 1024;       /* Slots per rank */
+  intmax_t keybytes = 64;       /* Maximum key length */
+  intmax_t valbytes = 192;      /* Maximum value length */
+  char *varname;                /* Name of the variable to bind the handle to */
+  kv_t *kv;                     /* New key-value store */
+  int handle;                   /* Handle corresponding to the above */
+  char *base;                   /* Our slots */
+  MPI_Aint segsize;             /* Number of bytes in the above */
+  int opt;                      /* Parsed option */
+
+  /* Parse the command line. */
+  mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "c:n:k:v:")) != -1) {
+    switch (opt) {
+      case 'c':
+        if (!mpibash_parse_comm(list_optarg, &comm))
+          return (EX_USAGE);
+        break;
+
+      case 'n':
+        if (!legal_number(list_optarg, &nslots) || nslots < 1 || nslots > INT_MAX) {
+          builtin_error(_("-n: invalid number of slots"));
+          return (EX_USAGE);
+        }
+        break;
+
+      case 'k':
+        if (!legal_number(list_optarg, &keybytes) || keybytes < 1 || keybytes > INT_MAX/2) {
+          builtin_error(_("-k: invalid key length"));
+          return (EX_USAGE);
+        }
+        break;
+
+      case 'v':
+        if (!legal_number(list_optarg, &valbytes) || valbytes < 0 || valbytes > INT_MAX/2) {
+          builtin_error(_("-v: invalid value length"));
+          return (EX_USAGE);
+        }
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  no_args(list);
+
+  /* Allocate a table entry, reusing a free one if possible. */
+  for (handle = 0; handle < kv_table_size; handle++)
+    if (!kv_table[handle].in_use)
+      break;
+  if (handle == kv_table_size) {
+    int newsize = kv_table_size == 0 ? 8 : kv_table_size*2;
+
+    kv_table = realloc(kv_table, newsize*sizeof(kv_t));
+    memset(&kv_table[kv_table_size], 0, (newsize - kv_table_size)*sizeof(kv_t));
+    kv_table_size = newsize;
+  }
+  kv = &kv_table[handle];
+  kv->comm = comm;
+  kv->nslots = (int) nslots;
+  kv->keybytes = (int) keybytes;
+  kv->valbytes = (int) valbytes;
+  kv->slot_size = (sizeof(slot_header_t) + keybytes + valbytes + 7) & ~(MPI_Aint)7;
+  segsize = kv->slot_size*nslots;
+
+  /* Allocate our slots in window memory, which lets MPI use shared
+   * memory for processes on the same node, and clear them within a
+   * lock on ourself so the stores are visible to later RMA operations.
+   * Ensure every process's slots are cleared before anyone uses them. */
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  MPI_TRY(MPI_Win_allocate(segsize, 1, MPI_INFO_NULL, comm.comm, &base, &kv->win));
+  MPI_TRY(MPI_Win_set_errhandler(kv->win, MPI_ERRORS_RETURN));
+  MPI_TRY(MPI_Win_lock(MPI_LOCK_EXCLUSIVE, comm.rank, 0, kv->win));
+  memset(base, 0, segsize);
+  MPI_TRY(MPI_Win_unlock(comm.rank, kv->win));
+  MPI_TRY(MPI_Barrier(comm.comm));
+  kv->in_use = 1;
+  mpibash_bind_variable_number(varname, handle, 0);
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_kv_create builtin. */
+static char *mpi_kv_create_doc[] = {
+  "Create a key-value store distributed across processes.",
+  "",
+  "Options:",
+  "  -c COMM       Spread the store across communicator COMM (default:",
+  "                all processes).",
+  "",
+  "  -n SLOTS      Reserve SLOTS entries on each process (default: 1024).",
+  "",
+  "  -k BYTES      Accept keys of up to BYTES bytes (default: 64).",
+  "",
+  "  -v BYTES      Accept values of up to BYTES bytes (default: 192).",
+  "",
+  "Arguments:",
+  "  NAME          Scalar variable in which to receive a handle to the",
+  "                store.",
+  "",
+  "All processes in COMM must call mpi_kv_create together with the same",
+  "options.  Each key is assigned by hash to one process, which holds it",
+  "in a window of one-sided memory.  Other processes then access it",
+  "with mpi_kv_put, mpi_kv_get, and mpi_kv_cas without that process's",
+  "participation.  Keys cannot be removed, so size -n for the total number of keys",
+  "expected plus some slack.  Accesses to other nodes progress more",
+  "reliably when MPI-Bash was initialized with mpi_init -t.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_kv_create builtin. */
+DEFINE_BUILTIN(mpi_kv_create, "mpi_kv_create [-c comm] [-n slots] [-k bytes] [-v bytes] name");
+
+/* Store a value in a distributed key-value store. */
+static int
+mpi_kv_put_builtin (WORD_LIST *list)
+{
+  kv_t *kv;                     /* Key-value store */
+  char *key;                    /* Key to store */
+  char *value;                  /* Value to store */
+  char *oldvalue;               /* Value being replaced */
+  int stored;                   /* 1=value was stored */
+  int result;
+
+  YES_ARGS(list);
+  kv = parse_kv(list->word->word);
+  if (kv == NULL)
+    return (EX_USAGE);
+  list = list->next;
+  YES_ARGS(list);
+  key = list->word->word;
+  list = list->next;
+  YES_ARGS(list);
+  value = list->word->word;
+  list = list->next;
+  no_args(list);
+  result = kv_access(kv, key, value, NULL, &oldvalue, &stored);
+  free(oldvalue);
+  return result;
+}
+
+/* Define the documentation for the mpi_kv_put builtin. */
+static char *mpi_kv_put_doc[] = {
+  "Store a value in a distributed key-value store.",
+  "",
+  "Arguments:",
+  "  KV            Handle returned by mpi_kv_create.",
+  "",
+  "  KEY           Key under which to store VALUE.",
+  "",
+  "  VALUE         String to associate with KEY, replacing any previous",
+  "                value.",
+  "",
+  "The value is visible to every process in the store's communicator as",
+  "soon as mpi_kv_put returns.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid handle is given, KEY or VALUE is too long,",
+  "the store has no room for KEY, or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_kv_put builtin. */
+DEFINE_BUILTIN(mpi_kv_put, "mpi_kv_put kv key value");
+
+/* Retrieve a value from a distributed key-value store. */
+static int
+mpi_kv_get_builtin (WORD_LIST *list)
+{
+  kv_t *kv;                     /* Key-value store */
+  char *key;                    /* Key to look up */
+  char *varname;                /* Name of the variable to bind the results to */
+  char *value;                  /* Value associated with key */
+  int stored;                   /* Unused */
+
+  YES_ARGS(list);
+  kv = parse_kv(list->word->word);
+  if (kv == NULL)
+    return (EX_USAGE);
+  list = list->next;
+  YES_ARGS(list);
+  key = list->word->word;
+  list = list->next;
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  no_args(list);
+  if (kv_access(kv, key, NULL, NULL, &value, &stored) != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  if (value == NULL)
+    return EXECUTION_FAILURE;
+  bind_variable(varname, value, 0);
+  free(value);
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_kv_get builtin. */
+static char *mpi_kv_get_doc[] = {
+  "Retrieve a value from a distributed key-value store.",
+  "",
+  "Arguments:",
+  "  KV            Handle returned by mpi_kv_create.",
+  "",
+  "  KEY           Key to look up.",
+  "",
+  "  NAME          Scalar variable in which to receive KEY's value.  NAME",
+  "                is left unset if KEY is not in the store.",
+  "",
+  "Exit Status:",
+  "Returns 0 if KEY was found and 1 if not or if an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_kv_get builtin. */
+DEFINE_BUILTIN(mpi_kv_get, "mpi_kv_get kv key name");
+
+/* Atomically replace a value in a distributed key-value store if it
+ * has an expected value. */
+static int
+mpi_kv_cas_builtin (WORD_LIST *list)
+{
+  kv_t *kv;                     /* Key-value store */
+  char *key;                    /* Key to update */
+  char *expected;               /* Value the key must have */
+  char *newvalue;               /* Value to store */
+  char *varname = NULL;         /* Name of the variable to bind the old value to */
+  char *oldvalue;               /* Value before the operation */
+  int stored;                   /* 1=newvalue was stored */
+
+  YES_ARGS(list);
+  kv = parse_kv(list->word->word);
+  if (kv == NULL)
+    return (EX_USAGE);
+  list = list->next;
+  YES_ARGS(list);
+  key = list->word->word;
+  list = list->next;
+  YES_ARGS(list);
+  expected = list->word->word;
+  list = list->next;
+  YES_ARGS(list);
+  newvalue = list->word->word;
+  list = list->next;
+  if (list != NULL) {
+    varname = list->word->word;
+    REQUIRE_WRITABLE(varname);
+    list = list->next;
+  }
+  no_args(list);
+  if (kv_access(kv, key, newvalue, expected, &oldvalue, &stored) != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  if (varname != NULL)
+    bind_variable(varname, oldvalue == NULL ? "" : oldvalue, 0);
+  free(oldvalue);
+  return stored ? EXECUTION_SUCCESS : EXECUTION_FAILURE;
+}
+
+/* Define the documentation for the mpi_kv_cas builtin. */
+static char *mpi_kv_cas_doc[] = {
+  "Compare and swap a value in a distributed key-value store.",
+  "",
+  "Arguments:",
+  "  KV            Handle returned by mpi_kv_create.",
+  "",
+  "  KEY           Key whose value to replace.",
+  "",
+  "  OLD           Value KEY must currently have.  A key that is not in",
+  "                the store is treated as having the empty string as",
+  "                its value.",
+  "",
+  "  NEW           Value to store if KEY's value is OLD.",
+  "",
+  "  NAME          Scalar variable in which to receive KEY's value from",
+  "                before the operation (optional).",
+  "",
+  "The comparison and replacement take place within a single exclusive",
+  "lock on the process that holds KEY, so no other mpi_kv_* operation on",
+  "the same store can observe or modify KEY in between.  Hence, if many",
+  "processes run \"mpi_kv_cas $kv $key '' $rank\" concurrently, exactly",
+  "one of them succeeds, making it the sole owner of KEY.",
+  "",
+  "Exit Status:",
+  "Returns 0 if NEW was stored and 1 if not or if an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_kv_cas builtin. */
+DEFINE_BUILTIN(mpi_kv_cas, "mpi_kv_cas kv key old new [name]");
+
+/* Free a distributed key-value store. */
+static int
+mpi_kv_free_builtin (WORD_LIST *list)
+{
+  kv_t *kv;                     /* Key-value store to free */
+
+  YES_ARGS(list);
+  kv = parse_kv(list->word->word);
+  if (kv == NULL)
+    return (EX_USAGE);
+  list = list->next;
+  no_args(list);
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  kv->in_use = 0;
+  MPI_TRY(MPI_Win_free(&kv->win));
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_kv_free builtin. */
+static char *mpi_kv_free_doc[] = {
+  "Free a distributed key-value store.",
+  "",
+  "Arguments:",
+  "  KV            Handle returned by mpi_kv_create.",
+  "",
+  "All processes in the store's communicator must call mpi_kv_free",
+  "together, and before freeing that communicator with mpi_comm_free.",
+  "KV and all of its contents are invalid once mpi_kv_free returns.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid handle is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_kv_free builtin. */
+DEFINE_BUILTIN(mpi_kv_free, "mpi_kv_free kv");
@@ -14,22 +14,41 @@
 #include "bashgetopt.h"
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
+#include <unistd.h>
 #include <dlfcn.h>
+#include <pthread.h>
 #include <mpi.h>
 
-/* Try an MPI operation.  Return with an error message on failure. */
+/* Try an MPI operation.  Return with an error message on failure.
+ * The time spent in the operation is charged to the running builtin
+ * as wait time. */
 #define MPI_TRY(STMT)                                   \
   do                                                    \
     {                                                   \
       int mpierr;                                       \
+      double mpistart = mpibash_stats_clock ();         \
       mpierr = STMT;                                    \
+      mpibash_stats_wait (mpistart);                    \
       if (mpierr != MPI_SUCCESS)                        \
         return mpibash_report_mpi_error (mpierr);       \
     }                                                   \
   while (0)
 
+/* Perform an MPI operation that may block, assigning its error code
+ * to MPIERR.  Like MPI_TRY, charge the time spent to the running
+ * builtin as wait time. */
+#define MPI_TIMED(MPIERR, STMT)                         \
+  do                                                    \
+    {                                                   \
+      double mpistart = mpibash_stats_clock ();         \
+      (MPIERR) = STMT;                                  \
+      mpibash_stats_wait (mpistart);                    \
+    }                                                   \
+  while (0)
+
 /* Return with a usage message if no arguments remain. */
 #define YES_ARGS(LIST)                          \
   if ((LIST) == 0) {                            \
@@ -60,25 +79,160 @@
     }                                                                   \
   while (0)
 
-/* Simplify defining an MPI-Bash builtin. */
+/* Simplify defining an MPI-Bash builtin.  Every invocation is
+ * counted and timed (see mpi_stats). */
 #define DEFINE_BUILTIN(NAME, SYNOPSIS)                          \
+  static int                                                    \
+  NAME##_profiled (WORD_LIST *list)                             \
+  {                                                             \
+    static mpibash_stats_t *stats = NULL;                       \
+    return mpibash_stats_call (&stats, #NAME, NAME##_builtin, list); \
+  }                                                             \
   struct builtin NAME##_struct = {                              \
     #NAME,             /* Builtin name */                       \
-    NAME##_builtin,    /* Function implementing the builtin */  \
+    NAME##_profiled,   /* Function implementing the builtin */  \
     BUILTIN_ENABLED,   /* Initial flags for builtin */          \
     NAME##_doc,        /* Builtin documentation */              \
     SYNOPSIS,          /* Usage synopsis */                     \
     0                  /* Reserved */                           \
   }
 
+/* Accumulate statistics for one builtin (or Circle-Bash callback). */
+typedef struct mpibash_stats {
+  char *name;                   /* Name of the builtin */
+  long calls;                   /* Number of invocations */
+  uint64_t messages;            /* Number of messages sent or received */
+  uint64_t bytes;               /* Number of bytes sent or received */
+  double wall;                  /* Seconds spent in the builtin */
+  double wait;                  /* Seconds of the above spent within MPI */
+  struct mpibash_stats *next;   /* Next builtin, in order of first use */
+} mpibash_stats_t;
+
+/* Remember the builtin that was running when another one began. */
+typedef struct {
+  mpibash_stats_t *prev;        /* Statistics of the interrupted builtin */
+  double start;                 /* Time at which the new builtin began */
+} mpibash_stats_frame_t;
+
+/* Define the states a nonblocking request can be in. */
+typedef enum {
+  MPIBASH_REQ_DEFERRED,         /* Not yet handed to MPI (e.g., awaiting a match) */
+  MPIBASH_REQ_ACTIVE,           /* Outstanding within MPI */
+  MPIBASH_REQ_DONE              /* Completed but not yet reported to the user */
+} mpibash_req_state_t;
+
+/* Describe one entry in the table of nonblocking requests. */
+typedef struct mpibash_request {
+  int in_use;                   /* 1=entry is allocated; 0=entry is free */
+  mpibash_req_state_t state;    /* Progress of the request */
+  MPI_Request request;          /* Underlying MPI request */
+  MPI_Status status;            /* Status of the completed request */
+  MPI_Comm comm;                /* Communicator on which the request was issued */
+  int peer;                     /* Peer rank (or MPI_ANY_SOURCE) */
+  int tag;                      /* Message tag (or MPI_ANY_TAG) */
+  char *buffer;                 /* Message buffer, freed on completion */
+  int count;                    /* Number of bytes in the above */
+  char *varname;                /* Variable to bind on completion or NULL */
+  int kind;                     /* Operation-specific detail (e.g., a value type) */
+  MPI_Op op;                    /* Reduction operation or MPI_OP_NULL */
+
+  /* Post a deferred request (1=may block; 0=must not block).  Return an
+   * MPI error code. */
+  int (*post)(struct mpibash_request *req, int block);
+
+  /* Bind the results of a completed request.  Return EXECUTION_SUCCESS
+   * or EXECUTION_FAILURE. */
+  int (*complete)(struct mpibash_request *req);
+} mpibash_request_t;
+
+/* Define how file contents are streamed: in chunks of
+ * MPIBASH_CHUNK_SIZE bytes with up to MPIBASH_STREAM_DEPTH chunks in
+ * flight at once. */
+#define MPIBASH_CHUNK_SIZE (4*1024*1024)
+#define MPIBASH_STREAM_DEPTH 4
+
+/* Define how often, in microseconds, the progress thread started by
+ * "mpi_init -t" advances outstanding requests. */
+#define MPIBASH_PROGRESS_INTERVAL 1000
+
+/* Define how long, in microseconds, mpi_wait and mpi_waitany sleep
+ * between polls while a request is still waiting for a message to
+ * match. */
+#define MPIBASH_POLL_INTERVAL 100
+
+/* Describe a file or file descriptor whose contents are being sent. */
+typedef struct {
+  const char *name;             /* Name to use in error messages */
+  int fd;                       /* File descriptor to read from */
+  int close_fd;                 /* 1=we opened fd and must close it */
+  char *map;                    /* Memory-mapped contents or NULL if not mapped */
+  size_t map_len;               /* Number of bytes mapped */
+  size_t offset;                /* Offset of the next chunk within the map */
+  char *buffers[MPIBASH_STREAM_DEPTH];  /* Read buffers for unmapped sources */
+  int which;                    /* Next entry in buffers to read into */
+} mpibash_source_t;
+
+/* Describe a communicator that scripts refer to by handle. */
+typedef struct {
+  int in_use;                   /* 1=entry is allocated; 0=entry is free */
+  MPI_Comm comm;                /* The communicator itself */
+  MPI_Comm stream_comm;         /* Private duplicate for streamed file contents */
+  MPI_Comm coll_comm;           /* Private duplicate for point-to-point steps of collectives */
+  int rank;                     /* Our rank within comm */
+  int size;                     /* Number of ranks in comm */
+} mpibash_comm_t;
+
+/* Define the handle that always refers to MPI_COMM_WORLD. */
+#define MPIBASH_COMM_WORLD 0
+
 /* Declare all of the library-local variables and functions we need. */
 extern int mpibash_rank;
 extern int mpibash_num_ranks;
+extern MPI_Comm mpibash_stream_comm;
+extern MPI_Comm mpibash_channel_comm;
+extern MPI_Comm mpibash_coll_comm;
+extern pthread_mutex_t *mpibash_builtin_lock;
 extern SHELL_VAR *mpibash_bind_variable_number (const char *name, long value, int flags);
 extern int mpibash_report_mpi_error (int mpierr);
+extern uint64_t mpibash_hash_key (const char *key, size_t len);
 extern SHELL_VAR *mpibash_bind_array_variable_number (char *name, arrayind_t ind, long value, int flags);
 extern int mpibash_invoke_bash_command(char *funcname, ...);
 extern int mpibash_find_callback_function (WORD_LIST *list, SHELL_VAR **user_func);
+extern int mpibash_register_builtins (void *self, char **names);
+extern double mpibash_stats_clock (void);
+extern mpibash_stats_t *mpibash_stats_list (void);
+extern mpibash_stats_t *mpibash_stats_current (void);
+extern mpibash_stats_t *mpibash_stats_lookup (const char *name);
+extern void mpibash_stats_enter (mpibash_stats_t **stats, const char *name, mpibash_stats_frame_t *frame);
+extern void mpibash_stats_leave (mpibash_stats_frame_t *frame);
+extern int mpibash_share_builtin_lock (void);
+extern int mpibash_stats_call (mpibash_stats_t **stats, const char *name, sh_builtin_func_t *func, WORD_LIST *list);
+extern void mpibash_stats_wait (double start);
+extern void mpibash_stats_bytes (MPI_Comm comm, int peer, long nbytes);
+extern int mpibash_stats_report (void);
+extern int mpibash_alloc_request (void);
+extern mpibash_request_t *mpibash_get_request (int handle);
+extern void mpibash_release_request (int handle);
+extern int mpibash_count_requests (MPI_Comm comm);
+extern int mpibash_start_progress (void);
+extern void mpibash_stop_progress (void);
+extern int mpibash_parse_fd (char *word, int *fd);
+extern int mpibash_open_source (mpibash_source_t *src, const char *filename, int fd);
+extern ssize_t mpibash_read_chunk (mpibash_source_t *src, char **chunk);
+extern void mpibash_close_source (mpibash_source_t *src);
+extern int mpibash_open_sink (const char *filename);
+extern int mpibash_write_all (int fd, const char *buffer, size_t len);
+extern int mpibash_flush_batches (void);
+extern int mpibash_retire_batches (void);
+extern int mpibash_discard_pending (MPI_Comm comm);
+extern void mpibash_init_comms (void);
+extern void mpibash_get_comm (int handle, mpibash_comm_t *comm);
+extern int mpibash_parse_comm (char *word, mpibash_comm_t *comm);
+extern int mpibash_parse_comm_option (WORD_LIST **list, mpibash_comm_t *comm);
+extern MPI_Comm mpibash_stream_comm_of (MPI_Comm comm);
+extern void mpibash_init_tool (void);
+extern void mpibash_finalize_tool (void);
+extern void mpibash_tool_release_comm (MPI_Comm comm);
 
 /* Declare all of the bash variables and functions we use as weak symbols.
  * This seems to avoid errors like, "symbol lookup error:
@@ -87,5 +241,10 @@ extern int running_trap __attribute__((weak));
 extern int trap_saved_exit_value __attribute__((weak));
 extern char *list_optarg __attribute__((weak));
 extern WORD_LIST *loptend __attribute__((weak));
+extern int num_shell_builtins __attribute__((weak));
+extern struct builtin *shell_builtins __attribute__((weak));
+extern struct builtin static_shell_builtins[] __attribute__((weak));
+extern struct builtin *builtin_address_internal (char *, int) __attribute__((weak));
+extern void initialize_shell_builtins (void) __attribute__((weak));
 
 #endif
@@ -5,99 +5,1757 @@
  *************************************/
 
 #include "mpibash.h"
+#include <stdint.h>
+#include <limits.h>
+
+/* Every point-to-point message ends with a byte that identifies its
+ * format.  Strings end with their NUL terminator, which doubles as
+ * FRAME_TEXT. */
+enum {
+  FRAME_TEXT = 0,               /* NUL-terminated string */
+  FRAME_LONG,                   /* Eager-mode header announcing a long payload */
+  FRAME_STREAM,                 /* Header announcing streamed file contents */
+  FRAME_ARRAY,                  /* Packed array elements */
+  FRAME_BATCH                   /* Several length-prefixed messages */
+};
+
+/* Define the limits on a batch of messages: BATCH_MAX_BYTES bytes,
+ * including length prefixes, and BATCH_MAX_COUNT messages.  Messages
+ * too long to fit in an empty batch are never batched. */
+#define BATCH_MAX_BYTES (64*1024)
+#define BATCH_MAX_COUNT 256
+
+/* Describe a batch of messages awaiting transmission to one rank. */
+typedef struct batch {
+  struct batch *next;           /* Next batch in creation order */
+  MPI_Comm comm;                /* Communicator to send on */
+  int dest;                     /* Destination rank */
+  int tag;                      /* Message tag */
+  char *buffer;                 /* Length-prefixed messages */
+  size_t len;                   /* Number of bytes used in the above */
+  int count;                    /* Number of messages in the above */
+  MPI_Request request;          /* Send of the batch once it has been flushed */
+} batch_t;
+
+/* Keep track of all batches not yet sent and of all batches sent but
+ * not yet known to have completed. */
+static batch_t *batches = NULL;
+static batch_t *sent_batches = NULL;
+
+static int flush_batches (MPI_Comm comm, int dest, int tag);
+
+/* Describe a message that was received before anyone asked for it. */
+typedef struct pending_msg {
+  struct pending_msg *next;     /* Next message in arrival order */
+  MPI_Comm comm;                /* Communicator the message arrived on */
+  int source;                   /* Sender's rank */
+  int tag;                      /* Message tag */
+  char *buffer;                 /* Message contents (NUL-terminated) */
+  int count;                    /* Number of bytes in the above, excluding the added NUL */
+} pending_msg_t;
+
+/* Keep track of messages received ahead of demand in arrival order. */
+static pending_msg_t *pending_head = NULL;
+static pending_msg_t *pending_tail = NULL;
+
+/* Describe the ring of pre-posted eager receives.  Short messages
+ * travel on short_comm and land directly in a pre-posted slot.  Longer
+ * messages send a header on short_comm followed by the payload on
+ * long_comm.  Slots are always completed and reposted in ring order,
+ * which preserves MPI's non-overtaking guarantee. */
+static struct {
+  int enabled;                  /* 1=eager mode is on; 0=off */
+  MPI_Comm comm;                /* Communicator eager mode applies to */
+  MPI_Comm short_comm;          /* Private duplicate for short messages and headers */
+  MPI_Comm long_comm;           /* Private duplicate for long payloads */
+  int nslots;                   /* Number of receive slots */
+  int slot_size;                /* Bytes per slot */
+  char *slots;                  /* Receive buffers (nslots*slot_size bytes) */
+  MPI_Request *requests;        /* One receive request per slot */
+  int head;                     /* Oldest posted slot */
+  long *sent;                   /* Number of eager messages sent to each rank */
+  long received;                /* Number of eager messages received */
+} eager;
+
+/* Append a message to the list of pending messages. */
+static void
+append_pending (MPI_Comm comm, int source, int tag, char *buffer, int count)
+{
+  pending_msg_t *msg = malloc(sizeof(pending_msg_t));
+
+  msg->next = NULL;
+  msg->comm = comm;
+  msg->source = source;
+  msg->tag = tag;
+  msg->buffer = buffer;
+  msg->count = count;
+  if (pending_tail == NULL)
+    pending_head = msg;
+  else
+    pending_tail->next = msg;
+  pending_tail = msg;
+}
+
+/* Remove and return the oldest pending message that matches a given
+ * source and tag or NULL if there is no such message. */
+static pending_msg_t *
+take_pending (int source, int tag, MPI_Comm comm)
+{
+  pending_msg_t *msg;
+  pending_msg_t *prev = NULL;
+
+  for (msg = pending_head; msg != NULL; prev = msg, msg = msg->next)
+    if (msg->comm == comm
+        && (source == MPI_ANY_SOURCE || source == msg->source)
+        && (tag == MPI_ANY_TAG || tag == msg->tag)) {
+      if (prev == NULL)
+        pending_head = msg->next;
+      else
+        prev->next = msg->next;
+      if (pending_tail == msg)
+        pending_tail = prev;
+      return msg;
+    }
+  return NULL;
+}
+
+/* Discard every pending message that arrived on a given communicator
+ * and return the number discarded. */
+int
+mpibash_discard_pending (MPI_Comm comm)
+{
+  pending_msg_t *msg;
+  int ndiscarded = 0;           /* Number of messages discarded */
+
+  while ((msg = take_pending(MPI_ANY_SOURCE, MPI_ANY_TAG, comm)) != NULL) {
+    free(msg->buffer);
+    free(msg);
+    ndiscarded++;
+  }
+  return ndiscarded;
+}
+
+/* If a received message is a batch, replace it with its first message
+ * and append the rest to the list of pending messages.  If KEEP_FIRST
+ * is 0, append the first message as well and set *BUFFER to NULL. */
+static void
+unbatch_message (MPI_Comm comm, int source, int tag, int keep_first,
+                 char **buffer, int *count)
+{
+  char *batch = *buffer;        /* Received batch */
+  char *p;                      /* Next message in the batch */
+  char *end;                    /* End of the messages in the batch */
+  char *msg;                    /* Copy of one message */
+  uint64_t len;                 /* Number of bytes in the above */
+
+  if (*count == 0 || batch[*count - 1] != FRAME_BATCH)
+    return;
+  end = batch + *count - 1;
+  *buffer = NULL;
+  *count = 0;
+  for (p = batch; p < end; p += sizeof(uint64_t) + len) {
+    memcpy(&len, p, sizeof(uint64_t));
+    msg = malloc(len + 1);
+    memcpy(msg, p + sizeof(uint64_t), len);
+    msg[len] = '\0';
+    if (keep_first && *buffer == NULL) {
+      *buffer = msg;
+      *count = (int) len;
+    }
+    else
+      append_pending(comm, source, tag, msg, (int) len);
+  }
+  free(batch);
+}
+
+/* Complete the oldest eager-receive slot, append its message to the
+ * pending list, and repost the slot.  If BLOCK is 0 and the slot has
+ * not yet completed, set *PROGRESSED to 0 and return. */
+static int
+eager_progress (int block, int *progressed)
+{
+  MPI_Status status;            /* Status of the completed slot */
+  char *slot;                   /* Buffer of the completed slot */
+  char *buffer;                 /* Copy of the message */
+  int count;                    /* Number of bytes in the above */
+  int flag = 1;                 /* 1=slot completed */
+  int mpierr;
+
+  /* Complete the oldest slot. */
+  *progressed = 0;
+  if (block)
+    MPI_TIMED(mpierr, MPI_Wait(&eager.requests[eager.head], &status));
+  else
+    mpierr = MPI_Test(&eager.requests[eager.head], &flag, &status);
+  if (mpierr != MPI_SUCCESS || !flag)
+    return mpierr;
+  *progressed = 1;
+  eager.received++;
+  slot = eager.slots + eager.head*eager.slot_size;
+  mpierr = MPI_Get_count(&status, MPI_BYTE, &count);
+  if (mpierr != MPI_SUCCESS)
+    return mpierr;
+
+  /* Copy out a short message or receive a long one. */
+  if (count > (int)sizeof(uint64_t) && slot[count - 1] == FRAME_LONG) {
+    uint64_t len;
+
+    memcpy(&len, slot, sizeof(uint64_t));
+    count = (int) len;
+    buffer = malloc(count + 1);
+    MPI_TIMED(mpierr, MPI_Recv(buffer, count, MPI_BYTE, status.MPI_SOURCE,
+                               status.MPI_TAG, eager.long_comm, MPI_STATUS_IGNORE));
+    if (mpierr != MPI_SUCCESS) {
+      free(buffer);
+      return mpierr;
+    }
+  }
+  else {
+    buffer = malloc(count + 1);
+    memcpy(buffer, slot, count);
+  }
+  buffer[count] = '\0';
+  if (count > 0 && buffer[count - 1] == FRAME_BATCH)
+    unbatch_message(eager.comm, status.MPI_SOURCE, status.MPI_TAG, 0,
+                    &buffer, &count);
+  else
+    append_pending(eager.comm, status.MPI_SOURCE, status.MPI_TAG, buffer, count);
+
+  /* Repost the slot, which becomes the newest in the ring. */
+  mpierr = MPI_Irecv(slot, eager.slot_size, MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG,
+                     eager.short_comm, &eager.requests[eager.head]);
+  eager.head = (eager.head + 1) % eager.nslots;
+  return mpierr;
+}
+
+/* Begin sending a message of COUNT bytes.  In eager mode, long
+ * messages are preceded by a header.  If REQUEST is NULL, block until
+ * the send completes. */
+static int
+start_send (char *message, int count, int dest, int tag, MPI_Comm comm,
+            MPI_Request *request)
+{
+  char header[sizeof(uint64_t) + 1];    /* Eager-mode header */
+  uint64_t len = count;
+  int mpierr;
+
+  /* Preserve message order by sending any earlier batched messages to
+   * the same destination and tag first. */
+  mpierr = flush_batches(comm, dest, tag);
+  if (mpierr != MPI_SUCCESS)
+    return mpierr;
+
+  /* Account for the message.  batch_send already accounted for each
+   * message within a batch. */
+  if (count == 0 || message[count - 1] != FRAME_BATCH)
+    mpibash_stats_bytes(comm, dest, count);
+  if (eager.enabled && comm == eager.comm && dest != MPI_PROC_NULL) {
+    eager.sent[dest]++;
+    if (count <= eager.slot_size)
+      comm = eager.short_comm;
+    else {
+      memcpy(header, &len, sizeof(uint64_t));
+      header[sizeof(uint64_t)] = FRAME_LONG;
+      MPI_TIMED(mpierr, MPI_Send(header, sizeof(header), MPI_BYTE, dest, tag,
+                                 eager.short_comm));
+      if (mpierr != MPI_SUCCESS)
+        return mpierr;
+      comm = eager.long_comm;
+    }
+  }
+  if (request == NULL) {
+    MPI_TIMED(mpierr, MPI_Send(message, count, MPI_BYTE, dest, tag, comm));
+    return mpierr;
+  }
+  return MPI_Isend(message, count, MPI_BYTE, dest, tag, comm, request);
+}
+
+/* Free every sent batch whose send has completed.  If BLOCK is 1,
+ * wait for all of them to complete. */
+static int
+retire_batches (int block)
+{
+  batch_t *b;                   /* Batch to consider */
+  batch_t **prevp;              /* Pointer to b in the list */
+  int flag = 1;                 /* 1=the batch's send completed */
+  int err;                      /* Result of testing one batch */
+  int mpierr = MPI_SUCCESS;
+
+  for (prevp = &sent_batches, b = sent_batches; b != NULL; b = *prevp) {
+    if (block)
+      MPI_TIMED(err, MPI_Wait(&b->request, MPI_STATUS_IGNORE));
+    else
+      err = MPI_Test(&b->request, &flag, MPI_STATUS_IGNORE);
+    if (err != MPI_SUCCESS || !flag) {
+      if (mpierr == MPI_SUCCESS)
+        mpierr = err;
+      prevp = &b->next;
+      continue;
+    }
+    *prevp = b->next;
+    free(b->buffer);
+    free(b);
+  }
+  return mpierr;
+}
+
+/* Send every batch destined for a given communicator, rank, and tag.
+ * A COMM of MPI_COMM_NULL, a DEST of MPI_ANY_SOURCE, or a TAG of
+ * MPI_ANY_TAG matches all communicators, ranks, or tags.  Batches are
+ * sent without blocking, as the receiver may itself be about to flush
+ * a batch to us before receiving, and are freed once their sends
+ * complete. */
+static int
+flush_batches (MPI_Comm comm, int dest, int tag)
+{
+  batch_t *b;                   /* Batch to consider */
+  batch_t **prevp;              /* Pointer to b in the list */
+  int mpierr;
+
+  mpierr = retire_batches(0);
+  for (prevp = &batches, b = batches; b != NULL; b = *prevp) {
+    if ((comm != MPI_COMM_NULL && comm != b->comm)
+        || (dest != MPI_ANY_SOURCE && dest != b->dest)
+        || (tag != MPI_ANY_TAG && tag != b->tag)) {
+      prevp = &b->next;
+      continue;
+    }
+    *prevp = b->next;
+    b->buffer[b->len++] = FRAME_BATCH;
+    if (mpierr == MPI_SUCCESS)
+      mpierr = start_send(b->buffer, (int) b->len, b->dest, b->tag,
+                          b->comm, &b->request);
+    if (mpierr == MPI_SUCCESS) {
+      b->next = sent_batches;
+      sent_batches = b;
+    }
+    else {
+      free(b->buffer);
+      free(b);
+    }
+  }
+  return mpierr;
+}
+
+/* Send every batched message.  This is called before any operation
+ * that might block waiting on another rank, which might in turn be
+ * waiting on a batched message.  It does not wait for the batches to
+ * be received. */
+int
+mpibash_flush_batches (void)
+{
+  MPI_TRY(flush_batches(MPI_COMM_NULL, MPI_ANY_SOURCE, MPI_ANY_TAG));
+  return EXECUTION_SUCCESS;
+}
+
+/* Wait for every flushed batch to be sent and free it.  This is called
+ * by mpi_finalize. */
+int
+mpibash_retire_batches (void)
+{
+  MPI_TRY(retire_batches(1));
+  return EXECUTION_SUCCESS;
+}
+
+/* Add a NUL-terminated message of COUNT bytes to the batch for a
+ * given communicator, rank, and tag.  Send the batch first if the
+ * message won't fit and afterwards if it is full. */
+static int
+batch_send (char *message, int count, int dest, int tag, MPI_Comm comm)
+{
+  batch_t *b;                   /* Batch to add to */
+  batch_t **prevp;              /* Pointer to b in the list */
+  uint64_t len = count;         /* Length prefix */
+  size_t needed = sizeof(uint64_t) + count;     /* Bytes the message adds to a batch */
+  int mpierr;
+
+  if (needed > BATCH_MAX_BYTES)
+    return start_send(message, count, dest, tag, comm, NULL);
+  mpibash_stats_bytes(comm, dest, count);
+  for (prevp = &batches, b = batches; b != NULL; prevp = &b->next, b = b->next)
+    if (b->comm == comm && b->dest == dest && b->tag == tag)
+      break;
+  if (b != NULL && b->len + needed > BATCH_MAX_BYTES) {
+    mpierr = flush_batches(comm, dest, tag);
+    if (mpierr != MPI_SUCCESS)
+      return mpierr;
+    for (prevp = &batches; *prevp != NULL; prevp = &(*prevp)->next)
+      ;
+    b = NULL;
+  }
+  if (b == NULL) {
+    b = *prevp = malloc(sizeof(batch_t));
+    b->next = NULL;
+    b->comm = comm;
+    b->dest = dest;
+    b->tag = tag;
+    b->buffer = malloc(BATCH_MAX_BYTES + 1);
+    b->len = 0;
+    b->count = 0;
+  }
+  memcpy(b->buffer + b->len, &len, sizeof(uint64_t));
+  memcpy(b->buffer + b->len + sizeof(uint64_t), message, count);
+  b->len += needed;
+  b->count++;
+  if (b->len == BATCH_MAX_BYTES || b->count == BATCH_MAX_COUNT)
+    return flush_batches(comm, dest, tag);
+  return MPI_SUCCESS;
+}
+
+/* Receive a message into a newly allocated, NUL-terminated buffer,
+ * which the caller must free.  Messages are matched from the pending
+ * list first, then from the eager ring (if enabled), and finally with
+ * a single MPI_Mprobe/MPI_Mrecv matching pass.  A batch is split into
+ * its component messages.  If BLOCK is 0 and no message is available,
+ * set *BUFFER to NULL.  If BLOCK is 1, send all batched messages
+ * first. */
+static int
+receive_message (int source, int tag, MPI_Comm comm, int block,
+                 char **buffer, int *count, MPI_Status *status)
+{
+  pending_msg_t *msg;           /* Previously received message */
+  MPI_Message mpimsg;           /* Matched message */
+  int flag = 1;                 /* 1=a message was matched */
+  int mpierr;
+
+  *buffer = NULL;
+  if (block) {
+    mpierr = flush_batches(MPI_COMM_NULL, MPI_ANY_SOURCE, MPI_ANY_TAG);
+    if (mpierr != MPI_SUCCESS)
+      return mpierr;
+  }
+  while (1) {
+    /* Return a pending message if one matches. */
+    msg = take_pending(source, tag, comm);
+    if (msg != NULL) {
+      *buffer = msg->buffer;
+      *count = msg->count;
+      status->MPI_SOURCE = msg->source;
+      status->MPI_TAG = msg->tag;
+      free(msg);
+      mpibash_stats_bytes(comm, status->MPI_SOURCE, *count);
+      return MPI_SUCCESS;
+    }
+
+    /* In eager mode, drain the ring until a message matches. */
+    if (eager.enabled && comm == eager.comm) {
+      mpierr = eager_progress(block, &flag);
+      if (mpierr != MPI_SUCCESS || !flag)
+        return mpierr;
+      continue;
+    }
+
+    /* Otherwise, match and receive the message directly. */
+    if (block)
+      MPI_TIMED(mpierr, MPI_Mprobe(source, tag, comm, &mpimsg, status));
+    else
+      mpierr = MPI_Improbe(source, tag, comm, &flag, &mpimsg, status);
+    if (mpierr != MPI_SUCCESS || !flag)
+      return mpierr;
+    mpierr = MPI_Get_count(status, MPI_BYTE, count);
+    if (mpierr != MPI_SUCCESS)
+      return mpierr;
+    *buffer = malloc(*count + 1);
+    (*buffer)[*count] = '\0';
+    mpierr = MPI_Mrecv(*buffer, *count, MPI_BYTE, &mpimsg, status);
+    if (mpierr != MPI_SUCCESS) {
+      free(*buffer);
+      *buffer = NULL;
+    }
+    else {
+      unbatch_message(comm, status->MPI_SOURCE, status->MPI_TAG, 1,
+                      buffer, count);
+      mpibash_stats_bytes(comm, status->MPI_SOURCE, *count);
+    }
+    return mpierr;
+  }
+}
+
+/* Stream the contents of a file or file descriptor to another rank.
+ * A short header announces the stream, then the contents follow in
+ * chunks on COMM's private stream communicator, several at a time.  A chunk shorter
+ * than the announced chunk size (possibly empty) ends the stream.  A
+ * one-byte trailer then tells the receiver whether we read the whole
+ * source (0) or stopped early because of a read error (1). */
+static int
+send_stream (mpibash_source_t *src, int dest, int tag, MPI_Comm comm)
+{
+  char header[sizeof(uint64_t) + 1];    /* Stream header */
+  uint64_t chunk_size = MPIBASH_CHUNK_SIZE;     /* Maximum bytes per chunk */
+  MPI_Request requests[MPIBASH_STREAM_DEPTH];   /* Chunks in flight */
+  MPI_Comm stream_comm = mpibash_stream_comm_of(comm);  /* Communicator for chunks */
+  char *chunk;                  /* One chunk of data */
+  ssize_t len;                  /* Number of bytes in the above */
+  char failed;                  /* Trailer: 1=the stream ended early */
+  int result = EXECUTION_SUCCESS;
+  int mpierr;
+  int waiterr;
+  long i;
+
+  /* Announce the stream. */
+  memcpy(header, &chunk_size, sizeof(uint64_t));
+  header[sizeof(uint64_t)] = FRAME_STREAM;
+  MPI_TRY(start_send(header, sizeof(header), dest, tag, comm, NULL));
+
+  /* Send chunks until we send a short one.  Reading or mapping the
+   * next chunk overlaps with sending the previous ones.  On a read
+   * error, end the stream early so the receiver doesn't hang.  On an
+   * MPI error, still drain the chunks in flight, as the caller frees
+   * their buffers as soon as we return. */
+  for (i = 0; i < MPIBASH_STREAM_DEPTH; i++)
+    requests[i] = MPI_REQUEST_NULL;
+  for (i = 0; ; i++) {
+    MPI_Request *req = &requests[i % MPIBASH_STREAM_DEPTH];
+
+    MPI_TIMED(mpierr, MPI_Wait(req, MPI_STATUS_IGNORE));
+    if (mpierr != MPI_SUCCESS)
+      break;
+    len = mpibash_read_chunk(src, &chunk);
+    if (len == -1) {
+      result = EXECUTION_FAILURE;
+      len = 0;
+    }
+    MPI_TIMED(mpierr, MPI_Isend(chunk, (int) len, MPI_BYTE, dest, tag,
+                                stream_comm, req));
+    if (mpierr != MPI_SUCCESS)
+      break;
+    mpibash_stats_bytes(comm, dest, len);
+    if (len < MPIBASH_CHUNK_SIZE)
+      break;
+  }
+  MPI_TIMED(waiterr, MPI_Waitall(MPIBASH_STREAM_DEPTH, requests,
+                                 MPI_STATUSES_IGNORE));
+  if (mpierr == MPI_SUCCESS)
+    mpierr = waiterr;
+  failed = result != EXECUTION_SUCCESS;
+  if (mpierr == MPI_SUCCESS)
+    MPI_TIMED(mpierr, MPI_Send(&failed, 1, MPI_BYTE, dest, tag, stream_comm));
+  if (mpierr != MPI_SUCCESS)
+    return mpibash_report_mpi_error(mpierr);
+  return result;
+}
+
+/* Receive the chunks of a stream announced by HEADER from a given
+ * source and tag on COMM.  If FD is not -1, write the chunks to FD.
+ * Otherwise, accumulate them into a newly allocated, NUL-terminated
+ * *BUFFER.  Store the total number of bytes received in *TOTAL.
+ * Receiving chunk i+1 overlaps with consuming chunk i.  Fail if the
+ * sender's trailer says the stream was cut short. */
+static int
+receive_stream (char *header, int source, int tag, MPI_Comm comm, int fd,
+                char **buffer, size_t *total)
+{
+  MPI_Comm stream_comm = mpibash_stream_comm_of(comm);  /* Communicator for chunks */
+  uint64_t chunk_size;          /* Maximum bytes per chunk */
+  char *chunks[2];              /* Double-buffered chunk data */
+  MPI_Request request;          /* Receive of the next chunk */
+  MPI_Status status;            /* Status of a completed chunk */
+  int count;                    /* Number of bytes in a chunk */
+  int cur = 0;                  /* Index into chunks of the current chunk */
+  char failed;                  /* Trailer: 1=the stream ended early */
+  int result = EXECUTION_SUCCESS;
+  int mpierr;
+
+  memcpy(&chunk_size, header, sizeof(uint64_t));
+  chunks[0] = malloc(chunk_size);
+  chunks[1] = malloc(chunk_size);
+  *total = 0;
+  if (fd == -1)
+    *buffer = NULL;
+  mpierr = MPI_Irecv(chunks[cur], (int) chunk_size, MPI_BYTE, source, tag,
+                     stream_comm, &request);
+  do {
+    if (mpierr == MPI_SUCCESS)
+      MPI_TIMED(mpierr, MPI_Wait(&request, &status));
+    if (mpierr == MPI_SUCCESS)
+      mpierr = MPI_Get_count(&status, MPI_BYTE, &count);
+    if (mpierr != MPI_SUCCESS)
+      break;
+    mpibash_stats_bytes(comm, source, count);
+    if ((uint64_t)count == chunk_size)
+      mpierr = MPI_Irecv(chunks[1 - cur], (int) chunk_size, MPI_BYTE, source,
+                         tag, stream_comm, &request);
+
+    /* Write the chunk or append it to the buffer.  After a write
+     * error, keep draining the stream but discard its contents. */
+    if (fd != -1) {
+      if (result == EXECUTION_SUCCESS)
+        result = mpibash_write_all(fd, chunks[cur], count);
+    }
+    else {
+      *buffer = realloc(*buffer, *total + count + 1);
+      memcpy(*buffer + *total, chunks[cur], count);
+      (*buffer)[*total + count] = '\0';
+    }
+    *total += count;
+    cur = 1 - cur;
+  }
+  while ((uint64_t)count == chunk_size);
+  free(chunks[0]);
+  free(chunks[1]);
+  if (fd == -1 && *buffer == NULL)
+    *buffer = strdup("");
+  if (mpierr == MPI_SUCCESS)
+    MPI_TIMED(mpierr, MPI_Recv(&failed, 1, MPI_BYTE, source, tag, stream_comm,
+                               MPI_STATUS_IGNORE));
+  if (mpierr != MPI_SUCCESS)
+    return mpibash_report_mpi_error(mpierr);
+  if (failed) {
+    builtin_error(_("rank %d failed to read all of the data it was sending"),
+                  source);
+    return EXECUTION_FAILURE;
+  }
+  return result;
+}
+
+/* Append a length-prefixed string to a packed array and return a
+ * pointer just past it. */
+static char *
+pack_string (char *p, const char *str)
+{
+  uint64_t len = str == NULL ? 0 : strlen(str);
+
+  memcpy(p, &len, sizeof(uint64_t));
+  if (len > 0)
+    memcpy(p + sizeof(uint64_t), str, len);
+  return p + sizeof(uint64_t) + len;
+}
+
+/* Extract a length-prefixed string from a packed array into a newly
+ * allocated, NUL-terminated *STR and return a pointer just past it. */
+static char *
+unpack_string (char *p, char **str)
+{
+  uint64_t len;
+
+  memcpy(&len, p, sizeof(uint64_t));
+  *str = malloc(len + 1);
+  memcpy(*str, p + sizeof(uint64_t), len);
+  (*str)[len] = '\0';
+  return p + sizeof(uint64_t) + len;
+}
+
+/* Pack every element of an indexed or associative array variable into
+ * a newly allocated buffer, which the caller must free.  The elements
+ * come first, each a key (an int64_t index or a length-prefixed string)
+ * followed by a length-prefixed value.  A trailer holds the element
+ * count, an indexed/associative flag, and FRAME_ARRAY.  A scalar is
+ * treated as element 0 of an indexed array. */
+static int
+pack_array (SHELL_VAR *var, char **buffer, int *count)
+{
+  ARRAY *array = NULL;          /* Contents of an indexed array */
+  HASH_TABLE *hash = NULL;      /* Contents of an associative array */
+  ARRAY_ELEMENT *ae;            /* One element of an indexed array */
+  BUCKET_CONTENTS *b;           /* One element of an associative array */
+  char *scalar = NULL;          /* Contents of a scalar variable */
+  uint64_t nelts = 0;           /* Number of elements */
+  int64_t ind;                  /* Index of an indexed-array element */
+  size_t total;                 /* Number of bytes to send */
+  char *p;                      /* Next byte to fill in */
+  int i;
+
+  /* Determine the packed size. */
+  total = sizeof(uint64_t) + 2;
+  if (assoc_p(var)) {
+    hash = assoc_cell(var);
+    for (i = 0; i < hash->nbuckets; i++)
+      for (b = hash_items(i, hash); b != NULL; b = b->next) {
+        total += 2*sizeof(uint64_t) + strlen(b->key);
+        if (b->data != NULL)
+          total += strlen((char *)b->data);
+        nelts++;
+      }
+  }
+  else if (array_p(var)) {
+    array = array_cell(var);
+    for (ae = element_forw(array_head(array)); ae != array_head(array); ae = element_forw(ae)) {
+      total += sizeof(int64_t) + sizeof(uint64_t);
+      if (element_value(ae) != NULL)
+        total += strlen(element_value(ae));
+      nelts++;
+    }
+  }
+  else {
+    scalar = value_cell(var) == NULL ? "" : value_cell(var);
+    total += sizeof(int64_t) + sizeof(uint64_t) + strlen(scalar);
+    nelts = 1;
+  }
+  if (total > INT_MAX) {
+    builtin_error(_("%s: array too large to send"), var->name);
+    return EXECUTION_FAILURE;
+  }
+
+  /* Fill in the buffer. */
+  *buffer = p = malloc(total);
+  *count = (int) total;
+  if (hash != NULL)
+    for (i = 0; i < hash->nbuckets; i++)
+      for (b = hash_items(i, hash); b != NULL; b = b->next) {
+        p = pack_string(p, b->key);
+        p = pack_string(p, (char *)b->data);
+      }
+  else if (array != NULL)
+    for (ae = element_forw(array_head(array)); ae != array_head(array); ae = element_forw(ae)) {
+      ind = element_index(ae);
+      memcpy(p, &ind, sizeof(int64_t));
+      p = pack_string(p + sizeof(int64_t), element_value(ae));
+    }
+  else {
+    ind = 0;
+    memcpy(p, &ind, sizeof(int64_t));
+    p = pack_string(p + sizeof(int64_t), scalar);
+  }
+  memcpy(p, &nelts, sizeof(uint64_t));
+  p[sizeof(uint64_t)] = hash != NULL;
+  p[sizeof(uint64_t) + 1] = FRAME_ARRAY;
+  return EXECUTION_SUCCESS;
+}
+
+/* Unpack a buffer produced by pack_array into array variable VARNAME,
+ * which the caller has already unbound. */
+static int
+unpack_array (char *buffer, int count, char *varname)
+{
+  SHELL_VAR *var;               /* Variable to bind */
+  char *trailer;                /* Element count and array type */
+  char *p = buffer;             /* Next byte to unpack */
+  char *key;                    /* Key of an associative-array element */
+  char *value;                  /* Value of any element */
+  int64_t ind;                  /* Index of an indexed-array element */
+  uint64_t nelts;               /* Number of elements */
+  int is_assoc;                 /* 1=associative; 0=indexed */
+
+  trailer = buffer + count - (sizeof(uint64_t) + 2);
+  memcpy(&nelts, trailer, sizeof(uint64_t));
+  is_assoc = trailer[sizeof(uint64_t)];
+  var = is_assoc ? make_new_assoc_variable(varname) : make_new_array_variable(varname);
+  for (; nelts > 0; nelts--) {
+    if (is_assoc) {
+      p = unpack_string(p, &key);
+      p = unpack_string(p, &value);
+      assoc_insert(assoc_cell(var), key, value);   /* Takes ownership of key */
+    }
+    else {
+      memcpy(&ind, p, sizeof(int64_t));
+      p = unpack_string(p + sizeof(int64_t), &value);
+      array_insert(array_cell(var), (arrayind_t) ind, value);
+    }
+    free(value);
+  }
+  return EXECUTION_SUCCESS;
+}
+
+/* Deliver a message received on COMM.  Text is bound to element 0 of
+ * VARNAME or, if FD is not -1, written to FD, in which case element 0
+ * is the number of bytes written.  Streams are received in full first.
+ * Elements 1 and 2 are the sender's rank and the tag. */
+static int
+deliver_message (char *buffer, int count, MPI_Status *status, MPI_Comm comm,
+                 int fd, char *varname)
+{
+  char *contents = buffer;      /* Message contents */
+  size_t len = count > 0 ? count - 1 : 0;       /* Number of bytes in the above */
+  int streamed = 0;             /* 1=message was a stream */
+  int result = EXECUTION_SUCCESS;
+
+  /* Pull in the body of a stream. */
+  switch (count > 0 ? buffer[count - 1] : FRAME_TEXT) {
+    case FRAME_TEXT:
+      break;
+
+    case FRAME_STREAM:
+      result = receive_stream(buffer, status->MPI_SOURCE, status->MPI_TAG,
+                              comm, fd, &contents, &len);
+      streamed = 1;
+      break;
+
+    case FRAME_ARRAY:
+      builtin_error(_("received an array; use -a to receive it"));
+      return EXECUTION_FAILURE;
+
+    default:
+      builtin_error(_("received a message in an unrecognized format"));
+      return EXECUTION_FAILURE;
+  }
+
+  /* Bind the results.  Streams were already written to FD. */
+  if (fd == -1) {
+    bind_array_variable(varname, 0, contents, 0);
+    if (streamed)
+      free(contents);
+  }
+  else {
+    if (!streamed)
+      result = mpibash_write_all(fd, contents, len);
+    mpibash_bind_array_variable_number(varname, 0, len, 0);
+  }
+  mpibash_bind_array_variable_number(varname, 1, status->MPI_SOURCE, 0);
+  mpibash_bind_array_variable_number(varname, 2, status->MPI_TAG, 0);
+  return result;
+}
 
 /* Send a message to another MPI rank. */
 static int
-mpi_send_builtin (WORD_LIST * list)
+mpi_send_builtin (WORD_LIST * list)
+{
+  char *word;                   /* One argument */
+  intmax_t target_rank;         /* MPI target rank */
+  char *message = NULL;         /* Message to send to rank target_rank */
+  intmax_t tag = 0;             /* Message tag to use */
+  char *filename = NULL;        /* File whose contents should be sent */
+  int fd = -1;                  /* File descriptor whose contents should be sent */
+  mpibash_source_t src;         /* Source of streamed contents */
+  int array_mode = 0;           /* 1=send an entire array */
+  int batch_mode = 0;           /* 1=batch the message with others */
+  mpibash_comm_t comm;          /* Communicator to send on */
+  SHELL_VAR *var;               /* Array to send */
+  int count;                    /* Number of bytes in a packed array */
+  int result;
+  int opt;                      /* Parsed option */
+
+  /* Parse any options provided. */
+  mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "abc:t:f:F:")) != -1) {
+    switch (opt) {
+      case 'c':
+        if (!mpibash_parse_comm(list_optarg, &comm))
+          return (EX_USAGE);
+        break;
+
+      case 't':
+        if (!legal_number(list_optarg, &tag)) {
+          sh_neednumarg("-t");
+          return (EX_USAGE);
+        }
+        break;
+
+      case 'a':
+        array_mode = 1;
+        break;
+
+      case 'b':
+        batch_mode = 1;
+        break;
+
+      case 'f':
+        filename = list_optarg;
+        break;
+
+      case 'F':
+        if (!mpibash_parse_fd(list_optarg, &fd))
+          return (EX_USAGE);
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+  if (filename != NULL && fd != -1) {
+    builtin_error(_("-f and -F are mutually exclusive"));
+    return (EX_USAGE);
+  }
+  if (array_mode && (filename != NULL || fd != -1)) {
+    builtin_error(_("-a cannot be combined with -f or -F"));
+    return (EX_USAGE);
+  }
+  if (batch_mode && (array_mode || filename != NULL || fd != -1)) {
+    builtin_error(_("-b cannot be combined with -a, -f, or -F"));
+    return (EX_USAGE);
+  }
+
+  /* Parse the target rank, which must be a number. */
+  YES_ARGS(list);
+  word = list->word->word;
+  if (!legal_number(word, &target_rank)) {
+    builtin_error(_("mpi_send: numeric rank required"));
+    return EX_USAGE;
+  }
+  list = list->next;
+
+  /* Parse the message to send unless it comes from a file. */
+  if (filename == NULL && fd == -1) {
+    YES_ARGS(list);
+    message = list->word->word;
+    list = list->next;
+  }
+  no_args(list);
+
+  /* Send an entire array as a single message. */
+  if (array_mode) {
+    var = find_variable(message);
+    if (var == NULL || invisible_p(var)) {
+      builtin_error(_("%s: no such variable"), message);
+      return EXECUTION_FAILURE;
+    }
+    if (pack_array(var, &message, &count) != EXECUTION_SUCCESS)
+      return EXECUTION_FAILURE;
+    result = start_send(message, count, (int)target_rank, (int)tag,
+                        comm.comm, NULL);
+    free(message);
+    if (result != MPI_SUCCESS)
+      return mpibash_report_mpi_error(result);
+    return EXECUTION_SUCCESS;
+  }
+
+  /* Send the message. */
+  if (batch_mode) {
+    MPI_TRY(batch_send(message, strlen(message) + 1, (int)target_rank, (int)tag,
+                       comm.comm));
+    return EXECUTION_SUCCESS;
+  }
+  if (message != NULL) {
+    MPI_TRY(start_send(message, strlen(message) + 1, (int)target_rank, (int)tag,
+                       comm.comm, NULL));
+    return EXECUTION_SUCCESS;
+  }
+  if (mpibash_open_source(&src, filename, fd) != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  result = send_stream(&src, (int)target_rank, (int)tag, comm.comm);
+  mpibash_close_source(&src);
+  return result;
+}
+
+/* Define the documentation for the mpi_send builtin. */
+static char *mpi_send_doc[] = {
+  "Send a message to a remote process in the same MPI job.",
+  "",
+  "Options:",
+  "  -t TAG        Send the message using tag TAG (default: 0).  TAG must",
+  "                be a nonnegative integer.",
+  "",
+  "  -f FILE       Send the contents of FILE instead of MESSAGE.",
+  "",
+  "  -F FD         Send everything that can be read from file descriptor FD",
+  "                instead of MESSAGE.",
+  "",
+  "  -a            Treat MESSAGE as the name of an indexed or associative",
+  "                array and send all of its elements in a single message,",
+  "                to be received with mpi_recv -a.",
+  "",
+  "  -b            Batch MESSAGE with other short messages to the same RANK",
+  "                and TAG and send them all at once.  See mpi_flush.",
+  "",
+  "  -c COMM       Send within communicator COMM (default: all processes).",
+  "                RANK is then a rank within COMM.",
+  "",
+  "Arguments:",
+  "  RANK          Whom to send the message to.  RANK must be an integer in",
+  "                the range [0, $(mpi_comm_size)-1].",
+  "",
+  "  MESSAGE       String to send to rank RANK.",
+  "",
+  "File contents are streamed in chunks, several of which are in flight",
+  "at once, so data of any size and content can be sent without passing",
+  "through a shell variable.  Regular files are memory-mapped rather than",
+  "read.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_send builtin. */
+DEFINE_BUILTIN(mpi_send, "mpi_send [-c comm] [-t tag] [-a | -b | -f file | -F fd] rank [message]");
+
+/* Send batched messages. */
+static int
+mpi_flush_builtin (WORD_LIST *list)
+{
+  char *word;                   /* One argument */
+  intmax_t target_rank = MPI_ANY_SOURCE;        /* Rank whose batches to send */
+  MPI_Comm comm = MPI_COMM_NULL;        /* Communicator whose batches to send */
+  mpibash_comm_t entry;         /* Communicator named by -c */
+
+  /* Parse the optional communicator and target rank. */
+  if (list != NULL && ISOPTION(list->word->word, 'c')) {
+    list = list->next;
+    YES_ARGS(list);
+    if (!mpibash_parse_comm(list->word->word, &entry))
+      return (EX_USAGE);
+    comm = entry.comm;
+    list = list->next;
+  }
+  if (list != NULL) {
+    word = list->word->word;
+    if (!legal_number(word, &target_rank)) {
+      builtin_error(_("mpi_flush: numeric rank required"));
+      return EX_USAGE;
+    }
+    list = list->next;
+  }
+  no_args(list);
+
+  /* Send the batches. */
+  MPI_TRY(flush_batches(comm, (int) target_rank, MPI_ANY_TAG));
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_flush builtin. */
+static char *mpi_flush_doc[] = {
+  "Send messages batched by mpi_send -b.",
+  "",
+  "Options:",
+  "  -c COMM       Send only the messages batched for communicator COMM.",
+  "",
+  "Arguments:",
+  "  RANK          Send only the messages batched for rank RANK (default:",
+  "                all batched messages).",
+  "",
+  "mpi_send -b holds short messages to the same rank and tag and sends",
+  "them together as a single MPI message, which mpi_recv and mpi_irecv",
+  "transparently split back into the original messages.  A batch is",
+  "sent when it reaches 64 KiB or 256 messages, when mpi_flush is",
+  "called, when an unbatched message is sent to the same rank and tag,",
+  "and before any operation that can block waiting on another process:",
+  "mpi_recv, mpi_sendrecv, mpi_shift, mpi_wait, mpi_waitany, mpi_waitall,",
+  "collectives, and mpi_finalize.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_flush builtin. */
+DEFINE_BUILTIN(mpi_flush, "mpi_flush [-c comm] [rank]");
+
+/* Receive a message from another MPI rank. */
+static int
+mpi_recv_builtin (WORD_LIST *list)
+{
+  char *word;                   /* One argument */
+  intmax_t source_rank;         /* MPI source rank */
+  MPI_Status status;            /* Status of an MPI operation */
+  int count;                    /* Message length in bytes */
+  intmax_t tag = 0;             /* Message tag to use */
+  char *varname;                /* Name of the variable to bind the results to */
+  char *message;                /* Message received from MPI */
+  char *filename = NULL;        /* File to which to write the message */
+  int fd = -1;                  /* File descriptor to which to write the message */
+  int array_mode = 0;           /* 1=receive an entire array */
+  mpibash_comm_t comm;          /* Communicator to receive on */
+  int result;
+  int opt;                      /* Parsed option */
+
+  /* Parse any options provided. */
+  mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "ac:t:o:F:")) != -1) {
+    switch (opt) {
+      case 'c':
+        if (!mpibash_parse_comm(list_optarg, &comm))
+          return (EX_USAGE);
+        break;
+
+      case 't':
+        if (!strcmp(list_optarg, "any"))
+          tag = MPI_ANY_TAG;
+        else if (!legal_number(list_optarg, &tag)) {
+          builtin_error(_("-t: numeric argument or \"any\" required"));
+          return (EX_USAGE);
+        }
+        break;
+
+      case 'a':
+        array_mode = 1;
+        break;
+
+      case 'o':
+        filename = list_optarg;
+        break;
+
+      case 'F':
+        if (!mpibash_parse_fd(list_optarg, &fd))
+          return (EX_USAGE);
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+  if (filename != NULL && fd != -1) {
+    builtin_error(_("-o and -F are mutually exclusive"));
+    return (EX_USAGE);
+  }
+  if (array_mode && (filename != NULL || fd != -1)) {
+    builtin_error(_("-a cannot be combined with -o or -F"));
+    return (EX_USAGE);
+  }
+
+  /* Parse the source rank, which must be a number or "any". */
+  YES_ARGS(list);
+  word = list->word->word;
+  if (!legal_number(word, &source_rank)) {
+    if (!strcmp(word, "any"))
+      source_rank = MPI_ANY_SOURCE;
+    else {
+      builtin_error(_("mpi_recv: numeric rank or \"any\" required"));
+      return (EX_USAGE);
+    }
+  }
+  list = list->next;
+
+  /* Parse the target variable, which must not be read-only. */
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  no_args(list);
+
+  /* Receive a message.  Because we don't know long the message will
+   * be, we match it first then receive it into a buffer of the right
+   * size. */
+  if (filename != NULL) {
+    fd = mpibash_open_sink(filename);
+    if (fd == -1)
+      return EXECUTION_FAILURE;
+  }
+  result = receive_message((int) source_rank, (int) tag, comm.comm, 1,
+                           &message, &count, &status);
+  if (result == MPI_SUCCESS) {
+    if (!array_mode)
+      result = deliver_message(message, count, &status, comm.comm, fd,
+                               varname);
+    else if (count > 0 && message[count - 1] == FRAME_ARRAY)
+      result = unpack_array(message, count, varname);
+    else {
+      builtin_error(_("received a message that is not an array"));
+      result = EXECUTION_FAILURE;
+    }
+    free(message);
+  }
+  else
+    result = mpibash_report_mpi_error(result);
+  if (filename != NULL)
+    close(fd);
+  return result;
+}
+
+/* Define the documentation for the mpi_recv builtin. */
+static char *mpi_recv_doc[] = {
+  "Receive a message from a remote process in the same MPI job.",
+  "",
+  "Options:",
+  "  -t TAG        Receive only messages sent using tag TAG (default: 0).",
+  "                TAG must be either a nonnegative integer or the string",
+  "                \"any\" to receive messages sent using any tag.",
+  "",
+  "  -o FILE       Write the message to FILE instead of binding it to NAME.",
+  "",
+  "  -F FD         Write the message to file descriptor FD instead of",
+  "                binding it to NAME.",
+  "",
+  "  -a            Receive an array sent with mpi_send -a.  NAME becomes",
+  "                an indexed or associative array (matching the sender's)",
+  "                holding exactly the elements sent.  The sender's rank",
+  "                and tag are not reported.",
+  "",
+  "  -c COMM       Receive within communicator COMM (default: all",
+  "                processes).  RANK is then a rank within COMM.",
+  "",
+  "Arguments:",
+  "  RANK          Receive only messages sent from sender RANK.  RANK",
+  "                must either be in the range [0, $(mpi_comm_size)-1] or",
+  "                be the string \"any\" to receive messages from any sender.",
+  "",
+  "  NAME          Array variable in which to receive the message (or, with",
+  "                -o or -F, the number of bytes written), sender rank, and",
+  "                tag.",
+  "",
+  "Use -o or -F to receive file contents sent with mpi_send -f or -F",
+  "intact; shell variables cannot hold NUL bytes.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_recv builtin. */
+DEFINE_BUILTIN(mpi_recv, "mpi_recv [-c comm] [-t tag] [-a | -o file | -F fd] rank name");
+
+/* Send a message to one rank of COMM while receiving a message from
+ * another.
+ * The send is started first and completed last so that every process
+ * in a ring or halo exchange can call this at the same time without
+ * deadlocking.  A DEST or SOURCE of MPI_PROC_NULL skips that half of
+ * the exchange, in which case *BUFFER is set to NULL. */
+static int
+exchange_messages (char *message, int dest, int send_tag,
+                   int source, int recv_tag, MPI_Comm comm,
+                   char **buffer, int *count, MPI_Status *status)
+{
+  MPI_Request request = MPI_REQUEST_NULL;   /* Outgoing message */
+  int mpierr;
+
+  *buffer = NULL;
+  if (dest != MPI_PROC_NULL) {
+    mpierr = start_send(message, strlen(message) + 1, dest, send_tag,
+                        comm, &request);
+    if (mpierr != MPI_SUCCESS)
+      return mpierr;
+  }
+  if (source != MPI_PROC_NULL) {
+    mpierr = receive_message(source, recv_tag, comm, 1,
+                             buffer, count, status);
+    if (mpierr != MPI_SUCCESS) {
+      MPI_Wait(&request, MPI_STATUS_IGNORE);
+      return mpierr;
+    }
+  }
+  MPI_TIMED(mpierr, MPI_Wait(&request, MPI_STATUS_IGNORE));
+  if (mpierr != MPI_SUCCESS) {
+    free(*buffer);
+    *buffer = NULL;
+  }
+  return mpierr;
+}
+
+/* Send a message to one MPI rank and receive a message from another
+ * in a single step. */
+static int
+mpi_sendrecv_builtin (WORD_LIST *list)
+{
+  char *word;                   /* One argument */
+  intmax_t target_rank;         /* MPI target rank */
+  intmax_t source_rank;         /* MPI source rank */
+  intmax_t send_tag = 0;        /* Tag of the outgoing message */
+  intmax_t recv_tag = -1;       /* Tag of the incoming message (-1=same as send_tag) */
+  MPI_Status status;            /* Status of the incoming message */
+  char *message;                /* Message to send to rank target_rank */
+  char *varname;                /* Name of the variable to bind the results to */
+  char *received;               /* Message received from MPI */
+  int count;                    /* Number of bytes in the above */
+  mpibash_comm_t comm;          /* Communicator to exchange on */
+  int result;
+  int opt;                      /* Parsed option */
+
+  /* Parse any options provided. */
+  mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "c:t:T:")) != -1) {
+    switch (opt) {
+      case 'c':
+        if (!mpibash_parse_comm(list_optarg, &comm))
+          return (EX_USAGE);
+        break;
+
+      case 't':
+        if (!legal_number(list_optarg, &send_tag)) {
+          sh_neednumarg("-t");
+          return (EX_USAGE);
+        }
+        break;
+
+      case 'T':
+        if (!strcmp(list_optarg, "any"))
+          recv_tag = MPI_ANY_TAG;
+        else if (!legal_number(list_optarg, &recv_tag)) {
+          builtin_error(_("-T: numeric argument or \"any\" required"));
+          return (EX_USAGE);
+        }
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+  if (recv_tag == -1)
+    recv_tag = send_tag;
+
+  /* Parse the target rank and the message to send. */
+  YES_ARGS(list);
+  word = list->word->word;
+  if (!legal_number(word, &target_rank)) {
+    builtin_error(_("mpi_sendrecv: numeric rank required"));
+    return EX_USAGE;
+  }
+  list = list->next;
+  YES_ARGS(list);
+  message = list->word->word;
+  list = list->next;
+
+  /* Parse the source rank, which must be a number or "any". */
+  YES_ARGS(list);
+  word = list->word->word;
+  if (!legal_number(word, &source_rank)) {
+    if (!strcmp(word, "any"))
+      source_rank = MPI_ANY_SOURCE;
+    else {
+      builtin_error(_("mpi_sendrecv: numeric rank or \"any\" required"));
+      return (EX_USAGE);
+    }
+  }
+  list = list->next;
+
+  /* Parse the target variable, which must not be read-only. */
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  no_args(list);
+
+  /* Exchange messages and bind the one we received. */
+  result = exchange_messages(message, (int) target_rank, (int) send_tag,
+                             (int) source_rank, (int) recv_tag, comm.comm,
+                             &received, &count, &status);
+  if (result != MPI_SUCCESS)
+    return mpibash_report_mpi_error(result);
+  result = deliver_message(received, count, &status, comm.comm, -1, varname);
+  free(received);
+  return result;
+}
+
+/* Define the documentation for the mpi_sendrecv builtin. */
+static char *mpi_sendrecv_doc[] = {
+  "Send a message to one process while receiving from another.",
+  "",
+  "Options:",
+  "  -t TAG        Send the message using tag TAG (default: 0).  TAG must",
+  "                be a nonnegative integer.",
+  "",
+  "  -T TAG        Receive only messages sent using tag TAG (default: the",
+  "                same as -t).  TAG must be either a nonnegative integer",
+  "                or the string \"any\".",
+  "",
+  "  -c COMM       Exchange within communicator COMM (default: all",
+  "                processes).  DEST and SOURCE are then ranks within COMM.",
+  "",
+  "Arguments:",
+  "  DEST          Whom to send the message to.  DEST must be an integer in",
+  "                the range [0, $(mpi_comm_size)-1].",
+  "",
+  "  MESSAGE       String to send to rank DEST.",
+  "",
+  "  SOURCE        Receive only messages sent from sender SOURCE.  SOURCE",
+  "                must either be in the range [0, $(mpi_comm_size)-1] or",
+  "                be the string \"any\".",
+  "",
+  "  NAME          Array variable in which to receive the message, sender",
+  "                rank, and tag.",
+  "",
+  "Unlike a pair of mpi_send and mpi_recv calls, mpi_sendrecv cannot",
+  "deadlock when every process in a ring or neighbor exchange calls it",
+  "at the same time.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_sendrecv builtin. */
+DEFINE_BUILTIN(mpi_sendrecv, "mpi_sendrecv [-c comm] [-t tag] [-T tag] dest message source name");
+
+/* Parse a comma-separated list of positive grid dimensions covering
+ * NRANKS ranks into a newly allocated array, which the caller must
+ * free.  Return the number of dimensions or 0 on failure. */
+static int
+parse_grid (char *word, int nranks, int **dims)
+{
+  char *copy = strdup(word);    /* Modifiable copy of word */
+  char *field;                  /* One dimension */
+  char *saveptr;                /* State for strtok_r */
+  intmax_t n;                   /* Parsed dimension */
+  long product = 1;             /* Number of ranks in the grid */
+  int ndims = 0;                /* Number of dimensions parsed */
+
+  *dims = malloc((strlen(word)/2 + 1)*sizeof(int));
+  for (field = strtok_r(copy, ",", &saveptr);
+       field != NULL;
+       field = strtok_r(NULL, ",", &saveptr)) {
+    if (!legal_number(field, &n) || n < 1 || n > nranks)
+      break;
+    (*dims)[ndims++] = (int) n;
+    product *= n;
+    if (product > nranks)
+      break;
+  }
+  free(copy);
+  if (field != NULL || ndims == 0 || product != nranks) {
+    builtin_error(_("%s: invalid grid for %d processes"), word, nranks);
+    free(*dims);
+    return 0;
+  }
+  return ndims;
+}
+
+/* Shift a value along a ring of all ranks or along one dimension of a
+ * row-major Cartesian grid of ranks. */
+static int
+mpi_shift_builtin (WORD_LIST *list)
+{
+  intmax_t disp;                /* Displacement along the dimension */
+  intmax_t tag = 0;             /* Message tag to use */
+  intmax_t dim = 0;             /* Dimension along which to shift */
+  char *grid = NULL;            /* Comma-separated grid extents */
+  int *dims = NULL;             /* Extent of each grid dimension */
+  int ndims = 1;                /* Number of entries in the above */
+  int periodic = 1;             /* 1=wrap around; 0=stop at the edges */
+  long stride = 1;              /* Rank distance between neighbors along dim */
+  long coord;                   /* Our coordinate along dim */
+  long dest_coord;              /* Destination's coordinate along dim */
+  long source_coord;            /* Source's coordinate along dim */
+  int dest = MPI_PROC_NULL;     /* Rank to send to */
+  int source = MPI_PROC_NULL;   /* Rank to receive from */
+  char *message;                /* Value to send */
+  char *varname;                /* Name of the variable to bind the result to */
+  char *received;               /* Value received */
+  int count;                    /* Number of bytes in the above */
+  MPI_Status status;            /* Status of the incoming message */
+  mpibash_comm_t comm;          /* Communicator whose ranks form the ring or grid */
+  int result;
+  int opt;                      /* Parsed option */
+  int i;
+
+  /* Parse any options provided. */
+  mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "c:d:g:nt:")) != -1) {
+    switch (opt) {
+      case 'c':
+        if (!mpibash_parse_comm(list_optarg, &comm))
+          return (EX_USAGE);
+        break;
+
+      case 'd':
+        if (!legal_number(list_optarg, &dim) || dim < 0) {
+          builtin_error(_("-d: nonnegative number required"));
+          return (EX_USAGE);
+        }
+        break;
+
+      case 'g':
+        grid = list_optarg;
+        break;
+
+      case 'n':
+        periodic = 0;
+        break;
+
+      case 't':
+        if (!legal_number(list_optarg, &tag)) {
+          sh_neednumarg("-t");
+          return (EX_USAGE);
+        }
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+
+  /* Parse the displacement, the value to send, and the target
+   * variable. */
+  YES_ARGS(list);
+  if (!legal_number(list->word->word, &disp)) {
+    builtin_error(_("mpi_shift: numeric displacement required"));
+    return (EX_USAGE);
+  }
+  list = list->next;
+  YES_ARGS(list);
+  message = list->word->word;
+  list = list->next;
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  no_args(list);
+
+  /* Parse the grid shape. */
+  if (grid == NULL) {
+    dims = malloc(sizeof(int));
+    dims[0] = comm.size;
+  }
+  else {
+    ndims = parse_grid(grid, comm.size, &dims);
+    if (ndims == 0)
+      return (EX_USAGE);
+  }
+  if (dim >= ndims) {
+    builtin_error(_("-d: grid has only %d dimension(s)"), ndims);
+    free(dims);
+    return (EX_USAGE);
+  }
+
+  /* Find our neighbors along the given dimension.  Ranks are laid out
+   * in row-major order, as with MPI_Cart_create. */
+  for (i = ndims - 1; i > dim; i--)
+    stride *= dims[i];
+  coord = (comm.rank/stride) % dims[dim];
+  dest_coord = coord + disp;
+  source_coord = coord - disp;
+  if (periodic) {
+    dest_coord = ((dest_coord % dims[dim]) + dims[dim]) % dims[dim];
+    source_coord = ((source_coord % dims[dim]) + dims[dim]) % dims[dim];
+  }
+  if (dest_coord >= 0 && dest_coord < dims[dim])
+    dest = (int) (comm.rank + (dest_coord - coord)*stride);
+  if (source_coord >= 0 && source_coord < dims[dim])
+    source = (int) (comm.rank + (source_coord - coord)*stride);
+  free(dims);
+
+  /* Exchange values.  Leave the target variable unset at an edge. */
+  result = exchange_messages(message, dest, (int) tag, source, (int) tag,
+                             comm.comm, &received, &count, &status);
+  if (result != MPI_SUCCESS)
+    return mpibash_report_mpi_error(result);
+  if (received == NULL)
+    return EXECUTION_SUCCESS;
+  if (count > 0 && received[count - 1] != FRAME_TEXT) {
+    builtin_error(_("received a message in an unrecognized format"));
+    free(received);
+    return EXECUTION_FAILURE;
+  }
+  bind_variable(varname, received, 0);
+  free(received);
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_shift builtin. */
+static char *mpi_shift_doc[] = {
+  "Shift a value along a ring or grid of processes.",
+  "",
+  "Options:",
+  "  -g DIMS       Arrange the processes in a row-major Cartesian grid",
+  "                whose extents are given by the comma-separated list",
+  "                DIMS, for example, \"4,8\".  The extents must multiply",
+  "                to $(mpi_comm_size).  By default, all processes form a",
+  "                single ring.",
+  "",
+  "  -c COMM       Shift among the processes of communicator COMM (default:",
+  "                all processes).",
+  "",
+  "  -d DIM        Shift along grid dimension DIM (default: 0).",
+  "",
+  "  -n            Do not wrap around at the edges of the ring or grid.",
+  "",
+  "  -t TAG        Send the value using tag TAG (default: 0).  TAG must",
+  "                be a nonnegative integer.",
+  "",
+  "Arguments:",
+  "  DISP          Number of positions by which to shift.  Each process",
+  "                sends VALUE to the process DISP positions ahead of it",
+  "                and receives from the process DISP positions behind it.",
+  "                Precede a negative DISP with \"--\".",
+  "",
+  "  VALUE         String to send.",
+  "",
+  "  NAME          Scalar variable in which to receive the shifted value.",
+  "                With -n, NAME is left unset on processes with no one",
+  "                DISP positions behind them.",
+  "",
+  "All processes in the MPI job must call mpi_shift together.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_shift builtin. */
+DEFINE_BUILTIN(mpi_shift, "mpi_shift [-c comm] [-g dims] [-d dim] [-n] [-t tag] disp value name");
+
+/* Send a message to another MPI rank without waiting for it to be
+ * received. */
+static int
+mpi_isend_builtin (WORD_LIST *list)
 {
   char *word;                   /* One argument */
   intmax_t target_rank;         /* MPI target rank */
   char *message;                /* Message to send to rank target_rank */
   intmax_t tag = 0;             /* Message tag to use */
+  char *varname;                /* Name of the variable to bind the handle to */
+  mpibash_request_t *req;       /* Nonblocking request */
+  int handle;                   /* Handle corresponding to the above */
+  mpibash_comm_t comm;          /* Communicator to send on */
+  int opt;                      /* Parsed option */
+  int mpierr;
 
-  /* Parse "-t TAG" (optional), where TAG is a number or "any". */
-  YES_ARGS(list);
-  word = list->word->word;
-  if (ISOPTION(word, 't')) {
-    list = list->next;
-    if (list == 0) {
-      sh_needarg("mpi_send");
-      return EX_USAGE;
-    }
-    word = list->word->word;
-    if (!legal_number(word, &tag)) {
-      sh_neednumarg("-t");
-      return EX_USAGE;
+  /* Parse any options provided. */
+  mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "c:t:")) != -1) {
+    switch (opt) {
+      case 'c':
+        if (!mpibash_parse_comm(list_optarg, &comm))
+          return (EX_USAGE);
+        break;
+
+      case 't':
+        if (!legal_number(list_optarg, &tag)) {
+          sh_neednumarg("-t");
+          return (EX_USAGE);
+        }
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
     }
-    list = list->next;
-  }
-  else if (*word == '-') {
-    sh_invalidopt(word);
-    builtin_usage();
-    return EX_USAGE;
   }
+  list = loptend;
 
   /* Parse the target rank, which must be a number. */
   YES_ARGS(list);
   word = list->word->word;
   if (!legal_number(word, &target_rank)) {
-    builtin_error(_("mpi_send: numeric rank required"));
+    builtin_error(_("mpi_isend: numeric rank required"));
     return EX_USAGE;
   }
   list = list->next;
 
-  /* Parse the message to send. */
+  /* Parse the message to send and the variable to receive the
+   * request handle. */
   YES_ARGS(list);
   message = list->word->word;
   list = list->next;
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
   no_args(list);
 
-  /* Send the message. */
-  MPI_TRY(MPI_Send(message, strlen(message) + 1, MPI_BYTE, (int)target_rank,
-                   (int)tag, MPI_COMM_WORLD));
+  /* Initiate the send.  The request keeps its own copy of the message
+   * until the send completes. */
+  handle = mpibash_alloc_request();
+  req = mpibash_get_request(handle);
+  req->buffer = strdup(message);
+  req->count = strlen(message) + 1;
+  req->comm = comm.comm;
+  req->peer = (int) target_rank;
+  req->tag = (int) tag;
+  mpierr = start_send(req->buffer, req->count, req->peer, req->tag, req->comm,
+                      &req->request);
+  if (mpierr != MPI_SUCCESS) {
+    mpibash_release_request(handle);
+    return mpibash_report_mpi_error(mpierr);
+  }
+  mpibash_bind_variable_number(varname, handle, 0);
   return EXECUTION_SUCCESS;
 }
 
-/* Define the documentation for the mpi_send builtin. */
-static char *mpi_send_doc[] = {
-  "Send a message to a remote process in the same MPI job.",
+/* Define the documentation for the mpi_isend builtin. */
+static char *mpi_isend_doc[] = {
+  "Initiate sending a message to a remote process in the same MPI job.",
   "",
   "Options:",
   "  -t TAG        Send the message using tag TAG (default: 0).  TAG must",
   "                be a nonnegative integer.",
   "",
+  "  -c COMM       Send within communicator COMM (default: all processes).",
+  "                RANK is then a rank within COMM.",
+  "",
   "Arguments:",
   "  RANK          Whom to send the message to.  RANK must be an integer in",
   "                the range [0, $(mpi_comm_size)-1].",
   "",
   "  MESSAGE       String to send to rank RANK.",
   "",
+  "  NAME          Scalar variable in which to receive a request handle.",
+  "",
+  "mpi_isend returns immediately.  Pass the request handle to mpi_wait,",
+  "mpi_test, mpi_waitany, or mpi_waitall to complete the send.",
+  "",
   "Exit Status:",
   "Returns 0 unless an invalid option is given or an error occurs.",
   NULL
 };
 
-/* Describe the mpi_send builtin. */
-DEFINE_BUILTIN(mpi_send, "mpi_send [-t tag] rank message");
+/* Describe the mpi_isend builtin. */
+DEFINE_BUILTIN(mpi_isend, "mpi_isend [-c comm] [-t tag] rank message name");
 
-/* Receive a message from another MPI rank. */
+/* Match a message for a deferred nonblocking receive and, if one is
+ * found, start receiving it into a buffer of exactly the right size. */
 static int
-mpi_recv_builtin (WORD_LIST *list)
+post_irecv (mpibash_request_t *req, int block)
+{
+  pending_msg_t *msg;           /* Previously received message */
+  MPI_Message mpimsg;           /* Matched message */
+  MPI_Status status;            /* Status of the matched message */
+  int flag = 1;                 /* 1=a message was matched */
+  int mpierr;
+
+  /* Pending and eager messages are already in memory, so matching one
+   * completes the request immediately. */
+  if (eager.enabled && req->comm == eager.comm) {
+    mpierr = receive_message(req->peer, req->tag, req->comm, block,
+                             &req->buffer, &req->count, &req->status);
+    if (mpierr == MPI_SUCCESS && req->buffer != NULL)
+      req->state = MPIBASH_REQ_DONE;
+    return mpierr;
+  }
+  msg = take_pending(req->peer, req->tag, req->comm);
+  if (msg != NULL) {
+    req->buffer = msg->buffer;
+    req->count = msg->count;
+    req->status.MPI_SOURCE = msg->source;
+    req->status.MPI_TAG = msg->tag;
+    req->state = MPIBASH_REQ_DONE;
+    free(msg);
+    mpibash_stats_bytes(req->comm, req->status.MPI_SOURCE, req->count);
+    return MPI_SUCCESS;
+  }
+
+  /* Otherwise, match a message and start receiving it. */
+  if (block)
+    MPI_TIMED(mpierr, MPI_Mprobe(req->peer, req->tag, req->comm, &mpimsg, &status));
+  else
+    mpierr = MPI_Improbe(req->peer, req->tag, req->comm, &flag, &mpimsg, &status);
+  if (mpierr != MPI_SUCCESS || !flag)
+    return mpierr;
+  mpierr = MPI_Get_count(&status, MPI_BYTE, &req->count);
+  if (mpierr != MPI_SUCCESS)
+    return mpierr;
+  req->buffer = malloc(req->count + 1);
+  req->buffer[req->count] = '\0';
+  req->state = MPIBASH_REQ_ACTIVE;
+  mpibash_stats_bytes(req->comm, status.MPI_SOURCE, req->count);
+  return MPI_Imrecv(req->buffer, req->count, MPI_BYTE, &mpimsg, &req->request);
+}
+
+/* Bind a message received by a nonblocking receive to an array
+ * variable. */
+static int
+complete_irecv (mpibash_request_t *req)
+{
+  unbatch_message(req->comm, req->status.MPI_SOURCE, req->status.MPI_TAG, 1,
+                  &req->buffer, &req->count);
+  return deliver_message(req->buffer, req->count, &req->status, req->comm,
+                         -1, req->varname);
+}
+
+/* Initiate receiving a message from another MPI rank. */
+static int
+mpi_irecv_builtin (WORD_LIST *list)
 {
   char *word;                   /* One argument */
   intmax_t source_rank;         /* MPI source rank */
-  MPI_Status status;            /* Status of an MPI operation */
-  int count;                    /* Message length in bytes */
   intmax_t tag = 0;             /* Message tag to use */
-  char *varname;                /* Name of the variable to bind the results to */
-  static char *message = NULL;  /* Message received from MPI */
-  static size_t alloced = 0;    /* Number of bytes allocated for the above */
+  char *varname;                /* Name of the variable to bind the message to */
+  char *reqname;                /* Name of the variable to bind the handle to */
+  mpibash_request_t *req;       /* Nonblocking request */
+  int handle;                   /* Handle corresponding to the above */
+  mpibash_comm_t comm;          /* Communicator to receive on */
   int opt;                      /* Parsed option */
+  int mpierr;
 
   /* Parse any options provided. */
+  mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
   reset_internal_getopt();
-  while ((opt = internal_getopt(list, "t:")) != -1) {
+  while ((opt = internal_getopt(list, "c:t:")) != -1) {
     switch (opt) {
+      case 'c':
+        if (!mpibash_parse_comm(list_optarg, &comm))
+          return (EX_USAGE);
+        break;
+
       case 't':
         if (!strcmp(list_optarg, "any"))
           tag = MPI_ANY_TAG;
@@ -121,56 +1779,213 @@ mpi_recv_builtin (WORD_LIST *list)
     if (!strcmp(word, "any"))
       source_rank = MPI_ANY_SOURCE;
     else {
-      builtin_error(_("mpi_recv: numeric rank or \"any\" required"));
+      builtin_error(_("mpi_irecv: numeric rank or \"any\" required"));
       return (EX_USAGE);
     }
   }
   list = list->next;
 
-  /* Parse the target variable, which must not be read-only. */
+  /* Parse the message and request-handle variables, neither of which
+   * may be read-only. */
   YES_ARGS(list);
   varname = list->word->word;
   REQUIRE_WRITABLE(varname);
   list = list->next;
+  YES_ARGS(list);
+  reqname = list->word->word;
+  REQUIRE_WRITABLE(reqname);
+  list = list->next;
   no_args(list);
 
-  /* Receive a message.  Because we don't know long the message will
-   * be, we first probe to get the length. */
-  MPI_TRY(MPI_Probe((int) source_rank, (int) tag, MPI_COMM_WORLD, &status));
-  MPI_TRY(MPI_Get_count(&status, MPI_BYTE, &count));
-  if (alloced < (size_t)count) {
-    message = realloc(message, count);
-    alloced = count;
-  }
-  MPI_TRY(MPI_Recv(message, count, MPI_BYTE, status.MPI_SOURCE, status.MPI_TAG,
-                   MPI_COMM_WORLD, &status));
-  bind_array_variable(varname, 0, message, 0);
-  mpibash_bind_array_variable_number(varname, 1, status.MPI_SOURCE, 0);
-  mpibash_bind_array_variable_number(varname, 2, status.MPI_TAG, 0);
+  /* Because we don't know how long the message will be, we defer
+   * posting the receive until a matching message arrives.  Try
+   * matching one right away. */
+  handle = mpibash_alloc_request();
+  req = mpibash_get_request(handle);
+  req->state = MPIBASH_REQ_DEFERRED;
+  req->comm = comm.comm;
+  req->peer = (int) source_rank;
+  req->tag = (int) tag;
+  req->varname = strdup(varname);
+  req->post = post_irecv;
+  req->complete = complete_irecv;
+  mpierr = post_irecv(req, 0);
+  if (mpierr != MPI_SUCCESS) {
+    mpibash_release_request(handle);
+    return mpibash_report_mpi_error(mpierr);
+  }
+  mpibash_bind_variable_number(reqname, handle, 0);
   return EXECUTION_SUCCESS;
 }
 
-/* Define the documentation for the mpi_recv builtin. */
-static char *mpi_recv_doc[] = {
-  "Receive a message from a remote process in the same MPI job.",
+/* Define the documentation for the mpi_irecv builtin. */
+static char *mpi_irecv_doc[] = {
+  "Initiate receiving a message from a remote process in the same MPI job.",
   "",
   "Options:",
   "  -t TAG        Receive only messages sent using tag TAG (default: 0).",
   "                TAG must be either a nonnegative integer or the string",
   "                \"any\" to receive messages sent using any tag.",
   "",
+  "  -c COMM       Receive within communicator COMM (default: all",
+  "                processes).  RANK is then a rank within COMM.",
+  "",
   "Arguments:",
   "  RANK          Receive only messages sent from sender RANK.  RANK",
   "                must either be in the range [0, $(mpi_comm_size)-1] or",
   "                be the string \"any\" to receive messages from any sender.",
   "",
   "  NAME          Array variable in which to receive the message, sender",
-  "                rank, and tag.",
+  "                rank, and tag once the receive completes.",
+  "",
+  "  REQUEST       Scalar variable in which to receive a request handle.",
+  "",
+  "mpi_irecv returns immediately.  Pass the request handle to mpi_wait,",
+  "mpi_test, mpi_waitany, or mpi_waitall to complete the receive.  A",
+  "message is matched to the receive no later than the first of those",
+  "calls that names the receive's handle.",
   "",
   "Exit Status:",
   "Returns 0 unless an invalid option is given or an error occurs.",
   NULL
 };
 
-/* Describe the mpi_recv builtin. */
-DEFINE_BUILTIN(mpi_recv, "mpi_recv [-t tag] rank name");
+/* Describe the mpi_irecv builtin. */
+DEFINE_BUILTIN(mpi_irecv, "mpi_irecv [-c comm] [-t tag] rank name request");
+
+/* Turn on eager mode: duplicate the communicator and pre-post a ring
+ * of receives. */
+static int
+enable_eager (int nslots, int slot_size)
+{
+  int i;
+
+  eager.comm = MPI_COMM_WORLD;
+  MPI_TRY(MPI_Comm_dup(eager.comm, &eager.short_comm));
+  MPI_TRY(MPI_Comm_dup(eager.comm, &eager.long_comm));
+  eager.nslots = nslots;
+  eager.slot_size = slot_size;
+  eager.slots = malloc((size_t)nslots*slot_size);
+  eager.requests = malloc(nslots*sizeof(MPI_Request));
+  eager.sent = calloc(mpibash_num_ranks, sizeof(long));
+  eager.received = 0;
+  eager.head = 0;
+  for (i = 0; i < nslots; i++)
+    MPI_TRY(MPI_Irecv(eager.slots + i*slot_size, slot_size, MPI_BYTE,
+                      MPI_ANY_SOURCE, MPI_ANY_TAG, eager.short_comm,
+                      &eager.requests[i]));
+  eager.enabled = 1;
+  return EXECUTION_SUCCESS;
+}
+
+/* Turn off eager mode.  Messages still in flight are first drained
+ * into the pending list so that later receives can match them. */
+static int
+disable_eager (void)
+{
+  long expected;                /* Number of eager messages sent to us */
+  int progressed;
+  int i;
+
+  MPI_TRY(MPI_Reduce_scatter_block(eager.sent, &expected, 1, MPI_LONG,
+                                   MPI_SUM, eager.comm));
+  while (eager.received < expected)
+    MPI_TRY(eager_progress(1, &progressed));
+  for (i = 0; i < eager.nslots; i++) {
+    MPI_TRY(MPI_Cancel(&eager.requests[i]));
+    MPI_TRY(MPI_Wait(&eager.requests[i], MPI_STATUS_IGNORE));
+  }
+  eager.enabled = 0;
+  MPI_TRY(MPI_Comm_free(&eager.short_comm));
+  MPI_TRY(MPI_Comm_free(&eager.long_comm));
+  free(eager.slots);
+  free(eager.requests);
+  free(eager.sent);
+  return EXECUTION_SUCCESS;
+}
+
+/* Enable or disable a ring of pre-posted receives for short messages. */
+static int
+mpi_eager_builtin (WORD_LIST *list)
+{
+  char *word;                   /* One argument */
+  intmax_t nslots = 16;         /* Number of pre-posted receives */
+  intmax_t slot_size = 1024;    /* Largest message that can be received eagerly */
+  int opt;                      /* Parsed option */
+
+  /* Parse any options provided. */
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "n:s:")) != -1) {
+    switch (opt) {
+      case 'n':
+        if (!legal_number(list_optarg, &nslots) || nslots < 1) {
+          builtin_error(_("-n: positive number required"));
+          return (EX_USAGE);
+        }
+        break;
+
+      case 's':
+        if (!legal_number(list_optarg, &slot_size) || slot_size < 16 || slot_size > INT_MAX) {
+          builtin_error(_("-s: number no smaller than 16 required"));
+          return (EX_USAGE);
+        }
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+
+  /* Parse the new state, "on" or "off". */
+  YES_ARGS(list);
+  word = list->word->word;
+  list = list->next;
+  no_args(list);
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  if (!strcmp(word, "on")) {
+    if (eager.enabled) {
+      builtin_error(_("eager mode is already on"));
+      return EXECUTION_FAILURE;
+    }
+    return enable_eager((int) nslots, (int) slot_size);
+  }
+  if (!strcmp(word, "off")) {
+    if (!eager.enabled)
+      return EXECUTION_SUCCESS;
+    return disable_eager();
+  }
+  builtin_error(_("%s: \"on\" or \"off\" required"), word);
+  return EX_USAGE;
+}
+
+/* Define the documentation for the mpi_eager builtin. */
+static char *mpi_eager_doc[] = {
+  "Enable or disable pre-posted receives for short messages.",
+  "",
+  "Options:",
+  "  -n COUNT      Keep COUNT receives posted at all times (default: 16).",
+  "",
+  "  -s BYTES      Receive messages of up to BYTES bytes (default: 1024)",
+  "                directly into a pre-posted buffer.",
+  "",
+  "Arguments:",
+  "  on|off        Whether eager mode should be enabled or disabled.",
+  "",
+  "In eager mode, mpi_send, mpi_isend, mpi_recv, and mpi_irecv exchange",
+  "short messages through a ring of receives that were posted in",
+  "advance, so a short message is matched exactly once, as soon as it",
+  "arrives.  Longer messages are preceded by a short header.  All",
+  "processes in the MPI job must call mpi_eager together and with the",
+  "same arguments.  Messages in flight when eager mode is turned off",
+  "remain available to subsequent receives.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_eager builtin. */
+DEFINE_BUILTIN(mpi_eager, "mpi_eager [-n count] [-s bytes] on|off");
@@ -0,0 +1,547 @@
+/*******************************************
+ * MPI-Bash nonblocking-request completion *
+ *                                         *
+ * By Scott Pakin <pakin@lanl.gov>         *
+ *******************************************/
+
+#include "mpibash.h"
+#include <time.h>
+
+static mpibash_request_t *request_table = NULL;   /* All nonblocking requests, indexed by handle */
+static int request_table_size = 0;      /* Number of entries allocated in the above */
+
+/* Let a background thread advance requests while the shell is busy
+ * elsewhere (e.g., running an external command).  The thread touches
+ * the request table only while holding progress_lock, which every
+ * builtin holds for its duration (see mpibash_builtin_lock). */
+static pthread_t progress_thread;       /* Thread that drives progress */
+static int progress_running = 0;        /* 1=progress_thread was started */
+static pthread_mutex_t progress_lock;   /* Excludes builtins and progress_thread from each other */
+static pthread_mutex_t progress_sleep_lock = PTHREAD_MUTEX_INITIALIZER;  /* Protects progress_stop */
+static pthread_cond_t progress_wakeup = PTHREAD_COND_INITIALIZER;   /* Signaled to stop the thread */
+static int progress_stop = 0;           /* 1=progress_thread should exit */
+static int progress_atfork_set = 0;     /* 1=fork handlers are registered */
+
+/* Allocate an entry in the request table and return its handle. */
+int
+mpibash_alloc_request (void)
+{
+  mpibash_request_t *req;
+  int handle;
+
+  /* Reuse a free entry if possible.  Otherwise, grow the table. */
+  for (handle = 0; handle < request_table_size; handle++)
+    if (!request_table[handle].in_use)
+      break;
+  if (handle == request_table_size) {
+    int newsize = request_table_size == 0 ? 16 : request_table_size*2;
+
+    request_table = realloc(request_table, newsize*sizeof(mpibash_request_t));
+    memset(&request_table[request_table_size], 0,
+           (newsize - request_table_size)*sizeof(mpibash_request_t));
+    request_table_size = newsize;
+  }
+
+  /* Initialize the entry. */
+  req = &request_table[handle];
+  memset(req, 0, sizeof(mpibash_request_t));
+  req->in_use = 1;
+  req->state = MPIBASH_REQ_ACTIVE;
+  req->request = MPI_REQUEST_NULL;
+  req->op = MPI_OP_NULL;
+  return handle;
+}
+
+/* Map a handle to a request.  The pointer is valid only until the
+ * next call to mpibash_alloc_request. */
+mpibash_request_t *
+mpibash_get_request (int handle)
+{
+  return &request_table[handle];
+}
+
+/* Release a request's resources and return its handle to the free
+ * pool. */
+void
+mpibash_release_request (int handle)
+{
+  mpibash_request_t *req = &request_table[handle];
+
+  free(req->buffer);
+  free(req->varname);
+  req->in_use = 0;
+}
+
+/* Return the number of outstanding requests on a given communicator. */
+int
+mpibash_count_requests (MPI_Comm comm)
+{
+  int nreqs = 0;                /* Number of requests found */
+  int handle;
+
+  for (handle = 0; handle < request_table_size; handle++)
+    if (request_table[handle].in_use && request_table[handle].comm == comm)
+      nreqs++;
+  return nreqs;
+}
+
+/* Parse a request handle.  Return 1 on success, 0 on failure. */
+static int
+parse_handle (char *word, int *handle)
+{
+  intmax_t n;
+
+  if (!legal_number(word, &n) || n < 0 || n >= request_table_size
+      || !request_table[n].in_use) {
+    builtin_error(_("%s: invalid request handle"), word);
+    return 0;
+  }
+  *handle = (int) n;
+  return 1;
+}
+
+/* Parse a list of request handles into a newly allocated array.
+ * Return the number of handles or -1 on error. */
+static int
+parse_handle_list (WORD_LIST *list, int **handles)
+{
+  int nhandles = 0;
+  int i;
+
+  *handles = malloc(list_length((GENERIC_LIST *)list)*sizeof(int));
+  for (; list; list = list->next) {
+    if (!parse_handle(list->word->word, &(*handles)[nhandles])) {
+      free(*handles);
+      return -1;
+    }
+    for (i = 0; i < nhandles; i++)
+      if ((*handles)[i] == (*handles)[nhandles]) {
+        builtin_error(_("%s: request handle specified more than once"),
+                      list->word->word);
+        free(*handles);
+        return -1;
+      }
+    nhandles++;
+  }
+  return nhandles;
+}
+
+/* Bind the results of a completed request and release its handle. */
+static int
+finish_request (int handle)
+{
+  mpibash_request_t *req = &request_table[handle];
+  int result = EXECUTION_SUCCESS;
+
+  if (req->complete != NULL)
+    result = req->complete(req);
+  mpibash_release_request(handle);
+  return result;
+}
+
+/* Try to advance a request from deferred to active to done.  If BLOCK
+ * is 1, wait for the request to finish.  Set *DONE to 1 if the request
+ * finished (and its handle was released) or 0 otherwise. */
+static int
+progress_request (int handle, int block, int *done)
+{
+  mpibash_request_t *req = &request_table[handle];
+  int flag;
+
+  *done = 0;
+  if (block && mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  if (req->state == MPIBASH_REQ_DEFERRED)
+    MPI_TRY(req->post(req, block));
+  if (req->state == MPIBASH_REQ_ACTIVE) {
+    if (block) {
+      MPI_TRY(MPI_Wait(&req->request, &req->status));
+      req->state = MPIBASH_REQ_DONE;
+    }
+    else {
+      MPI_TRY(MPI_Test(&req->request, &flag, &req->status));
+      if (flag)
+        req->state = MPIBASH_REQ_DONE;
+    }
+  }
+  if (req->state != MPIBASH_REQ_DONE)
+    return EXECUTION_SUCCESS;
+  *done = 1;
+  return finish_request(handle);
+}
+
+/* Wait for any one of a set of requests to finish.  Store the index
+ * into HANDLES of the request that finished in *WHICH. */
+static int
+wait_for_any (int *handles, int nhandles, int *which)
+{
+  static MPI_Request *mpireqs = NULL;   /* Active MPI requests */
+  static int *active = NULL;    /* Index into HANDLES of each of the above */
+  static int alloced = 0;       /* Number of entries allocated for the above */
+  int nactive;                  /* Number of active requests */
+  int ndeferred;                /* Number of requests still awaiting posting */
+  MPI_Status status;            /* Status of the request that finished */
+  int flag;                     /* 1=a request finished */
+  struct timespec backoff = {0, MPIBASH_POLL_INTERVAL*1000L};  /* Delay between polls */
+  int i;
+
+  if (alloced < nhandles) {
+    mpireqs = realloc(mpireqs, nhandles*sizeof(MPI_Request));
+    active = realloc(active, nhandles*sizeof(int));
+    alloced = nhandles;
+  }
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  while (1) {
+    /* Give each deferred request a chance to post, and return
+     * immediately if any request has already finished. */
+    nactive = ndeferred = 0;
+    for (i = 0; i < nhandles; i++) {
+      mpibash_request_t *req = &request_table[handles[i]];
+
+      if (req->state == MPIBASH_REQ_DEFERRED)
+        MPI_TRY(req->post(req, nhandles == 1));
+      switch (req->state) {
+        case MPIBASH_REQ_DEFERRED:
+          ndeferred++;
+          break;
+
+        case MPIBASH_REQ_ACTIVE:
+          mpireqs[nactive] = req->request;
+          active[nactive++] = i;
+          break;
+
+        case MPIBASH_REQ_DONE:
+          *which = i;
+          return finish_request(handles[i]);
+      }
+    }
+
+    /* Block if nothing remains deferred.  Otherwise, poll so that
+     * deferred requests get another chance to post, backing off
+     * briefly between polls rather than spinning. */
+    if (ndeferred == 0) {
+      MPI_TRY(MPI_Waitany(nactive, mpireqs, &i, &status));
+      flag = 1;
+    }
+    else if (nactive > 0)
+      MPI_TRY(MPI_Testany(nactive, mpireqs, &i, &flag, &status));
+    else
+      flag = 0;
+    if (!flag || i == MPI_UNDEFINED) {
+      nanosleep(&backoff, NULL);
+      continue;
+    }
+    *which = active[i];
+    request_table[handles[*which]].request = mpireqs[i];
+    request_table[handles[*which]].status = status;
+    request_table[handles[*which]].state = MPIBASH_REQ_DONE;
+    return finish_request(handles[*which]);
+  }
+}
+
+/* Periodically post deferred requests and test active ones until
+ * asked to stop.  Skip any round in which a builtin is running; the
+ * builtin makes progress on its own.  Errors are left for the main
+ * thread to encounter when it next progresses the same request. */
+static void *
+progress_loop (void *arg)
+{
+  mpibash_request_t *req;       /* One request to advance */
+  struct timespec deadline;     /* Time at which to poll again */
+  int handle;                   /* Handle corresponding to req */
+  int flag;                     /* 1=request finished */
+
+  (void) arg;
+  pthread_mutex_lock(&progress_sleep_lock);
+  while (!progress_stop) {
+    /* Advance every outstanding request. */
+    if (pthread_mutex_trylock(&progress_lock) == 0) {
+      for (handle = 0; handle < request_table_size; handle++) {
+        req = &request_table[handle];
+        if (!req->in_use)
+          continue;
+        if (req->state == MPIBASH_REQ_DEFERRED && req->post(req, 0) != MPI_SUCCESS)
+          continue;
+        if (req->state == MPIBASH_REQ_ACTIVE
+            && MPI_Test(&req->request, &flag, &req->status) == MPI_SUCCESS
+            && flag)
+          req->state = MPIBASH_REQ_DONE;
+      }
+      pthread_mutex_unlock(&progress_lock);
+    }
+
+    /* Sleep until the next poll or until we're told to stop. */
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += MPIBASH_PROGRESS_INTERVAL*1000L;
+    deadline.tv_sec += deadline.tv_nsec/1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(&progress_wakeup, &progress_sleep_lock, &deadline);
+  }
+  pthread_mutex_unlock(&progress_sleep_lock);
+  return NULL;
+}
+
+/* Keep progress_thread from holding progress_lock across a fork.
+ * Otherwise, the child, which lacks the thread, would inherit a lock
+ * that no one can release. */
+static void
+progress_prepare_fork (void)
+{
+  if (progress_running)
+    pthread_mutex_lock(&progress_lock);
+}
+
+/* Release the lock taken by progress_prepare_fork in the parent. */
+static void
+progress_parent_fork (void)
+{
+  if (progress_running)
+    pthread_mutex_unlock(&progress_lock);
+}
+
+/* Release the lock taken by progress_prepare_fork in the child, which
+ * has no progress thread to exclude or stop. */
+static void
+progress_child_fork (void)
+{
+  if (progress_running) {
+    pthread_mutex_unlock(&progress_lock);
+    mpibash_builtin_lock = NULL;
+    progress_running = 0;
+  }
+}
+
+/* Start a thread that advances nonblocking requests in the
+ * background.  MPI must provide MPI_THREAD_SERIALIZED. */
+int
+mpibash_start_progress (void)
+{
+  pthread_mutexattr_t attr;     /* Attributes for progress_lock */
+  int err;
+
+  if (progress_running)
+    return EXECUTION_SUCCESS;
+
+  /* Builtins can nest (e.g., within Circle-Bash callbacks), so the
+   * lock must be recursive. */
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&progress_lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+  if (!progress_atfork_set) {
+    err = pthread_atfork(progress_prepare_fork, progress_parent_fork,
+                         progress_child_fork);
+    if (err != 0) {
+      builtin_error(_("failed to register fork handlers (%s)"), strerror(err));
+      return EXECUTION_FAILURE;
+    }
+    progress_atfork_set = 1;
+  }
+  progress_stop = 0;
+  err = pthread_create(&progress_thread, NULL, progress_loop, NULL);
+  if (err != 0) {
+    builtin_error(_("failed to start the progress thread (%s)"), strerror(err));
+    return EXECUTION_FAILURE;
+  }
+  progress_running = 1;
+  mpibash_builtin_lock = &progress_lock;
+  return EXECUTION_SUCCESS;
+}
+
+/* Stop the progress thread, if any, and wait for it to exit. */
+void
+mpibash_stop_progress (void)
+{
+  if (!progress_running)
+    return;
+  mpibash_builtin_lock = NULL;
+  pthread_mutex_lock(&progress_sleep_lock);
+  progress_stop = 1;
+  pthread_cond_signal(&progress_wakeup);
+  pthread_mutex_unlock(&progress_sleep_lock);
+  pthread_join(progress_thread, NULL);
+  progress_running = 0;
+}
+
+/* Wait for a nonblocking operation to complete. */
+static int
+mpi_wait_builtin (WORD_LIST *list)
+{
+  int handle;                   /* Request handle */
+  int done;                     /* 1=request finished */
+
+  YES_ARGS(list);
+  if (!parse_handle(list->word->word, &handle))
+    return EX_USAGE;
+  list = list->next;
+  no_args(list);
+  return progress_request(handle, 1, &done);
+}
+
+/* Define the documentation for the mpi_wait builtin. */
+static char *mpi_wait_doc[] = {
+  "Wait for a nonblocking operation to complete.",
+  "",
+  "Arguments:",
+  "  REQUEST       Request handle returned by a nonblocking operation",
+  "                such as mpi_isend or mpi_irecv.",
+  "",
+  "If the operation was a receive, the message, sender rank, and tag are",
+  "bound to the array variable that was named when the operation was",
+  "initiated, exactly as with mpi_recv.  REQUEST is invalid once mpi_wait",
+  "returns.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid request is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_wait builtin. */
+DEFINE_BUILTIN(mpi_wait, "mpi_wait request");
+
+/* Test if a nonblocking operation has completed. */
+static int
+mpi_test_builtin (WORD_LIST *list)
+{
+  int handle;                   /* Request handle */
+  char *varname;                /* Name of the variable to bind the results to */
+  int done;                     /* 1=request finished */
+  int result;
+
+  /* Parse the request handle and the target variable. */
+  YES_ARGS(list);
+  if (!parse_handle(list->word->word, &handle))
+    return EX_USAGE;
+  list = list->next;
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  no_args(list);
+
+  /* Test the request and report whether it finished. */
+  result = progress_request(handle, 0, &done);
+  mpibash_bind_variable_number(varname, done, 0);
+  return result;
+}
+
+/* Define the documentation for the mpi_test builtin. */
+static char *mpi_test_doc[] = {
+  "Test if a nonblocking operation has completed.",
+  "",
+  "Arguments:",
+  "  REQUEST       Request handle returned by a nonblocking operation",
+  "                such as mpi_isend or mpi_irecv.",
+  "",
+  "  NAME          Scalar variable in which to receive 1 if the operation",
+  "                completed or 0 if not.",
+  "",
+  "If the operation completed, its results are bound as with mpi_wait",
+  "and REQUEST becomes invalid.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid request is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_test builtin. */
+DEFINE_BUILTIN(mpi_test, "mpi_test request name");
+
+/* Wait for any of a set of nonblocking operations to complete. */
+static int
+mpi_waitany_builtin (WORD_LIST *list)
+{
+  char *varname;                /* Name of the variable to bind the results to */
+  int *handles;                 /* List of request handles */
+  int nhandles;                 /* Number of entries in the above */
+  int which;                    /* Index into handles of the finished request */
+  int result;
+
+  /* Parse the target variable and the request handles. */
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  YES_ARGS(list);
+  nhandles = parse_handle_list(list, &handles);
+  if (nhandles == -1)
+    return EX_USAGE;
+
+  /* Wait for one of the requests and report which one finished. */
+  which = -1;
+  result = wait_for_any(handles, nhandles, &which);
+  if (which != -1)
+    mpibash_bind_variable_number(varname, handles[which], 0);
+  free(handles);
+  return result;
+}
+
+/* Define the documentation for the mpi_waitany builtin. */
+static char *mpi_waitany_doc[] = {
+  "Wait for any of a set of nonblocking operations to complete.",
+  "",
+  "Arguments:",
+  "  NAME          Scalar variable in which to receive the handle of the",
+  "                request that completed.",
+  "",
+  "  REQUEST       Request handle returned by a nonblocking operation",
+  "                such as mpi_isend or mpi_irecv.",
+  "",
+  "The results of the completed operation are bound as with mpi_wait.",
+  "The remaining requests are left outstanding.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid request is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_waitany builtin. */
+DEFINE_BUILTIN(mpi_waitany, "mpi_waitany name request...");
+
+/* Wait for all of a set of nonblocking operations to complete. */
+static int
+mpi_waitall_builtin (WORD_LIST *list)
+{
+  int *handles;                 /* List of request handles */
+  int nhandles;                 /* Number of entries in the above */
+  int which;                    /* Index into handles of a finished request */
+  int result = EXECUTION_SUCCESS;
+
+  /* Parse the request handles. */
+  YES_ARGS(list);
+  nhandles = parse_handle_list(list, &handles);
+  if (nhandles == -1)
+    return EX_USAGE;
+
+  /* Repeatedly wait for any remaining request so that all of them
+   * make progress concurrently. */
+  while (nhandles > 0) {
+    which = -1;
+    if (wait_for_any(handles, nhandles, &which) != EXECUTION_SUCCESS)
+      result = EXECUTION_FAILURE;
+    if (which == -1)
+      break;
+    handles[which] = handles[--nhandles];
+  }
+  free(handles);
+  return result;
+}
+
+/* Define the documentation for the mpi_waitall builtin. */
+static char *mpi_waitall_doc[] = {
+  "Wait for all of a set of nonblocking operations to complete.",
+  "",
+  "Arguments:",
+  "  REQUEST       Request handle returned by a nonblocking operation",
+  "                such as mpi_isend or mpi_irecv.",
+  "",
+  "The results of each completed operation are bound as with mpi_wait.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid request is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_waitall builtin. */
+DEFINE_BUILTIN(mpi_waitall, "mpi_waitall request...");
@@ -0,0 +1,592 @@
+/*************************************
+ * MPI-Bash distributed sorting      *
+ *                                   *
+ * By Scott Pakin <pakin@lanl.gov>   *
+ *************************************/
+
+#include "mpibash.h"
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Describe a set of NUL-terminated records stored in a single buffer. */
+typedef struct {
+  char *data;                   /* Records, one after another */
+  char **recs;                  /* Pointer to each record in the above */
+  long nrecs;                   /* Number of entries in the above */
+} record_set_t;
+
+static int sort_reverse = 0;    /* 1=sort in descending order */
+static int sort_numeric = 0;    /* 1=compare leading numbers first */
+
+/* Compare two records according to sort_reverse and sort_numeric. */
+static int
+compare_strings (const char *a, const char *b)
+{
+  int cmp;
+
+  if (sort_numeric) {
+    double x = strtod(a, NULL);
+    double y = strtod(b, NULL);
+
+    cmp = x < y ? -1 : x > y;
+    if (cmp == 0)
+      cmp = strcmp(a, b);
+  }
+  else
+    cmp = strcmp(a, b);
+  return sort_reverse ? -cmp : cmp;
+}
+
+/* Compare two pointers to records (qsort callback). */
+static int
+compare_records (const void *a, const void *b)
+{
+  return compare_strings(*(char * const *)a, *(char * const *)b);
+}
+
+/* Point RS->recs at each of the NUL-terminated records in the first
+ * LEN bytes of RS->data. */
+static void
+split_records (record_set_t *rs, size_t len)
+{
+  char *p;                      /* One record */
+  long n = 0;                   /* Number of records */
+
+  for (p = rs->data; p < rs->data + len; p += strlen(p) + 1)
+    n++;
+  rs->recs = malloc((n + 1)*sizeof(char *));
+  rs->nrecs = n;
+  for (n = 0, p = rs->data; p < rs->data + len; p += strlen(p) + 1)
+    rs->recs[n++] = p;
+}
+
+/* Free a set of records. */
+static void
+free_records (record_set_t *rs)
+{
+  free(rs->data);
+  free(rs->recs);
+  rs->data = NULL;
+  rs->recs = NULL;
+  rs->nrecs = 0;
+}
+
+/* Copy every element of indexed array NAME into RS. */
+static int
+load_array (char *name, record_set_t *rs)
+{
+  SHELL_VAR *var;               /* Array to load */
+  ARRAY *array;                 /* Contents of the above */
+  ARRAY_ELEMENT *ae;            /* One element of the above */
+  size_t total = 0;             /* Number of bytes to copy */
+  char *p;                      /* Next byte to fill in */
+
+  var = find_variable(name);
+  if (var == NULL || invisible_p(var) || !array_p(var)) {
+    builtin_error(_("%s: not an indexed array"), name);
+    return EXECUTION_FAILURE;
+  }
+  array = array_cell(var);
+  for (ae = element_forw(array_head(array)); ae != array_head(array); ae = element_forw(ae))
+    total += strlen(element_value(ae)) + 1;
+  rs->data = p = malloc(total + 1);
+  for (ae = element_forw(array_head(array)); ae != array_head(array); ae = element_forw(ae)) {
+    strcpy(p, element_value(ae));
+    p += strlen(p) + 1;
+  }
+  split_records(rs, total);
+  return EXECUTION_SUCCESS;
+}
+
+/* Load this process's share of the lines of FILENAME into RS.  The
+ * file is divided into NRANKS equal byte ranges, and a line belongs to
+ * the process whose range contains its first byte. */
+static int
+load_file (char *filename, int rank, int nranks, record_set_t *rs)
+{
+  struct stat st;               /* File size */
+  char *map;                    /* File contents */
+  off_t begin;                  /* Offset of our first line */
+  off_t end;                    /* Offset just past our last line */
+  size_t len;                   /* Number of bytes in our lines */
+  size_t i;
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    builtin_error("%s: %s", filename, strerror(errno));
+    if (fd != -1)
+      close(fd);
+    return EXECUTION_FAILURE;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    rs->data = malloc(1);
+    split_records(rs, 0);
+    return EXECUTION_SUCCESS;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    builtin_error("%s: %s", filename, strerror(errno));
+    return EXECUTION_FAILURE;
+  }
+
+  /* Find our lines and copy them, turning newlines into NULs. */
+  begin = (off_t) ((double) st.st_size * rank / nranks);
+  end = (off_t) ((double) st.st_size * (rank + 1) / nranks);
+  if (rank == nranks - 1)
+    end = st.st_size;
+  if (begin > 0) {
+    while (begin < st.st_size && map[begin - 1] != '\n')
+      begin++;
+  }
+  while (end > begin && end < st.st_size && map[end - 1] != '\n')
+    end++;
+  if (end < begin)
+    end = begin;
+  len = end - begin;
+  rs->data = malloc(len + 1);
+  memcpy(rs->data, map + begin, len);
+  munmap(map, st.st_size);
+  if (len > 0 && rs->data[len - 1] != '\n')
+    rs->data[len++] = '\0';
+  for (i = 0; i < len; i++)
+    if (rs->data[i] == '\n')
+      rs->data[i] = '\0';
+  split_records(rs, len);
+  return EXECUTION_SUCCESS;
+}
+
+/* Concatenate records FIRST through LAST-1 of RS, with their NULs,
+ * into BUFFER and return the number of bytes written. */
+static size_t
+pack_records (record_set_t *rs, long first, long last, char *buffer)
+{
+  char *p = buffer;             /* Next byte to fill in */
+  long i;
+
+  for (i = first; i < last; i++) {
+    size_t len = strlen(rs->recs[i]) + 1;
+
+    memcpy(p, rs->recs[i], len);
+    p += len;
+  }
+  return p - buffer;
+}
+
+/* Compute the displacement of each of NELTS blocks from their COUNTS.
+ * Return the total number of bytes or -1 if that exceeds an int or
+ * any count is negative. */
+static long
+sum_counts (int *counts, int *displs, int nelts)
+{
+  long total = 0;               /* Running sum of counts */
+  int i;
+
+  for (i = 0; i < nelts; i++) {
+    displs[i] = (int) total;
+    total += counts[i];
+    if (counts[i] < 0 || total > INT_MAX)
+      return -1;
+  }
+  return total;
+}
+
+/* Choose NRANKS-1 splitters by regular sampling: each process
+ * contributes NRANKS-1 evenly spaced records from its sorted RS, and
+ * every process sorts all of the samples and picks evenly spaced
+ * ones.  Store the splitters in SPLITTERS, which the caller must free
+ * with free_records. */
+static int
+choose_splitters (record_set_t *rs, mpibash_comm_t *comm, record_set_t *splitters)
+{
+  record_set_t samples;         /* All processes' samples */
+  char *mine;                   /* Our samples */
+  int nmine = 0;                /* Number of bytes in the above */
+  int *counts;                  /* Number of sample bytes from each rank */
+  int *displs;                  /* Offset of each rank's samples */
+  long total;                   /* Number of sample bytes in all */
+  size_t len;                   /* Number of bytes in the splitters */
+  long i;
+  int mpierr;
+
+  /* Gather everyone's samples.  A process whose samples don't fit in
+   * an int contributes a count of -1.  Every process then sees the
+   * same counts and therefore reaches the same decision about whether
+   * to gather the samples themselves. */
+  len = 0;
+  if (rs->nrecs > 0)
+    for (i = 1; i < comm->size; i++)
+      len += strlen(rs->recs[i*rs->nrecs/comm->size]) + 1;
+  mine = malloc(len + 1);
+  if (len > INT_MAX)
+    nmine = -1;
+  else if (rs->nrecs > 0)
+    for (i = 1; i < comm->size; i++) {
+      long which = i*rs->nrecs/comm->size;
+
+      nmine += (int) pack_records(rs, which, which + 1, mine + nmine);
+    }
+  counts = malloc(comm->size*sizeof(int));
+  displs = malloc(comm->size*sizeof(int));
+  samples.data = NULL;
+  MPI_TIMED(mpierr, MPI_Allgather(&nmine, 1, MPI_INT, counts, 1, MPI_INT, comm->comm));
+  if (mpierr == MPI_SUCCESS) {
+    total = sum_counts(counts, displs, comm->size);
+    if (total == -1)
+      mpierr = MPI_ERR_COUNT;
+    else {
+      samples.data = malloc(total + 1);
+      MPI_TIMED(mpierr, MPI_Allgatherv(mine, nmine, MPI_BYTE, samples.data, counts,
+                                       displs, MPI_BYTE, comm->comm));
+    }
+  }
+  free(mine);
+  free(counts);
+  free(displs);
+  if (mpierr != MPI_SUCCESS) {
+    free(samples.data);
+    return mpierr;
+  }
+
+  /* Sort the samples and pick the splitters. */
+  split_records(&samples, total);
+  qsort(samples.recs, samples.nrecs, sizeof(char *), compare_records);
+  len = 0;
+  if (samples.nrecs > 0)
+    for (i = 1; i < comm->size; i++)
+      len += strlen(samples.recs[i*samples.nrecs/comm->size]) + 1;
+  splitters->data = malloc(len + 1);
+  len = 0;
+  if (samples.nrecs > 0)
+    for (i = 1; i < comm->size; i++) {
+      long which = i*samples.nrecs/comm->size;
+
+      len += pack_records(&samples, which, which + 1, splitters->data + len);
+    }
+  split_records(splitters, len);
+  free_records(&samples);
+  return MPI_SUCCESS;
+}
+
+/* Redistribute the sorted records RS across COMM so that rank i holds
+ * the i-th contiguous range of the global order.  Replace RS with the
+ * records we receive, sorted. */
+static int
+exchange_records (record_set_t *rs, mpibash_comm_t *comm)
+{
+  record_set_t splitters;       /* Boundaries between ranks' ranges */
+  record_set_t received;        /* Records sent to us */
+  int *sendcounts;              /* Bytes to send to each rank */
+  int *senddispls;              /* Offset of the bytes to send to each rank */
+  int *recvcounts;              /* Bytes to receive from each rank */
+  int *recvdispls;              /* Offset of the bytes from each rank */
+  char *sendbuf;                /* Records in sorted order */
+  long total;                   /* Number of bytes in received */
+  long first;                   /* First record bound for the current rank */
+  long i;
+  int dest;                     /* Rank to which to send a record */
+  int ok = 1;                   /* 1=all processes can exchange records */
+  int mpierr;
+
+  mpierr = choose_splitters(rs, comm, &splitters);
+  if (mpierr != MPI_SUCCESS)
+    return mpierr;
+
+  /* Our records are sorted, so each rank's share is a contiguous run
+   * of them: those after the previous splitter up to and including
+   * the next.  With no splitters (no records anywhere), everything
+   * stays put. */
+  sendcounts = calloc(comm->size, sizeof(int));
+  senddispls = malloc(comm->size*sizeof(int));
+  recvcounts = malloc(comm->size*sizeof(int));
+  recvdispls = malloc(comm->size*sizeof(int));
+  sendbuf = malloc(1);
+  total = 0;
+  for (i = 0; i < rs->nrecs; i++)
+    total += strlen(rs->recs[i]) + 1;
+  if (total > INT_MAX)
+    ok = 0;
+  else {
+    sendbuf = realloc(sendbuf, total + 1);
+    total = 0;
+    for (dest = 0, first = 0; dest < comm->size; dest++) {
+      long last = first;        /* Record just past dest's run */
+
+      if (dest == comm->size - 1 || splitters.nrecs == 0)
+        last = rs->nrecs;
+      else
+        while (last < rs->nrecs
+               && compare_strings(rs->recs[last], splitters.recs[dest]) <= 0)
+          last++;
+      sendcounts[dest] = (int) pack_records(rs, first, last, sendbuf + total);
+      total += sendcounts[dest];
+      first = last;
+      if (splitters.nrecs == 0)
+        break;
+    }
+    sum_counts(sendcounts, senddispls, comm->size);
+  }
+  free_records(&splitters);
+
+  /* Exchange byte counts then, if every process can send and receive
+   * its share, the records themselves. */
+  MPI_TIMED(mpierr, MPI_Alltoall(sendcounts, 1, MPI_INT, recvcounts, 1, MPI_INT, comm->comm));
+  received.data = NULL;
+  if (mpierr == MPI_SUCCESS) {
+    total = ok ? sum_counts(recvcounts, recvdispls, comm->size) : -1;
+    ok = total != -1;
+    MPI_TIMED(mpierr, MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, comm->comm));
+  }
+  if (mpierr == MPI_SUCCESS && !ok)
+    mpierr = MPI_ERR_COUNT;
+  if (mpierr == MPI_SUCCESS) {
+    received.data = malloc(total + 1);
+    MPI_TIMED(mpierr, MPI_Alltoallv(sendbuf, sendcounts, senddispls, MPI_BYTE,
+                                    received.data, recvcounts, recvdispls, MPI_BYTE,
+                                    comm->comm));
+    mpibash_stats_bytes(comm->comm, MPI_PROC_NULL, total);
+  }
+  free(sendbuf);
+  free(sendcounts);
+  free(senddispls);
+  free(recvcounts);
+  free(recvdispls);
+  if (mpierr != MPI_SUCCESS) {
+    free(received.data);
+    return mpierr;
+  }
+
+  /* Sort what we received. */
+  free_records(rs);
+  split_records(&received, total);
+  qsort(received.recs, received.nrecs, sizeof(char *), compare_records);
+  *rs = received;
+  return MPI_SUCCESS;
+}
+
+/* Write the records in RS, one per line, to FILENAME at an offset
+ * equal to the number of bytes all lower ranks write.  Store the
+ * number of bytes we wrote in *NBYTES. */
+static int
+write_records (record_set_t *rs, char *filename, mpibash_comm_t *comm,
+               int64_t *nbytes)
+{
+  int64_t offset = 0;           /* Offset at which to write */
+  char *buffer;                 /* Lines to write */
+  char *p;                      /* Next byte to fill in */
+  int result = EXECUTION_SUCCESS;
+  int ok;                       /* 1=all processes succeeded */
+  int fd = -1;
+  long i;
+
+  /* Compute our offset. */
+  *nbytes = 0;
+  for (i = 0; i < rs->nrecs; i++)
+    *nbytes += strlen(rs->recs[i]) + 1;
+  MPI_TRY(MPI_Exscan(nbytes, &offset, 1, MPI_INT64_T, MPI_SUM, comm->comm));
+  if (comm->rank == 0)
+    offset = 0;
+
+  /* Rank 0 creates (or truncates) the file before anyone writes. */
+  if (comm->rank == 0) {
+    fd = mpibash_open_sink(filename);
+    if (fd == -1)
+      result = EXECUTION_FAILURE;
+  }
+  MPI_TRY(MPI_Bcast(&result, 1, MPI_INT, 0, comm->comm));
+  if (result != EXECUTION_SUCCESS)
+    return EXECUTION_FAILURE;
+  if (comm->rank != 0) {
+    fd = open(filename, O_WRONLY);
+    if (fd == -1) {
+      builtin_error("%s: %s", filename, strerror(errno));
+      result = EXECUTION_FAILURE;
+    }
+  }
+
+  /* Write our lines at our offset. */
+  if (fd != -1) {
+    buffer = p = malloc(*nbytes + 1);
+    for (i = 0; i < rs->nrecs; i++) {
+      size_t len = strlen(rs->recs[i]);
+
+      memcpy(p, rs->recs[i], len);
+      p[len] = '\n';
+      p += len + 1;
+    }
+    if (lseek(fd, (off_t) offset, SEEK_SET) == -1) {
+      builtin_error("%s: %s", filename, strerror(errno));
+      result = EXECUTION_FAILURE;
+    }
+    else
+      result = mpibash_write_all(fd, buffer, *nbytes);
+    free(buffer);
+    close(fd);
+  }
+
+  /* Fail everywhere if any process failed. */
+  ok = result == EXECUTION_SUCCESS;
+  MPI_TRY(MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, comm->comm));
+  return ok ? EXECUTION_SUCCESS : EXECUTION_FAILURE;
+}
+
+/* Sort records distributed across all ranks. */
+static int
+mpi_sort_builtin (WORD_LIST *list)
+{
+  mpibash_comm_t comm;          /* Communicator to sort across */
+  char *infile = NULL;          /* File whose lines should be sorted */
+  char *outfile = NULL;         /* File to which to write the sorted lines */
+  char *inname = NULL;          /* Name of the array to sort */
+  char *varname;                /* Name of the variable to bind the results to */
+  SHELL_VAR *var;               /* Variable to bind */
+  record_set_t rs;              /* Records to sort */
+  int64_t nbytes;               /* Number of bytes written to outfile */
+  int ok;                       /* 1=all processes loaded their records */
+  int result;
+  int opt;                      /* Parsed option */
+  int mpierr;
+  long i;
+
+  /* Parse any options provided. */
+  mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
+  sort_reverse = 0;
+  sort_numeric = 0;
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "c:f:no:r")) != -1) {
+    switch (opt) {
+      case 'c':
+        if (!mpibash_parse_comm(list_optarg, &comm))
+          return (EX_USAGE);
+        break;
+
+      case 'f':
+        infile = list_optarg;
+        break;
+
+      case 'n':
+        sort_numeric = 1;
+        break;
+
+      case 'o':
+        outfile = list_optarg;
+        break;
+
+      case 'r':
+        sort_reverse = 1;
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+
+  /* Parse the input array (unless sorting a file) and the target
+   * variable.  The two may be the same. */
+  YES_ARGS(list);
+  if (infile == NULL) {
+    inname = list->word->word;
+    list = list->next;
+    YES_ARGS(list);
+  }
+  varname = list->word->word;
+  var = find_shell_variable(varname);
+  if (var != NULL && readonly_p(var)) {
+    err_readonly(varname);
+    return EXECUTION_FAILURE;
+  }
+  list = list->next;
+  no_args(list);
+
+  /* Load and sort our records.  Give up everywhere if any process
+   * failed to load its records. */
+  memset(&rs, 0, sizeof(record_set_t));
+  if (infile != NULL)
+    result = load_file(infile, comm.rank, comm.size, &rs);
+  else
+    result = load_array(inname, &rs);
+  if (result == EXECUTION_SUCCESS)
+    qsort(rs.recs, rs.nrecs, sizeof(char *), compare_records);
+  if (mpibash_flush_batches() != EXECUTION_SUCCESS)
+    result = EXECUTION_FAILURE;
+  ok = result == EXECUTION_SUCCESS;
+  MPI_TIMED(mpierr, MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, comm.comm));
+  if (mpierr != MPI_SUCCESS || !ok) {
+    free_records(&rs);
+    return mpierr != MPI_SUCCESS ? mpibash_report_mpi_error(mpierr) : EXECUTION_FAILURE;
+  }
+
+  /* Redistribute the records into globally ordered ranges. */
+  mpierr = exchange_records(&rs, &comm);
+  if (mpierr != MPI_SUCCESS) {
+    free_records(&rs);
+    return mpibash_report_mpi_error(mpierr);
+  }
+
+  /* Either write the records to a file or bind them to an array. */
+  if (outfile != NULL) {
+    result = write_records(&rs, outfile, &comm, &nbytes);
+    if (result == EXECUTION_SUCCESS)
+      mpibash_bind_variable_number(varname, (long) nbytes, 0);
+  }
+  else {
+    if (var != NULL)
+      unbind_variable(varname);
+    var = make_new_array_variable(varname);
+    for (i = 0; i < rs.nrecs; i++)
+      array_insert(array_cell(var), (arrayind_t) i, rs.recs[i]);
+    result = EXECUTION_SUCCESS;
+  }
+  free_records(&rs);
+  return result;
+}
+
+/* Define the documentation for the mpi_sort builtin. */
+static char *mpi_sort_doc[] = {
+  "Sort records distributed across all processes in the MPI job.",
+  "",
+  "Options:",
+  "  -f FILE       Sort the lines of FILE instead of ARRAY.  Every process",
+  "                names the same file and reads an equal share of it.",
+  "",
+  "  -o FILE       Write all of the sorted records, one per line, to FILE",
+  "                instead of binding them to NAME.  NAME receives the",
+  "                number of bytes this process wrote.",
+  "",
+  "  -n            Compare records by their leading numbers, then as",
+  "                strings.",
+  "",
+  "  -r            Sort in descending order.",
+  "",
+  "  -c COMM       Sort only across the processes in communicator COMM.",
+  "",
+  "Arguments:",
+  "  ARRAY         Indexed array of this process's records.",
+  "",
+  "  NAME          Indexed array variable in which to receive this",
+  "                process's share of the sorted records.",
+  "",
+  "mpi_sort is a sample sort: each process sorts its records, the",
+  "processes agree on splitters from a regular sample, and one all-to-all",
+  "exchange leaves rank 0 with the lowest records, rank 1 with the next",
+  "range, and so forth, each range sorted.  Records are compared byte by",
+  "byte, as with LC_ALL=C sort.  With -o, each process writes its range",
+  "at an offset computed with an exclusive scan, so the file holds the",
+  "complete sorted output.  All processes must call mpi_sort together.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_sort builtin. */
+DEFINE_BUILTIN(mpi_sort, "mpi_sort [-c comm] [-n] [-r] [-f file] [-o file] [array] name");
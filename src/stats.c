@@ -0,0 +1,320 @@
+/*************************************
+ * MPI-Bash communication statistics *
+ *                                   *
+ * By Scott Pakin <pakin@lanl.gov>   *
+ *************************************/
+
+#include "mpibash.h"
+#include <inttypes.h>
+
+static uint64_t *peer_messages = NULL;  /* Messages exchanged with each rank of MPI_COMM_WORLD */
+static uint64_t *peer_bytes = NULL;     /* Bytes exchanged with each rank of MPI_COMM_WORLD */
+static int num_peers = 0;               /* Number of entries in each of the above */
+
+/* Return the rank in MPI_COMM_WORLD of rank PEER in COMM or -1 if PEER
+ * is not a specific rank. */
+static int
+world_rank_of (MPI_Comm comm, int peer)
+{
+  static MPI_Group world_group = MPI_GROUP_NULL;        /* Group of MPI_COMM_WORLD */
+  MPI_Group group;              /* Group of COMM */
+  int result;                   /* Rank in world_group */
+
+  if (peer < 0)
+    return -1;
+  if (comm == MPI_COMM_WORLD)
+    return peer;
+  if (world_group == MPI_GROUP_NULL)
+    MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+  if (MPI_Comm_group(comm, &group) != MPI_SUCCESS)
+    return -1;
+  if (MPI_Group_translate_ranks(group, 1, &peer, world_group, &result) != MPI_SUCCESS
+      || result == MPI_UNDEFINED)
+    result = -1;
+  MPI_Group_free(&group);
+  return result;
+}
+
+/* Charge a message of NBYTES bytes sent to or received from rank PEER
+ * of COMM to the running builtin and to that peer.  Messages belonging
+ * to collectives, which have no single peer, use a PEER of
+ * MPI_PROC_NULL. */
+void
+mpibash_stats_bytes (MPI_Comm comm, int peer, long nbytes)
+{
+  mpibash_stats_t *stats;       /* Statistics of the running builtin */
+
+  /* Charge the running builtin. */
+  stats = mpibash_stats_current();
+  if (stats != NULL) {
+    stats->messages++;
+    stats->bytes += nbytes;
+  }
+
+  /* Charge the peer. */
+  peer = world_rank_of(comm, peer);
+  if (peer == -1)
+    return;
+  if (peer_messages == NULL) {
+    MPI_Comm_size(MPI_COMM_WORLD, &num_peers);
+    peer_messages = calloc(num_peers, sizeof(uint64_t));
+    peer_bytes = calloc(num_peers, sizeof(uint64_t));
+  }
+  if (peer < num_peers) {
+    peer_messages[peer]++;
+    peer_bytes[peer] += nbytes;
+  }
+}
+
+/* Store in *ALL a newly allocated array of the statistics of every
+ * builtin used so far, including those of Circle-Bash, which lives in
+ * a separate plugin with its own list.  Return the number of
+ * entries. */
+static int
+collect_stats (mpibash_stats_t ***all)
+{
+  mpibash_stats_t *lists[2];    /* MPI-Bash's and Circle-Bash's statistics */
+  mpibash_stats_t *(*circle_list)(void) = NULL;        /* Circle-Bash's mpibash_stats_list */
+  mpibash_stats_t *stats;       /* One builtin's statistics */
+  struct builtin *circle_init;  /* Circle-Bash's circle_init builtin */
+  int nstats = 0;               /* Number of entries in *all */
+  int i;
+
+  lists[0] = mpibash_stats_list();
+  lists[1] = NULL;
+  if (builtin_address_internal != NULL) {
+    circle_init = builtin_address_internal("circle_init", 1);
+    if (circle_init != NULL && circle_init->handle != NULL)
+      circle_list = (mpibash_stats_t *(*)(void)) dlsym(circle_init->handle,
+                                                        "mpibash_stats_list");
+    if (circle_list != NULL && circle_list != mpibash_stats_list)
+      lists[1] = circle_list();
+  }
+  for (i = 0; i < 2; i++)
+    for (stats = lists[i]; stats != NULL; stats = stats->next)
+      nstats++;
+  *all = malloc((nstats + 1)*sizeof(mpibash_stats_t *));
+  nstats = 0;
+  for (i = 0; i < 2; i++)
+    for (stats = lists[i]; stats != NULL; stats = stats->next)
+      (*all)[nstats++] = stats;
+  return nstats;
+}
+
+/* Report communication statistics per builtin or per peer. */
+static int
+mpi_stats_builtin (WORD_LIST *list)
+{
+  int by_peer = 0;              /* 1=report per peer; 0=report per builtin */
+  int reset = 0;                /* 1=reset all counters afterwards */
+  char *varname = NULL;         /* Name of the variable to bind the results to */
+  SHELL_VAR *var = NULL;        /* Variable corresponding to the above */
+  mpibash_stats_t **all;        /* Statistics of every builtin */
+  int nstats;                   /* Number of entries in the above */
+  char key[32];                 /* Peer rank as a string */
+  char value[128];              /* One line of statistics */
+  int opt;                      /* Parsed option */
+  int i;
+
+  /* Parse the options and the optional target variable. */
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "pr")) != -1) {
+    switch (opt) {
+      case 'p':
+        by_peer = 1;
+        break;
+
+      case 'r':
+        reset = 1;
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+  if (list != NULL) {
+    varname = list->word->word;
+    REQUIRE_WRITABLE(varname);
+    list = list->next;
+    no_args(list);
+    var = make_new_assoc_variable(varname);
+  }
+
+  /* Report either per-peer or per-builtin statistics. */
+  nstats = collect_stats(&all);
+  if (by_peer) {
+    if (var == NULL)
+      printf("# %-8s %12s %16s\n", "Rank", "Messages", "Bytes");
+    for (i = 0; i < num_peers; i++) {
+      if (peer_messages[i] == 0)
+        continue;
+      if (var == NULL)
+        printf("%10d %12" PRIu64 " %16" PRIu64 "\n",
+               i, peer_messages[i], peer_bytes[i]);
+      else {
+        sprintf(key, "%d", i);
+        sprintf(value, "%" PRIu64 " %" PRIu64, peer_messages[i], peer_bytes[i]);
+        assoc_insert(assoc_cell(var), strdup(key), value);   /* Takes ownership of key */
+      }
+    }
+  }
+  else {
+    if (var == NULL)
+      printf("# %-20s %8s %12s %16s %12s %12s\n",
+             "Builtin", "Calls", "Messages", "Bytes", "Wall (s)", "Wait (s)");
+    for (i = 0; i < nstats; i++) {
+      if (all[i]->calls == 0)
+        continue;
+      sprintf(value, "%ld %" PRIu64 " %" PRIu64 " %.6f %.6f",
+              all[i]->calls, all[i]->messages, all[i]->bytes,
+              all[i]->wall, all[i]->wait);
+      if (var == NULL)
+        printf("%-22s %8ld %12" PRIu64 " %16" PRIu64 " %12.6f %12.6f\n",
+               all[i]->name, all[i]->calls, all[i]->messages, all[i]->bytes,
+               all[i]->wall, all[i]->wait);
+      else
+        assoc_insert(assoc_cell(var), strdup(all[i]->name), value);   /* Takes ownership of key */
+    }
+  }
+  if (var == NULL)
+    fflush(stdout);
+
+  /* Optionally start counting afresh. */
+  if (reset) {
+    for (i = 0; i < nstats; i++) {
+      all[i]->calls = 0;
+      all[i]->messages = 0;
+      all[i]->bytes = 0;
+      all[i]->wall = 0.0;
+      all[i]->wait = 0.0;
+    }
+    for (i = 0; i < num_peers; i++) {
+      peer_messages[i] = 0;
+      peer_bytes[i] = 0;
+    }
+  }
+  free(all);
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_stats builtin. */
+static char *mpi_stats_doc[] = {
+  "Report how much time and communication each MPI-Bash builtin used.",
+  "",
+  "Options:",
+  "  -p            Report the number of messages and bytes exchanged with",
+  "                each rank of the MPI job instead of per-builtin",
+  "                statistics.  Collectives are not attributed to any",
+  "                single rank.",
+  "",
+  "  -r            Reset all counters to zero after reporting them.",
+  "",
+  "Arguments:",
+  "  NAME          Associative array variable in which to receive the",
+  "                statistics instead of printing them.  Keys are",
+  "                builtin names (or, with -p, ranks), and values are",
+  "                \"CALLS MESSAGES BYTES WALL WAIT\" (or, with -p,",
+  "                \"MESSAGES BYTES\").",
+  "",
+  "For each builtin invoked so far by this process, mpi_stats reports",
+  "the number of calls, the number of point-to-point and collective",
+  "messages sent or received and their total size in bytes, the wall",
+  "time in seconds spent within the builtin, and the portion of that",
+  "time spent waiting within MPI.  Circle-Bash builtins and the shell",
+  "functions Libcircle calls back (cb_create, cb_process, etc.) are",
+  "included.  Comparing the total wall time to the script's run time",
+  "shows how much time goes to MPI-Bash versus other commands.",
+  "",
+  "If the environment variable MPIBASH_STATS is set to a non-empty",
+  "value, mpi_finalize writes a report of the minimum, average, and",
+  "maximum of each statistic across all ranks to standard error on",
+  "rank 0.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given.",
+  NULL
+};
+
+/* Describe the mpi_stats builtin. */
+DEFINE_BUILTIN(mpi_stats, "mpi_stats [-p] [-r] [name]");
+
+/* Write to standard error on rank 0 the minimum, average, and maximum
+ * across MPI_COMM_WORLD of each builtin's statistics.  Every rank
+ * must call this function. */
+int
+mpibash_stats_report (void)
+{
+  mpibash_stats_t **all;        /* Statistics of every builtin */
+  int nstats;                   /* Number of entries in the above */
+  int range[2];                 /* Negated minimum and maximum of nstats */
+  double *local;                /* Our statistics as a vector */
+  double *mins, *sums, *maxs;   /* Reduced statistics */
+  int nranks;                   /* Number of ranks in the job */
+  int rank;                     /* Our rank in the job */
+  int mpierr;
+  int i, j;
+
+  /* Ensure that all ranks have the same builtins, which mpi_init and
+   * circle_init create in a fixed order. */
+  nstats = collect_stats(&all);
+  range[0] = -nstats;
+  range[1] = nstats;
+  MPI_Comm_size(MPI_COMM_WORLD, &nranks);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  mpierr = MPI_Allreduce(MPI_IN_PLACE, range, 2, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  if (mpierr != MPI_SUCCESS) {
+    free(all);
+    return mpibash_report_mpi_error(mpierr);
+  }
+  if (-range[0] != range[1]) {
+    if (rank == 0)
+      fprintf(stderr, _("MPIBASH_STATS: ranks loaded different builtins; no report written\n"));
+    free(all);
+    return EXECUTION_SUCCESS;
+  }
+
+  /* Reduce calls, messages, bytes, wall time, and wait time. */
+  local = malloc((5*nstats + 1)*sizeof(double));
+  mins = malloc((5*nstats + 1)*sizeof(double));
+  sums = malloc((5*nstats + 1)*sizeof(double));
+  maxs = malloc((5*nstats + 1)*sizeof(double));
+  for (i = 0; i < nstats; i++) {
+    local[5*i + 0] = (double) all[i]->calls;
+    local[5*i + 1] = (double) all[i]->messages;
+    local[5*i + 2] = (double) all[i]->bytes;
+    local[5*i + 3] = all[i]->wall;
+    local[5*i + 4] = all[i]->wait;
+  }
+  mpierr = MPI_Reduce(local, mins, 5*nstats, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+  if (mpierr == MPI_SUCCESS)
+    mpierr = MPI_Reduce(local, sums, 5*nstats, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (mpierr == MPI_SUCCESS)
+    mpierr = MPI_Reduce(local, maxs, 5*nstats, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+  /* Write one line per builtin that any rank invoked. */
+  if (mpierr == MPI_SUCCESS && rank == 0) {
+    fprintf(stderr, "# MPI-Bash statistics across %d rank(s) (min/avg/max per rank)\n", nranks);
+    fprintf(stderr, "# %-20s %26s %26s %26s %32s %32s\n",
+            "Builtin", "Calls", "Messages", "Bytes", "Wall (s)", "Wait (s)");
+    for (i = 0; i < nstats; i++) {
+      if (maxs[5*i] == 0.0)
+        continue;
+      fprintf(stderr, "%-22s", all[i]->name);
+      for (j = 0; j < 5; j++)
+        fprintf(stderr, j < 3 ? " %8.0f/%8.1f/%8.0f" : " %10.6f/%10.6f/%10.6f",
+                mins[5*i + j], sums[5*i + j]/nranks, maxs[5*i + j]);
+      fprintf(stderr, "\n");
+    }
+    fflush(stderr);
+  }
+  free(local);
+  free(mins);
+  free(sums);
+  free(maxs);
+  free(all);
+  if (mpierr != MPI_SUCCESS)
+    return mpibash_report_mpi_error(mpierr);
+  return EXECUTION_SUCCESS;
+}
@@ -0,0 +1,162 @@
+/*************************************
+ * MPI-Bash file-streaming functions *
+ *                                   *
+ * By Scott Pakin <pakin@lanl.gov>   *
+ *************************************/
+
+#include "mpibash.h"
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Parse a file-descriptor number.  Return 1 on success, 0 on failure. */
+int
+mpibash_parse_fd (char *word, int *fd)
+{
+  intmax_t n;
+
+  if (!legal_number(word, &n) || n < 0 || n > INT_MAX) {
+    builtin_error(_("%s: invalid file descriptor specification"), word);
+    return 0;
+  }
+  *fd = (int) n;
+  return 1;
+}
+
+/* Open a file (if FILENAME is non-NULL) or file descriptor (otherwise)
+ * as a source of chunks to send.  Regular files are memory-mapped so
+ * chunks can be sent directly from the page cache.  Return
+ * EXECUTION_SUCCESS or EXECUTION_FAILURE. */
+int
+mpibash_open_source (mpibash_source_t *src, const char *filename, int fd)
+{
+  struct stat st;
+
+  memset(src, 0, sizeof(mpibash_source_t));
+  src->name = filename == NULL ? "file descriptor" : filename;
+  if (filename != NULL) {
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+      builtin_error("%s: %s", filename, strerror(errno));
+      return EXECUTION_FAILURE;
+    }
+    src->close_fd = 1;
+  }
+  src->fd = fd;
+
+  /* Map regular files, starting from the current file offset.  Fall
+   * back to read() for everything else. */
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    off_t start = lseek(fd, 0, SEEK_CUR);
+
+    src->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (src->map == MAP_FAILED || start == -1 || start > st.st_size) {
+      if (src->map != MAP_FAILED)
+        munmap(src->map, st.st_size);
+      src->map = NULL;
+    }
+    else {
+      src->map_len = st.st_size;
+      src->offset = start;
+      madvise(src->map, src->map_len, MADV_SEQUENTIAL);
+    }
+  }
+  return EXECUTION_SUCCESS;
+}
+
+/* Return a pointer to the next chunk of up to MPIBASH_CHUNK_SIZE bytes
+ * in *CHUNK and the chunk's length as the function value (0 at end of
+ * file; -1 on error).  Unmapped sources rotate among
+ * MPIBASH_STREAM_DEPTH buffers, so a chunk remains valid until
+ * MPIBASH_STREAM_DEPTH more chunks have been requested. */
+ssize_t
+mpibash_read_chunk (mpibash_source_t *src, char **chunk)
+{
+  char *buffer;                 /* Buffer to read into */
+  ssize_t len = 0;              /* Number of bytes read so far */
+
+  /* Mapped files require no copying. */
+  if (src->map != NULL) {
+    len = src->map_len - src->offset;
+    if (len > MPIBASH_CHUNK_SIZE)
+      len = MPIBASH_CHUNK_SIZE;
+    *chunk = src->map + src->offset;
+    src->offset += len;
+    return len;
+  }
+
+  /* Fill the next buffer in the rotation, stopping early only at end
+   * of file. */
+  if (src->buffers[src->which] == NULL)
+    src->buffers[src->which] = malloc(MPIBASH_CHUNK_SIZE);
+  buffer = src->buffers[src->which];
+  src->which = (src->which + 1) % MPIBASH_STREAM_DEPTH;
+  while (len < MPIBASH_CHUNK_SIZE) {
+    ssize_t nread = read(src->fd, buffer + len, MPIBASH_CHUNK_SIZE - len);
+
+    if (nread == 0)
+      break;
+    if (nread == -1) {
+      if (errno == EINTR)
+        continue;
+      builtin_error("%s: %s", src->name, strerror(errno));
+      return -1;
+    }
+    len += nread;
+  }
+  *chunk = buffer;
+  return len;
+}
+
+/* Release all resources associated with a source. */
+void
+mpibash_close_source (mpibash_source_t *src)
+{
+  int i;
+
+  if (src->map != NULL) {
+    munmap(src->map, src->map_len);
+    if (!src->close_fd)
+      lseek(src->fd, src->offset, SEEK_SET);
+  }
+  for (i = 0; i < MPIBASH_STREAM_DEPTH; i++)
+    free(src->buffers[i]);
+  if (src->close_fd)
+    close(src->fd);
+}
+
+/* Open a file for writing and return its file descriptor or -1 on
+ * error. */
+int
+mpibash_open_sink (const char *filename)
+{
+  int fd;
+
+  fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd == -1)
+    builtin_error("%s: %s", filename, strerror(errno));
+  return fd;
+}
+
+/* Write an entire buffer to a file descriptor.  Return
+ * EXECUTION_SUCCESS or EXECUTION_FAILURE. */
+int
+mpibash_write_all (int fd, const char *buffer, size_t len)
+{
+  while (len > 0) {
+    ssize_t nwritten = write(fd, buffer, len);
+
+    if (nwritten == -1) {
+      if (errno == EINTR)
+        continue;
+      builtin_error(_("write error: %s"), strerror(errno));
+      return EXECUTION_FAILURE;
+    }
+    buffer += nwritten;
+    len -= nwritten;
+  }
+  return EXECUTION_SUCCESS;
+}
@@ -0,0 +1,353 @@
+/*************************************
+ * MPI-Bash timing functions         *
+ *                                   *
+ * By Scott Pakin <pakin@lanl.gov>   *
+ *************************************/
+
+#include "mpibash.h"
+
+/* Describe one named, accumulating timer. */
+typedef struct phase_timer {
+  char *name;                   /* Name of the timer */
+  double start;                 /* Time at which the timer was last started */
+  double total;                 /* Seconds accumulated by completed intervals */
+  long count;                   /* Number of completed intervals */
+  int running;                  /* 1=started but not yet stopped */
+  struct phase_timer *next;     /* Next timer, in order of creation */
+} phase_timer_t;
+
+static phase_timer_t *timers = NULL;    /* All timers created so far */
+
+/* Return the timer called NAME or, if CREATE is 1 and no such timer
+ * exists, a newly created one.  Otherwise, return NULL. */
+static phase_timer_t *
+find_timer (const char *name, int create)
+{
+  phase_timer_t *t;             /* Timer to consider */
+  phase_timer_t **prevp;        /* Pointer to t in the list */
+
+  for (prevp = &timers, t = timers; t != NULL; prevp = &t->next, t = t->next)
+    if (!strcmp(t->name, name))
+      return t;
+  if (!create)
+    return NULL;
+  t = *prevp = calloc(1, sizeof(phase_timer_t));
+  t->name = strdup(name);
+  return t;
+}
+
+/* Bind the current time to a variable. */
+static int
+mpi_wtime_builtin (WORD_LIST *list)
+{
+  char *varname;                /* Name of the variable to bind the results to */
+  char timestr[64];             /* Time as a string */
+  double now = MPI_Wtime();     /* Current time in seconds */
+  int opt;                      /* Parsed option */
+  enum {
+    SECONDS,                    /* Floating-point seconds (the default) */
+    MICROSECONDS,               /* Integer microseconds (-u) */
+    NANOSECONDS                 /* Integer nanoseconds (-n) */
+  } units = SECONDS;
+
+  /* Parse the options and the target variable. */
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, "nu")) != -1) {
+    switch (opt) {
+      case 'n':
+        units = NANOSECONDS;
+        break;
+
+      case 'u':
+        units = MICROSECONDS;
+        break;
+
+      default:
+        builtin_usage();
+        return (EX_USAGE);
+    }
+  }
+  list = loptend;
+  YES_ARGS(list);
+  varname = list->word->word;
+  REQUIRE_WRITABLE(varname);
+  list = list->next;
+  no_args(list);
+
+  /* Bind the time in the requested units. */
+  switch (units) {
+    case SECONDS:
+      sprintf(timestr, "%.9f", now);
+      break;
+
+    case MICROSECONDS:
+      sprintf(timestr, "%.0f", now*1e6);
+      break;
+
+    case NANOSECONDS:
+      sprintf(timestr, "%.0f", now*1e9);
+      break;
+  }
+  bind_variable(varname, timestr, 0);
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_wtime builtin. */
+static char *mpi_wtime_doc[] = {
+  "Return the current time as measured by MPI_Wtime().",
+  "",
+  "Options:",
+  "  -u            Return an integer number of microseconds instead of",
+  "                seconds.",
+  "",
+  "  -n            Return an integer number of nanoseconds instead of",
+  "                seconds.",
+  "",
+  "Arguments:",
+  "  NAME          Scalar variable in which to receive the time.",
+  "",
+  "Unlike $(date +%s.%N), mpi_wtime does not fork a process.  Times are",
+  "measured from an arbitrary point in the past, so only differences",
+  "between them are meaningful.  Because bash arithmetic is integer",
+  "only, -u and -n are convenient for computing those differences in",
+  "the shell.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_wtime builtin. */
+DEFINE_BUILTIN(mpi_wtime, "mpi_wtime [-u | -n] name");
+
+/* Reduce the timers named in LIST across COMM to ROOT.  If VARNAME is
+ * NULL, print a table of each timer's minimum, average, and maximum
+ * total time on ROOT.  Otherwise, bind associative array VARNAME on
+ * ROOT to "MIN AVG MAX CALLS" for each timer. */
+static int
+report_timers (WORD_LIST *list, int root, char *varname, mpibash_comm_t *comm)
+{
+  WORD_LIST *w;                 /* One timer name */
+  phase_timer_t *t;             /* Timer corresponding to the above */
+  SHELL_VAR *var = NULL;        /* Variable corresponding to varname */
+  double *local;                /* Our total and count of each timer */
+  double *mins, *sums, *maxs;   /* Reduced versions of the above */
+  char value[128];              /* One timer's statistics as a string */
+  double avg;                   /* Average total across ranks */
+  int ntimers;                  /* Number of timers to report */
+  int result = EXECUTION_SUCCESS;
+  int mpierr;
+  int i;
+
+  /* Gather our total and count for each timer, including timers this
+   * rank never started. */
+  ntimers = list_length((GENERIC_LIST *)list);
+  local = malloc((2*ntimers + 1)*sizeof(double));
+  mins = malloc((2*ntimers + 1)*sizeof(double));
+  sums = malloc((2*ntimers + 1)*sizeof(double));
+  maxs = malloc((2*ntimers + 1)*sizeof(double));
+  for (i = 0, w = list; w != NULL; i++, w = w->next) {
+    t = find_timer(w->word->word, 0);
+    local[2*i] = t == NULL ? 0.0 : t->total;
+    local[2*i + 1] = t == NULL ? 0.0 : (double) t->count;
+  }
+
+  /* Reduce them. */
+  mpierr = mpibash_flush_batches() == EXECUTION_SUCCESS ? MPI_SUCCESS : MPI_ERR_OTHER;
+  if (mpierr == MPI_SUCCESS)
+    MPI_TIMED(mpierr, MPI_Reduce(local, mins, 2*ntimers, MPI_DOUBLE, MPI_MIN, root, comm->comm));
+  if (mpierr == MPI_SUCCESS)
+    MPI_TIMED(mpierr, MPI_Reduce(local, sums, 2*ntimers, MPI_DOUBLE, MPI_SUM, root, comm->comm));
+  if (mpierr == MPI_SUCCESS)
+    MPI_TIMED(mpierr, MPI_Reduce(local, maxs, 2*ntimers, MPI_DOUBLE, MPI_MAX, root, comm->comm));
+
+  /* Report the results on the root.  Only the root checks that
+   * VARNAME is writable, and only once every rank has taken part in
+   * the reductions. */
+  if (mpierr == MPI_SUCCESS && comm->rank == root && varname != NULL) {
+    var = find_shell_variable(varname);
+    if (var != NULL && readonly_p(var)) {
+      err_readonly(varname);
+      result = EXECUTION_FAILURE;
+    }
+    else {
+      if (var != NULL)
+        unbind_variable(varname);
+      var = make_new_assoc_variable(varname);
+    }
+  }
+  if (mpierr == MPI_SUCCESS && comm->rank == root && result == EXECUTION_SUCCESS) {
+    if (varname == NULL)
+      printf("# %-18s %10s %12s %12s %12s %9s\n",
+             "Timer", "Calls", "Min (s)", "Avg (s)", "Max (s)", "Max/Avg");
+    for (i = 0, w = list; w != NULL; i++, w = w->next) {
+      avg = sums[2*i]/comm->size;
+      if (var != NULL) {
+        sprintf(value, "%.9f %.9f %.9f %.0f",
+                mins[2*i], avg, maxs[2*i], sums[2*i + 1]);
+        assoc_insert(assoc_cell(var), strdup(w->word->word), value);   /* Takes ownership of key */
+      }
+      else
+        printf("%-20s %10.0f %12.6f %12.6f %12.6f %9.2f\n",
+               w->word->word, sums[2*i + 1], mins[2*i], avg, maxs[2*i],
+               avg > 0.0 ? maxs[2*i]/avg : 1.0);
+    }
+    if (var == NULL)
+      fflush(stdout);
+  }
+  free(local);
+  free(mins);
+  free(sums);
+  free(maxs);
+  if (mpierr != MPI_SUCCESS)
+    return mpibash_report_mpi_error(mpierr);
+  return result;
+}
+
+/* Start, stop, read, or report named timers. */
+static int
+mpi_timer_builtin (WORD_LIST *list)
+{
+  char *action;                 /* "start", "stop", "read", or "report" */
+  char *varname = NULL;         /* Name of the variable to bind the results to */
+  char *rootword = NULL;        /* Argument to -r */
+  int root = 0;                 /* Rank that receives a report */
+  mpibash_comm_t comm;          /* Communicator to report across */
+  phase_timer_t *t;             /* Timer to act on */
+  double now = MPI_Wtime();     /* Current time in seconds */
+  char timestr[64];             /* Total time as a string */
+  int starting;                 /* 1=action is "start" */
+  int opt;                      /* Parsed option */
+
+  /* Parse the action. */
+  YES_ARGS(list);
+  action = list->word->word;
+  list = list->next;
+
+  /* Start or stop each named timer. */
+  starting = !strcmp(action, "start");
+  if (starting || !strcmp(action, "stop")) {
+    YES_ARGS(list);
+    for (; list != NULL; list = list->next) {
+      t = find_timer(list->word->word, starting);
+      if (starting) {
+        if (t->running) {
+          builtin_error(_("%s: timer is already running"), t->name);
+          return EXECUTION_FAILURE;
+        }
+        t->running = 1;
+        t->start = now;
+      }
+      else {
+        if (t == NULL || !t->running) {
+          builtin_error(_("%s: timer is not running"), list->word->word);
+          return EXECUTION_FAILURE;
+        }
+        t->running = 0;
+        t->total += now - t->start;
+        t->count++;
+      }
+    }
+    return EXECUTION_SUCCESS;
+  }
+
+  /* Bind a timer's total on this rank to a variable. */
+  if (!strcmp(action, "read")) {
+    YES_ARGS(list);
+    t = find_timer(list->word->word, 0);
+    list = list->next;
+    YES_ARGS(list);
+    varname = list->word->word;
+    REQUIRE_WRITABLE(varname);
+    list = list->next;
+    no_args(list);
+    sprintf(timestr, "%.9f", t == NULL ? 0.0 : t->total);
+    bind_variable(varname, timestr, 0);
+    return EXECUTION_SUCCESS;
+  }
+
+  /* Reduce timers across ranks. */
+  if (!strcmp(action, "report")) {
+    mpibash_get_comm(MPIBASH_COMM_WORLD, &comm);
+    reset_internal_getopt();
+    while ((opt = internal_getopt(list, "c:r:v:")) != -1) {
+      switch (opt) {
+        case 'c':
+          if (!mpibash_parse_comm(list_optarg, &comm))
+            return (EX_USAGE);
+          break;
+
+        case 'r':
+          rootword = list_optarg;
+          break;
+
+        case 'v':
+          varname = list_optarg;
+          break;
+
+        default:
+          builtin_usage();
+          return (EX_USAGE);
+      }
+    }
+    list = loptend;
+    YES_ARGS(list);
+    if (rootword != NULL) {
+      intmax_t n;
+
+      if (!legal_number(rootword, &n) || n < 0 || n >= comm.size) {
+        builtin_error(_("-r: rank in the range [0, %d] required"), comm.size - 1);
+        return (EX_USAGE);
+      }
+      root = (int) n;
+    }
+    return report_timers(list, root, varname, &comm);
+  }
+
+  builtin_error(_("%s: expected start, stop, read, or report"), action);
+  return (EX_USAGE);
+}
+
+/* Define the documentation for the mpi_timer builtin. */
+static char *mpi_timer_doc[] = {
+  "Accumulate time spent in named phases of a script.",
+  "",
+  "Actions:",
+  "  start NAME...         Start each named timer, creating it if needed.",
+  "",
+  "  stop NAME...          Stop each named timer and add the time since",
+  "                        it was started to its total.",
+  "",
+  "  read NAME VAR         Bind VAR to timer NAME's total on this process,",
+  "                        in seconds.",
+  "",
+  "  report NAME...        Reduce the totals of the named timers across",
+  "                        all processes.  Every process must call",
+  "                        mpi_timer report together with the same names.",
+  "",
+  "Options for report:",
+  "  -r ROOT       Report on rank ROOT (default: 0).",
+  "",
+  "  -c COMM       Reduce only across the processes in communicator COMM.",
+  "                ROOT is then a rank within COMM.",
+  "",
+  "  -v VAR        Instead of printing a table, bind associative array",
+  "                VAR on ROOT, keyed by timer name, to \"MIN AVG MAX",
+  "                CALLS\".",
+  "",
+  "Timers are backed by MPI_Wtime() and do not fork a process.  A timer",
+  "may be started and stopped many times; its total accumulates across",
+  "intervals.  The report lists, for each timer, the total number of",
+  "intervals and the minimum, average, and maximum total time across",
+  "processes.  Its last column, the ratio of the maximum to the",
+  "average, exposes load imbalance: 1.00 is perfectly balanced.  A",
+  "timer that is still running contributes only its completed",
+  "intervals.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_timer builtin. */
+DEFINE_BUILTIN(mpi_timer, "mpi_timer start|stop name... | read name var | report [-c comm] [-r root] [-v var] name...");
@@ -0,0 +1,612 @@
+/*****************************************************
+ * MPI-Bash interface to the MPI tool information    *
+ * interface (performance and control variables)     *
+ *                                                   *
+ * By Scott Pakin <pakin@lanl.gov>                   *
+ *****************************************************/
+
+#include "mpibash.h"
+
+/* Describe one performance or control variable. */
+typedef struct {
+  char name[256];               /* Name of the variable */
+  char desc[1024];              /* Human-readable description */
+  int verbosity;                /* MPI_T_VERBOSITY_* */
+  MPI_Datatype datatype;        /* Type of each element */
+  MPI_T_enum enumtype;          /* Enumeration, if any, of the values */
+  int bind;                     /* MPI_T_BIND_* */
+  int var_class;                /* MPI_T_PVAR_CLASS_* (pvars only) */
+  int readonly;                 /* 1=cannot be written (pvars only) */
+  int continuous;               /* 1=cannot be started or stopped (pvars only) */
+  int atomic;                   /* 1=supports atomic read-and-reset (pvars only) */
+  int scope;                    /* MPI_T_SCOPE_* (cvars only) */
+} tool_var_t;
+
+/* Remember each performance-variable handle we've allocated so
+ * counters keep accumulating from one read to the next. */
+typedef struct pvar_handle {
+  int index;                    /* Index of the performance variable */
+  MPI_Comm comm;                /* Communicator it's bound to or MPI_COMM_NULL */
+  MPI_T_pvar_handle handle;     /* Handle within pvar_session */
+  int count;                    /* Number of elements the handle reads */
+  struct pvar_handle *next;     /* Next handle in the list */
+} pvar_handle_t;
+
+static int tool_inited = 0;     /* 1=MPI_T_init_thread() succeeded */
+static MPI_T_pvar_session pvar_session;  /* Session in which we read pvars */
+static pvar_handle_t *pvar_handles = NULL;  /* All pvar handles allocated so far */
+
+/* Initialize the MPI tool information interface.  Failure is not
+ * fatal; the mpi_t_* builtins simply report that the interface is
+ * unavailable. */
+void
+mpibash_init_tool (void)
+{
+  int level;                    /* Thread level MPI was initialized with */
+  int provided;                 /* Thread level MPI_T provides */
+
+  MPI_Query_thread(&level);
+  if (MPI_T_init_thread(level, &provided) != MPI_SUCCESS)
+    return;
+  if (MPI_T_pvar_session_create(&pvar_session) != MPI_SUCCESS) {
+    MPI_T_finalize();
+    return;
+  }
+  tool_inited = 1;
+}
+
+/* Free all pvar handles and shut down the MPI tool information
+ * interface. */
+void
+mpibash_finalize_tool (void)
+{
+  pvar_handle_t *ph;            /* One handle to free */
+
+  if (!tool_inited)
+    return;
+  while (pvar_handles != NULL) {
+    ph = pvar_handles;
+    pvar_handles = ph->next;
+    MPI_T_pvar_handle_free(pvar_session, &ph->handle);
+    free(ph);
+  }
+  MPI_T_pvar_session_free(&pvar_session);
+  MPI_T_finalize();
+  tool_inited = 0;
+}
+
+/* Free all pvar handles bound to a communicator that is about to be
+ * freed. */
+void
+mpibash_tool_release_comm (MPI_Comm comm)
+{
+  pvar_handle_t *ph;            /* Handle to consider */
+  pvar_handle_t **prevp;        /* Pointer to ph in the list */
+
+  if (!tool_inited)
+    return;
+  for (prevp = &pvar_handles, ph = pvar_handles; ph != NULL; ph = *prevp)
+    if (ph->comm == comm) {
+      *prevp = ph->next;
+      MPI_T_pvar_handle_free(pvar_session, &ph->handle);
+      free(ph);
+    }
+    else
+      prevp = &ph->next;
+}
+
+/* Return 1 if the MPI tool information interface is usable.
+ * Otherwise, complain and return 0. */
+static int
+require_tool (void)
+{
+  if (tool_inited)
+    return 1;
+  builtin_error(_("the MPI tool information interface is not available"));
+  return 0;
+}
+
+/* Describe performance variable INDEX.  Return an MPI error code. */
+static int
+get_pvar_info (int index, tool_var_t *var)
+{
+  int namelen = sizeof(var->name);   /* Length of var->name */
+  int desclen = sizeof(var->desc);   /* Length of var->desc */
+
+  memset(var, 0, sizeof(tool_var_t));
+  return MPI_T_pvar_get_info(index, var->name, &namelen, &var->verbosity,
+                             &var->var_class, &var->datatype, &var->enumtype,
+                             var->desc, &desclen, &var->bind, &var->readonly,
+                             &var->continuous, &var->atomic);
+}
+
+/* Describe control variable INDEX.  Return an MPI error code. */
+static int
+get_cvar_info (int index, tool_var_t *var)
+{
+  int namelen = sizeof(var->name);   /* Length of var->name */
+  int desclen = sizeof(var->desc);   /* Length of var->desc */
+
+  memset(var, 0, sizeof(tool_var_t));
+  return MPI_T_cvar_get_info(index, var->name, &namelen, &var->verbosity,
+                             &var->datatype, &var->enumtype,
+                             var->desc, &desclen, &var->bind, &var->scope);
+}
+
+/* Find the performance (IS_PVAR=1) or control (IS_PVAR=0) variable
+ * called NAME and describe it in VAR.  Return its index or -1 if it
+ * does not exist. */
+static int
+find_tool_var (const char *name, int is_pvar, tool_var_t *var)
+{
+  int num;                      /* Number of variables */
+  int i;
+
+  if ((is_pvar ? MPI_T_pvar_get_num(&num) : MPI_T_cvar_get_num(&num)) != MPI_SUCCESS)
+    num = 0;
+  for (i = 0; i < num; i++)
+    if ((is_pvar ? get_pvar_info(i, var) : get_cvar_info(i, var)) == MPI_SUCCESS
+        && !strcmp(var->name, name))
+      return i;
+  builtin_error(_("%s: no such %s variable"), name, is_pvar ? "performance" : "control");
+  return -1;
+}
+
+/* Point OBJ at the object to which a variable binds given a
+ * communicator, or at NULL if the variable binds to no object.
+ * Return 1 on success.  Complain and return 0 if the variable binds
+ * to some other kind of object. */
+static int
+bound_object (tool_var_t *var, mpibash_comm_t *comm, void **obj)
+{
+  switch (var->bind) {
+    case MPI_T_BIND_NO_OBJECT:
+      *obj = NULL;
+      return 1;
+
+    case MPI_T_BIND_MPI_COMM:
+      *obj = &comm->comm;
+      return 1;
+
+    default:
+      builtin_error(_("%s: bound to an MPI object other than a communicator"), var->name);
+      return 0;
+  }
+}
+
+/* Return a short name for a performance-variable class. */
+static const char *
+pvar_class_name (int var_class)
+{
+  switch (var_class) {
+    case MPI_T_PVAR_CLASS_STATE:         return "state";
+    case MPI_T_PVAR_CLASS_LEVEL:         return "level";
+    case MPI_T_PVAR_CLASS_SIZE:          return "size";
+    case MPI_T_PVAR_CLASS_PERCENTAGE:    return "percentage";
+    case MPI_T_PVAR_CLASS_HIGHWATERMARK: return "highwatermark";
+    case MPI_T_PVAR_CLASS_LOWWATERMARK:  return "lowwatermark";
+    case MPI_T_PVAR_CLASS_COUNTER:       return "counter";
+    case MPI_T_PVAR_CLASS_AGGREGATE:     return "aggregate";
+    case MPI_T_PVAR_CLASS_TIMER:         return "timer";
+    case MPI_T_PVAR_CLASS_GENERIC:       return "generic";
+    default:                             return "unknown";
+  }
+}
+
+/* Return a short name for a control-variable scope. */
+static const char *
+cvar_scope_name (int scope)
+{
+  switch (scope) {
+    case MPI_T_SCOPE_CONSTANT: return "constant";
+    case MPI_T_SCOPE_READONLY: return "readonly";
+    case MPI_T_SCOPE_LOCAL:    return "local";
+    case MPI_T_SCOPE_GROUP:    return "group";
+    case MPI_T_SCOPE_GROUP_EQ: return "group_eq";
+    case MPI_T_SCOPE_ALL:      return "all";
+    case MPI_T_SCOPE_ALL_EQ:   return "all_eq";
+    default:                   return "unknown";
+  }
+}
+
+/* Either print every performance (IS_PVAR=1) or control (IS_PVAR=0)
+ * variable's name, class or scope, and description or, if VARNAME is
+ * non-NULL, bind an indexed array of their names to VARNAME. */
+static int
+list_tool_vars (int is_pvar, char *varname)
+{
+  tool_var_t var;               /* One variable */
+  int num;                      /* Number of variables */
+  arrayind_t nbound = 0;        /* Number of names bound so far */
+  int i;
+
+  if (varname != NULL) {
+    REQUIRE_WRITABLE(varname);
+    make_new_array_variable(varname);
+  }
+  MPI_TRY(is_pvar ? MPI_T_pvar_get_num(&num) : MPI_T_cvar_get_num(&num));
+  for (i = 0; i < num; i++) {
+    if ((is_pvar ? get_pvar_info(i, &var) : get_cvar_info(i, &var)) != MPI_SUCCESS)
+      continue;    /* Variables may be invalidated at any time. */
+    if (varname != NULL)
+      bind_array_variable(varname, nbound++, var.name, 0);
+    else
+      printf("%s\t%s\t%s\n", var.name,
+             is_pvar ? pvar_class_name(var.var_class) : cvar_scope_name(var.scope),
+             var.desc);
+  }
+  if (varname == NULL)
+    fflush(stdout);
+  return EXECUTION_SUCCESS;
+}
+
+/* Format element I of BUFFER, an array of TYPE, into STR. */
+static void
+format_value (MPI_Datatype type, void *buffer, int i, char *str)
+{
+  if (type == MPI_INT)
+    sprintf(str, "%d", ((int *)buffer)[i]);
+  else if (type == MPI_UNSIGNED)
+    sprintf(str, "%u", ((unsigned int *)buffer)[i]);
+  else if (type == MPI_UNSIGNED_LONG)
+    sprintf(str, "%lu", ((unsigned long *)buffer)[i]);
+  else if (type == MPI_UNSIGNED_LONG_LONG)
+    sprintf(str, "%llu", ((unsigned long long *)buffer)[i]);
+  else if (type == MPI_COUNT)
+    sprintf(str, "%lld", (long long) ((MPI_Count *)buffer)[i]);
+  else if (type == MPI_DOUBLE)
+    sprintf(str, "%.17g", ((double *)buffer)[i]);
+  else
+    strcpy(str, "");
+}
+
+/* Bind COUNT elements of BUFFER, an array of TYPE, to VARNAME.  A
+ * string or a single number is bound as a scalar, and multiple
+ * numbers are bound as an indexed array. */
+static void
+bind_values (char *varname, MPI_Datatype type, void *buffer, int count)
+{
+  char str[64];                 /* One element as a string */
+  int i;
+
+  if (type == MPI_CHAR) {
+    ((char *)buffer)[count] = '\0';
+    bind_variable(varname, (char *)buffer, 0);
+    return;
+  }
+  if (count == 1) {
+    format_value(type, buffer, 0, str);
+    bind_variable(varname, str, 0);
+    return;
+  }
+  make_new_array_variable(varname);
+  for (i = 0; i < count; i++) {
+    format_value(type, buffer, i, str);
+    bind_array_variable(varname, i, str, 0);
+  }
+}
+
+/* Parse WORD as a single value of TYPE into BUFFER, which holds COUNT
+ * elements.  Return 1 on success and 0 on failure. */
+static int
+parse_value (MPI_Datatype type, char *word, void *buffer, int count)
+{
+  intmax_t n;                   /* Word as an integer */
+  char *end;                    /* First unparsed character */
+
+  if (type == MPI_CHAR) {
+    if (strlen(word) >= (size_t) count)
+      return 0;
+    strcpy((char *)buffer, word);
+    return 1;
+  }
+  if (count != 1)
+    return 0;
+  if (type == MPI_DOUBLE) {
+    ((double *)buffer)[0] = strtod(word, &end);
+    return *word != '\0' && *end == '\0';
+  }
+  if (!legal_number(word, &n))
+    return 0;
+  if (type == MPI_INT)
+    ((int *)buffer)[0] = (int) n;
+  else if (type == MPI_COUNT)
+    ((MPI_Count *)buffer)[0] = (MPI_Count) n;
+  else if (n < 0)
+    return 0;
+  else if (type == MPI_UNSIGNED)
+    ((unsigned int *)buffer)[0] = (unsigned int) n;
+  else if (type == MPI_UNSIGNED_LONG)
+    ((unsigned long *)buffer)[0] = (unsigned long) n;
+  else if (type == MPI_UNSIGNED_LONG_LONG)
+    ((unsigned long long *)buffer)[0] = (unsigned long long) n;
+  else
+    return 0;
+  return 1;
+}
+
+/* Allocate a buffer large enough for COUNT elements of TYPE plus a
+ * string terminator. */
+static void *
+alloc_values (MPI_Datatype type, int count)
+{
+  int size;                     /* Size in bytes of one element */
+
+  if (MPI_Type_size(type, &size) != MPI_SUCCESS || size < 1)
+    size = sizeof(double);
+  return calloc(count + 1, size);
+}
+
+/* Return a handle to performance variable INDEX, bound to COMM if
+ * necessary, starting it if it is not continuous.  Return NULL and
+ * complain on failure. */
+static pvar_handle_t *
+get_pvar_handle (int index, tool_var_t *var, mpibash_comm_t *comm)
+{
+  pvar_handle_t *ph;            /* Handle to return */
+  void *obj;                    /* Object to which the variable is bound */
+  MPI_Comm bound = MPI_COMM_NULL;   /* Communicator to which the variable is bound */
+  int mpierr;
+
+  /* Reuse an existing handle if possible. */
+  if (!bound_object(var, comm, &obj))
+    return NULL;
+  if (obj != NULL)
+    bound = comm->comm;
+  for (ph = pvar_handles; ph != NULL; ph = ph->next)
+    if (ph->index == index && ph->comm == bound)
+      return ph;
+
+  /* Allocate and start a new handle. */
+  ph = calloc(1, sizeof(pvar_handle_t));
+  ph->index = index;
+  ph->comm = bound;
+  mpierr = MPI_T_pvar_handle_alloc(pvar_session, index, obj, &ph->handle, &ph->count);
+  if (mpierr == MPI_SUCCESS && !var->continuous) {
+    mpierr = MPI_T_pvar_start(pvar_session, ph->handle);
+    if (mpierr != MPI_SUCCESS)
+      MPI_T_pvar_handle_free(pvar_session, &ph->handle);
+  }
+  if (mpierr != MPI_SUCCESS) {
+    free(ph);
+    mpibash_report_mpi_error(mpierr);
+    return NULL;
+  }
+  ph->next = pvar_handles;
+  pvar_handles = ph;
+  return ph;
+}
+
+/* List, read, or reset MPI performance variables. */
+static int
+mpi_t_pvar_builtin (WORD_LIST *list)
+{
+  char *action;                 /* "list", "read", or "reset" */
+  char *varname = NULL;         /* Name of the variable to bind the results to */
+  mpibash_comm_t comm;          /* Communicator for communicator-bound pvars */
+  tool_var_t var;               /* Description of the performance variable */
+  pvar_handle_t *ph;            /* Handle to the performance variable */
+  void *buffer;                 /* Value(s) read */
+  int index;                    /* Index of the performance variable */
+  int reading;                  /* 1=action is "read" */
+  int mpierr;
+
+  /* Parse the action. */
+  YES_ARGS(list);
+  action = list->word->word;
+  list = list->next;
+  if (!require_tool())
+    return EXECUTION_FAILURE;
+
+  /* List all performance variables. */
+  if (!strcmp(action, "list")) {
+    if (list != NULL) {
+      varname = list->word->word;
+      list = list->next;
+    }
+    no_args(list);
+    return list_tool_vars(1, varname);
+  }
+  reading = !strcmp(action, "read");
+  if (!reading && strcmp(action, "reset")) {
+    builtin_error(_("%s: expected list, read, or reset"), action);
+    return (EX_USAGE);
+  }
+
+  /* Parse the remaining arguments to read and reset. */
+  if (mpibash_parse_comm_option(&list, &comm) != EXECUTION_SUCCESS)
+    return (EX_USAGE);
+  YES_ARGS(list);
+  index = find_tool_var(list->word->word, 1, &var);
+  if (index == -1)
+    return EXECUTION_FAILURE;
+  list = list->next;
+  if (reading) {
+    YES_ARGS(list);
+    varname = list->word->word;
+    REQUIRE_WRITABLE(varname);
+    list = list->next;
+  }
+  no_args(list);
+  ph = get_pvar_handle(index, &var, &comm);
+  if (ph == NULL)
+    return EXECUTION_FAILURE;
+
+  /* Reset the variable. */
+  if (!reading) {
+    if (var.readonly) {
+      builtin_error(_("%s: performance variable is read-only"), var.name);
+      return EXECUTION_FAILURE;
+    }
+    MPI_TRY(MPI_T_pvar_reset(pvar_session, ph->handle));
+    return EXECUTION_SUCCESS;
+  }
+
+  /* Read the variable. */
+  buffer = alloc_values(var.datatype, ph->count);
+  mpierr = MPI_T_pvar_read(pvar_session, ph->handle, buffer);
+  if (mpierr == MPI_SUCCESS)
+    bind_values(varname, var.datatype, buffer, ph->count);
+  free(buffer);
+  if (mpierr != MPI_SUCCESS)
+    return mpibash_report_mpi_error(mpierr);
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_t_pvar builtin. */
+static char *mpi_t_pvar_doc[] = {
+  "Inspect the MPI library's performance variables.",
+  "",
+  "Actions:",
+  "  list [NAME]           Print one line per performance variable giving",
+  "                        its name, class, and description, separated",
+  "                        by tabs.  If NAME is given, instead bind an",
+  "                        indexed array of variable names to NAME.",
+  "",
+  "  read PVAR NAME        Bind NAME to the current value of performance",
+  "                        variable PVAR.  Multi-element values are",
+  "                        bound as an indexed array.",
+  "",
+  "  reset PVAR            Reset performance variable PVAR to its",
+  "                        starting value.",
+  "",
+  "Options for read and reset:",
+  "  -c COMM       Use the instance of PVAR that is bound to communicator",
+  "                COMM (default: all processes).",
+  "",
+  "Performance variables expose MPI-library internals such as queue",
+  "lengths and protocol counters.  Their names, classes, and meanings",
+  "are specific to the MPI implementation.  A variable is started the",
+  "first time it is read, so counters accumulate from that point on.",
+  "Variables bound to MPI objects other than communicators are not",
+  "supported.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_t_pvar builtin. */
+DEFINE_BUILTIN(mpi_t_pvar, "mpi_t_pvar list [name] | read [-c comm] pvar name | reset [-c comm] pvar");
+
+/* List, get, or set MPI control variables. */
+static int
+mpi_t_cvar_builtin (WORD_LIST *list)
+{
+  char *action;                 /* "list", "get", or "set" */
+  char *varname = NULL;         /* Name of the variable to bind the results to */
+  char *value = NULL;           /* Value to assign */
+  mpibash_comm_t comm;          /* Communicator for communicator-bound cvars */
+  tool_var_t var;               /* Description of the control variable */
+  MPI_T_cvar_handle handle;     /* Handle to the control variable */
+  void *obj;                    /* Object to which the variable is bound */
+  void *buffer;                 /* Value(s) read or written */
+  int index;                    /* Index of the control variable */
+  int count;                    /* Number of elements in the control variable */
+  int getting;                  /* 1=action is "get" */
+  int mpierr;
+
+  /* Parse the action. */
+  YES_ARGS(list);
+  action = list->word->word;
+  list = list->next;
+  if (!require_tool())
+    return EXECUTION_FAILURE;
+
+  /* List all control variables. */
+  if (!strcmp(action, "list")) {
+    if (list != NULL) {
+      varname = list->word->word;
+      list = list->next;
+    }
+    no_args(list);
+    return list_tool_vars(0, varname);
+  }
+  getting = !strcmp(action, "get");
+  if (!getting && strcmp(action, "set")) {
+    builtin_error(_("%s: expected list, get, or set"), action);
+    return (EX_USAGE);
+  }
+
+  /* Parse the remaining arguments to get and set. */
+  if (mpibash_parse_comm_option(&list, &comm) != EXECUTION_SUCCESS)
+    return (EX_USAGE);
+  YES_ARGS(list);
+  index = find_tool_var(list->word->word, 0, &var);
+  if (index == -1)
+    return EXECUTION_FAILURE;
+  list = list->next;
+  YES_ARGS(list);
+  if (getting) {
+    varname = list->word->word;
+    REQUIRE_WRITABLE(varname);
+  }
+  else
+    value = list->word->word;
+  list = list->next;
+  no_args(list);
+  if (!getting && (var.scope == MPI_T_SCOPE_CONSTANT || var.scope == MPI_T_SCOPE_READONLY)) {
+    builtin_error(_("%s: control variable is read-only"), var.name);
+    return EXECUTION_FAILURE;
+  }
+  if (!bound_object(&var, &comm, &obj))
+    return EXECUTION_FAILURE;
+
+  /* Get or set the variable. */
+  MPI_TRY(MPI_T_cvar_handle_alloc(index, obj, &handle, &count));
+  buffer = alloc_values(var.datatype, count);
+  if (!getting) {
+    if (!parse_value(var.datatype, value, buffer, count)) {
+      builtin_error(_("%s: invalid value for control variable %s"), value, var.name);
+      free(buffer);
+      MPI_T_cvar_handle_free(&handle);
+      return EXECUTION_FAILURE;
+    }
+    mpierr = MPI_T_cvar_write(handle, buffer);
+  }
+  else {
+    mpierr = MPI_T_cvar_read(handle, buffer);
+    if (mpierr == MPI_SUCCESS)
+      bind_values(varname, var.datatype, buffer, count);
+  }
+  free(buffer);
+  MPI_T_cvar_handle_free(&handle);
+  if (mpierr != MPI_SUCCESS)
+    return mpibash_report_mpi_error(mpierr);
+  return EXECUTION_SUCCESS;
+}
+
+/* Define the documentation for the mpi_t_cvar builtin. */
+static char *mpi_t_cvar_doc[] = {
+  "Inspect or change the MPI library's control variables.",
+  "",
+  "Actions:",
+  "  list [NAME]           Print one line per control variable giving its",
+  "                        name, scope, and description, separated by",
+  "                        tabs.  If NAME is given, instead bind an",
+  "                        indexed array of variable names to NAME.",
+  "",
+  "  get CVAR NAME         Bind NAME to the current value of control",
+  "                        variable CVAR.  Multi-element values are bound",
+  "                        as an indexed array.",
+  "",
+  "  set CVAR VALUE        Assign VALUE to control variable CVAR.",
+  "",
+  "Options for get and set:",
+  "  -c COMM       Use the instance of CVAR that is bound to communicator",
+  "                COMM (default: all processes).",
+  "",
+  "Control variables are the MPI library's tunable parameters, such as",
+  "the message size at which it switches from an eager to a rendezvous",
+  "protocol.  Their names and meanings are specific to the MPI",
+  "implementation.  A variable's scope indicates whether it can be",
+  "changed after mpi_init and, if so, whether every process must",
+  "assign it the same value.",
+  "",
+  "Exit Status:",
+  "Returns 0 unless an invalid option is given or an error occurs.",
+  NULL
+};
+
+/* Describe the mpi_t_cvar builtin. */
+DEFINE_BUILTIN(mpi_t_cvar, "mpi_t_cvar list [name] | get [-c comm] cvar name | set [-c comm] cvar value");
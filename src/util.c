@@ -6,6 +6,20 @@
  ***********************************/
 
 #include "mpibash.h"
+#include <time.h>
+
+static mpibash_stats_t *stats_head = NULL;      /* Statistics of every builtin used */
+static mpibash_stats_t *stats_tail = NULL;      /* Last entry in the above */
+static mpibash_stats_t *stats_current = NULL;   /* Statistics of the running builtin */
+
+/* Lock every builtin holds while it runs, or NULL if there is no
+ * progress thread to exclude. */
+pthread_mutex_t *mpibash_builtin_lock = NULL;
+
+/* Variable holding the lock above.  Circle-Bash links its own copy of
+ * this file but must use MPI-Bash's lock (see
+ * mpibash_share_builtin_lock). */
+static pthread_mutex_t **builtin_lock_ref = &mpibash_builtin_lock;
 
 /* Perform the same operation as bind_variable, but with VALUE being a
  * number, not a string. */
@@ -30,6 +44,20 @@ mpibash_report_mpi_error (int mpierr)
   return EXECUTION_FAILURE;
 }
 
+/* Hash a key of LEN bytes with 64-bit FNV-1a. */
+uint64_t
+mpibash_hash_key (const char *key, size_t len)
+{
+  uint64_t hash = UINT64_C(14695981039346656037);   /* FNV offset basis */
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= (unsigned char) key[i];
+    hash *= UINT64_C(1099511628211);                /* FNV prime */
+  }
+  return hash;
+}
+
 /* Perform the same operation as bind_array_variable, but with VALUE
  * being a number, not a string. */
 SHELL_VAR *
@@ -90,6 +118,95 @@ mpibash_invoke_bash_command(char *funcname, ...)
   return EXECUTION_SUCCESS;
 }
 
+/* Register every builtin named in NULL-terminated list NAMES, all of
+ * which are defined by the same plugin as function SELF, directly in
+ * bash's builtin table.  This is what "enable -f plugin.so name..."
+ * does, but it reuses the already loaded plugin instead of reopening
+ * it and grows and re-sorts the table only once instead of once per
+ * builtin.  If the shell does not export its builtin table, fall back
+ * to enabling each builtin in turn.  Return EXECUTION_SUCCESS or
+ * EXECUTION_FAILURE. */
+int
+mpibash_register_builtins (void *self, char **names)
+{
+  Dl_info self_info;            /* Information about the plugin defining SELF */
+  void *handle;                 /* Handle to the same plugin */
+  struct builtin **added;       /* Builtins not previously in the table */
+  int nadded = 0;               /* Number of entries in the above */
+  struct builtin *table;        /* New builtin table */
+  struct builtin *b;            /* One builtin defined by the plugin */
+  struct builtin *old;          /* Existing entry for the same name */
+  char struct_name[256];        /* Name of the symbol defining b */
+  char **name;
+  int i;
+
+  /* Create every builtin's statistics up front so that all ranks list
+   * them in the same order. */
+  for (name = names; *name; name++)
+    mpibash_stats_lookup(*name);
+
+  /* Find and reopen the plugin that defines SELF.  RTLD_NOLOAD merely
+   * returns a new reference to the existing mapping. */
+  if (dladdr(self, &self_info) == 0 || self_info.dli_fname == NULL) {
+    fprintf(stderr, _("mpi_init: failed to find the MPI-Bash .so file\n"));
+    return EXECUTION_FAILURE;
+  }
+  if (&num_shell_builtins == NULL || initialize_shell_builtins == NULL
+      || builtin_address_internal == NULL) {
+    for (name = names; *name; name++)
+      if (mpibash_invoke_bash_command("enable", "-f", self_info.dli_fname,
+                                      *name, NULL) != EXECUTION_SUCCESS)
+        return EXECUTION_FAILURE;
+    return EXECUTION_SUCCESS;
+  }
+  handle = dlopen(self_info.dli_fname, RTLD_LAZY | RTLD_NOLOAD);
+  if (handle == NULL) {
+    fprintf(stderr, _("mpi_init: %s\n"), dlerror());
+    return EXECUTION_FAILURE;
+  }
+
+  /* Look up each builtin's description.  Overwrite existing entries
+   * in place (e.g., if mpi_init is invoked twice), and collect the
+   * rest. */
+  for (name = names; *name; name++)
+    nadded++;
+  added = malloc((nadded + 1)*sizeof(struct builtin *));
+  nadded = 0;
+  for (name = names; *name; name++) {
+    snprintf(struct_name, sizeof(struct_name), "%s_struct", *name);
+    b = (struct builtin *) dlsym(handle, struct_name);
+    if (b == NULL) {
+      fprintf(stderr, _("mpi_init: failed to find %s in %s\n"),
+              struct_name, self_info.dli_fname);
+      free(added);
+      return EXECUTION_FAILURE;
+    }
+    b->flags &= ~STATIC_BUILTIN;
+    b->handle = (char *) handle;
+    old = builtin_address_internal(*name, 1);
+    if (old != NULL)
+      memcpy(old, b, sizeof(struct builtin));
+    else
+      added[nadded++] = b;
+  }
+
+  /* Append the new builtins to the table in a single step. */
+  if (nadded > 0) {
+    table = malloc((num_shell_builtins + nadded + 1)*sizeof(struct builtin));
+    memcpy(table, shell_builtins, num_shell_builtins*sizeof(struct builtin));
+    for (i = 0; i < nadded; i++)
+      memcpy(&table[num_shell_builtins + i], added[i], sizeof(struct builtin));
+    memset(&table[num_shell_builtins + nadded], 0, sizeof(struct builtin));
+    if (shell_builtins != static_shell_builtins)
+      free(shell_builtins);
+    shell_builtins = table;
+    num_shell_builtins += nadded;
+    initialize_shell_builtins();
+  }
+  free(added);
+  return EXECUTION_SUCCESS;
+}
+
 /* Look up a user-provided callback function. */
 int
 mpibash_find_callback_function (WORD_LIST *list, SHELL_VAR **user_func)
@@ -113,3 +230,126 @@ mpibash_find_callback_function (WORD_LIST *list, SHELL_VAR **user_func)
   }
   return EXECUTION_SUCCESS;
 }
+
+/* Return the current time in seconds.  Unlike MPI_Wtime, this may be
+ * called before MPI is initialized. */
+double
+mpibash_stats_clock (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* Return the statistics of every builtin used so far, in order of
+ * first use. */
+mpibash_stats_t *
+mpibash_stats_list (void)
+{
+  return stats_head;
+}
+
+/* Return the statistics of the running builtin or NULL if no builtin
+ * is running. */
+mpibash_stats_t *
+mpibash_stats_current (void)
+{
+  return stats_current;
+}
+
+/* Return the statistics of the builtin called NAME, creating an empty
+ * entry if this is its first use. */
+mpibash_stats_t *
+mpibash_stats_lookup (const char *name)
+{
+  mpibash_stats_t *stats;
+
+  for (stats = stats_head; stats != NULL; stats = stats->next)
+    if (!strcmp(stats->name, name))
+      return stats;
+  stats = calloc(1, sizeof(mpibash_stats_t));
+  stats->name = strdup(name);
+  if (stats_tail == NULL)
+    stats_head = stats;
+  else
+    stats_tail->next = stats;
+  stats_tail = stats;
+  return stats;
+}
+
+/* Begin charging time, messages, and bytes to the builtin called NAME,
+ * whose statistics are cached in *STATS.  Remember in FRAME what to
+ * restore when the builtin finishes. */
+void
+mpibash_stats_enter (mpibash_stats_t **stats, const char *name,
+                     mpibash_stats_frame_t *frame)
+{
+  if (*stats == NULL)
+    *stats = mpibash_stats_lookup(name);
+  (*stats)->calls++;
+  frame->prev = stats_current;
+  frame->start = mpibash_stats_clock();
+  stats_current = *stats;
+}
+
+/* Finish charging the running builtin and resume charging the one it
+ * interrupted, if any. */
+void
+mpibash_stats_leave (mpibash_stats_frame_t *frame)
+{
+  stats_current->wall += mpibash_stats_clock() - frame->start;
+  stats_current = frame->prev;
+}
+
+/* Make builtins defined in this plugin hold MPI-Bash's builtin lock
+ * instead of their own.  Because plugins are loaded privately, find
+ * MPI-Bash's copy via the plugin that defines mpi_init.  Return 0 if
+ * MPI-Bash is loaded but its lock can't be found, 1 otherwise. */
+int
+mpibash_share_builtin_lock (void)
+{
+  struct builtin *mpi_init;     /* MPI-Bash's mpi_init builtin */
+  pthread_mutex_t **lock;       /* MPI-Bash's mpibash_builtin_lock */
+
+  if (builtin_address_internal == NULL)
+    return 1;
+  mpi_init = builtin_address_internal("mpi_init", 1);
+  if (mpi_init == NULL || mpi_init->handle == NULL)
+    return 1;
+  lock = (pthread_mutex_t **) dlsym(mpi_init->handle, "mpibash_builtin_lock");
+  if (lock == NULL)
+    return 0;
+  builtin_lock_ref = lock;
+  return 1;
+}
+
+/* Invoke builtin FUNC, called NAME, on LIST, charging it for the time
+ * it takes.  Keep the progress thread, if any, out of MPI-Bash's
+ * state for the duration. */
+int
+mpibash_stats_call (mpibash_stats_t **stats, const char *name,
+                    sh_builtin_func_t *func, WORD_LIST *list)
+{
+  mpibash_stats_frame_t frame;  /* Builtin we interrupted */
+  pthread_mutex_t *lock = *builtin_lock_ref;      /* Lock to hold, if any */
+  int result;
+
+  if (lock != NULL)
+    pthread_mutex_lock(lock);
+  mpibash_stats_enter(stats, name, &frame);
+  result = func(list);
+  mpibash_stats_leave(&frame);
+  if (lock != NULL)
+    pthread_mutex_unlock(lock);
+  return result;
+}
+
+/* Charge the time since START to the running builtin as time spent
+ * waiting within MPI. */
+void
+mpibash_stats_wait (double start)
+{
+  if (stats_current != NULL)
+    stats_current->wait += mpibash_stats_clock() - start;
+}